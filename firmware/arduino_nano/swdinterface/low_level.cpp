@@ -82,55 +82,72 @@ bool SWDInterfaceBase::readBit()
 #endif
 
 
-void SWDInterfaceBase::writeByte(uint8_t data)
+void SWDInterfaceBase::shiftOut(uint32_t bits, uint8_t count)
 {
-  for(uint8_t i=0; i<8; i++)
+  for(uint8_t i=0; i<count; i++)
   {
-    writeBit((data & 1) != 0);
-    data >>= 1;
+    writeBit((bits & 1) != 0);
+    bits >>= 1;
   }
 }
 
-void SWDInterfaceBase::writeWord32(uint32_t data)
+uint32_t SWDInterfaceBase::shiftIn(uint8_t count)
 {
-  for(uint8_t i=0; i<32; i++)
+  uint32_t bits = 0;
+  for(uint8_t i=0; i<count; i++)
   {
-    writeBit((data & 1) != 0);
-    data >>= 1;
+    if (readBit())
+      bits |= ((uint32_t)1) << i;
   }
+  return bits;
 }
 
-uint8_t SWDInterfaceBase::readAck()
+void SWDInterfaceBase::writeByte(uint8_t data)
 {
-  uint8_t swdcode = 0;
-
-  configDataPin(false); // input
-
-  if (readBit())
-    swdcode |= 1;
-
-  if (readBit())
-    swdcode |= 2;
+  shiftOut(data, 8);
+}
 
-  if (readBit())
-    swdcode |= 4;
+void SWDInterfaceBase::writeWord32(uint32_t data)
+{
+  shiftOut(data, 32);
+}
 
-  return swdcode;
+uint8_t SWDInterfaceBase::readAck()
+{
+  configDataPin(false); // input
+  return shiftIn(3);
 }
 
 void SWDInterfaceBase::lineReset()
 {
   configDataPin(true); // set as output
-  for(int8_t i=0; i<64; i++)
-    writeBit(true);
+  shiftOut(0xFFFFFFFF, 32);
+  shiftOut(0xFFFFFFFF, 32);
 }
 
 void SWDInterfaceBase::lineIdle()
 {
   setDataPin(false);
   configDataPin(true); // set as output
-  for(int8_t i=0; i<8; i++)
-    writeBit(false);
+  shiftOut(0, 8);
+}
+
+uint16_t SWDInterfaceBase::makeRequest(bool APnDP, bool RnW, uint8_t address)
+{
+  bool A2 = (address & 0x01) > 0;
+  bool A3 = (address & 0x02) > 0;
+  bool parity = APnDP ^ RnW ^ A2 ^ A3;
+
+  uint16_t request = 0;           // zero bit (to allow for start bit detection)
+  request |= 1 << 1;              // start bit
+  request |= APnDP ? (1 << 2) : 0;
+  request |= RnW ? (1 << 3) : 0;
+  request |= A2 ? (1 << 4) : 0;
+  request |= A3 ? (1 << 5) : 0;
+  request |= parity ? (1 << 6) : 0;
+                                  // stop bit (0)
+  request |= 1 << 8;              // park bit
+  return request;
 }
 
 uint8_t SWDInterfaceBase::doConnect(uint32_t &idcode)
@@ -164,38 +181,23 @@ uint8_t SWDInterfaceBase::doReadTransaction(bool APnDP, uint8_t address, uint32_
    *  10) read 32 bit, LSB first
    *  11) turn-around
    *  12) line idle
+   *
+   *  Steps 1-7 are shifted out in one go, as are the
+   *  turn-around and response code (8) and the turn-around
+   *  and line idle at the end (11,12).
    */
   configDataPin(true);  // output
-  writeBit(false);      // start with a zero bit
-
-  bool parity = 1 ^ APnDP ^ ((address & 0x01) > 0) ^ ((address & 0x02) > 0);
-
-  writeBit(true);       // start bit
-  writeBit(APnDP);
-  writeBit(true);       // read operation
-  writeBit( (address & 0x01) > 0);
-  writeBit( (address& 0x02) > 0);
-  writeBit(parity);
-  writeBit(false);      // stop bit
-  writeBit(true);       // park bit
+  shiftOut(makeRequest(APnDP, true, address), 9);
 
   configDataPin(false); // input
-  readBit();            // turn-around
-
-  uint8_t swdcode = readAck();
+  uint8_t swdcode = (shiftIn(4) >> 1) & 0x07;  // turn-around + ack
 
   // check the acknowledge status
   if (swdcode == SWD_OK)
   {
-    data = 0;
-    for(uint8_t i=0; i<32; i++)
-    {
-      data >>= 1;
-      if (readBit())
-        data |= 0x80000000;
-    }
-  
-    parity = readBit();
+    data = shiftIn(32);
+
+    bool parity = shiftIn(1);
     if (calcParity(data) != parity)
     {
       //FIXME: what to do?
@@ -204,12 +206,11 @@ uint8_t SWDInterfaceBase::doReadTransaction(bool APnDP, uint8_t address, uint32_
       swdcode = 4;
     }
   
-    // turn-around
+    // turn-around and line idle so the
+    // SWD subsystem can process the transaction
+    setDataPin(false);
     configDataPin(true);
-    writeBit(false);
-  
-    // line idle so the SWD subsystem can process the transaction
-    lineIdle();
+    shiftOut(0, 9);
     setDataPin(true);
       
     return swdcode; 
@@ -217,7 +218,7 @@ uint8_t SWDInterfaceBase::doReadTransaction(bool APnDP, uint8_t address, uint32_
   else if ((swdcode == SWD_FAIL) || (swdcode == SWD_WAIT))
   {
     // turn-around    
-    readBit();
+    shiftIn(1);
     configDataPin(true);
     //lineIdle();
     setDataPin(true);
@@ -226,10 +227,8 @@ uint8_t SWDInterfaceBase::doReadTransaction(bool APnDP, uint8_t address, uint32_
 
   // protocol error..
   // eat data + parity bit 
-  for(uint8_t i=0; i<33; i++)
-  {
-    readBit();
-  }
+  shiftIn(32);
+  shiftIn(1);
   
   //setDataPin(false);
   //configDataPin(true);
@@ -259,46 +258,36 @@ uint8_t SWDInterfaceBase::doWriteTransaction(bool APnDP, uint8_t address, uint32
    *  11) write 32 bit, LSB first
    *  12) write parity bit
    *  12b) line idle
+   *
+   *  Steps 1-7 are shifted out in one go, as are the
+   *  turn-around and response code (8) and the parity
+   *  bit and line idle at the end (12,12b).
    */
   configDataPin(true);  // output
-  writeBit(false);      // start with a zero bit
-
-  bool parity = 0 ^ APnDP ^ ((address & 0x01) > 0) ^ ((address & 0x02) > 0);
-
-  writeBit(true);       // start bit
-  writeBit(APnDP);
-  writeBit(false);      // write operation
-  writeBit( (address & 0x01) > 0);
-  writeBit( (address & 0x02) > 0);
-  writeBit(parity);
-  writeBit(false);      // stop bit
-  writeBit(true);       // park bit
+  shiftOut(makeRequest(APnDP, false, address), 9);
 
   configDataPin(false); // input
-  readBit();            // turn-around
-
-  uint8_t swdcode = readAck();
+  uint8_t swdcode = (shiftIn(4) >> 1) & 0x07;  // turn-around + ack
 
   // check the acknowledge status
   if (swdcode == SWD_OK)
   {
     // turn around
-    readBit(); 
+    shiftIn(1);
     configDataPin(true);  // output
         
-    writeWord32(data);
-  
-    writeBit(calcParity(data));
+    shiftOut(data, 32);
   
-    // line idle so the SWD subsystem can process the transaction
-    lineIdle();
+    // parity bit followed by line idle so the
+    // SWD subsystem can process the transaction
+    shiftOut(calcParity(data), 9);
     setDataPin(true);
     return swdcode;   
   }
   else if ((swdcode == SWD_FAIL) || (swdcode == SWD_WAIT))
   {
     // turn around    
-    readBit();  
+    shiftIn(1);  
     configDataPin(true);  // output
     //lineIdle();
     setDataPin(true);
@@ -307,10 +296,8 @@ uint8_t SWDInterfaceBase::doWriteTransaction(bool APnDP, uint8_t address, uint32
 
   // protocol error..
   // eat data + parity bit 
-  for(uint8_t i=0; i<33; i++)
-  {
-    readBit();
-  }
+  shiftIn(32);
+  shiftIn(1);
   
   //setDataPin(false);
   //configDataPin(true);
@@ -74,6 +74,21 @@ class SWDInterfaceBase
     /** wait for 1/2 a bit time */
     virtual void doDelay() = 0;
 
+    /** shift 'count' bits (1..32) out on the data pin, LSB first.
+     *  The data pin must already be configured as an output.
+     *  The default implementation bit-bangs through writeBit();
+     *  backends with shift register hardware (SPI, USART in
+     *  SPI mode) can override this.
+     */
+    virtual void shiftOut(uint32_t bits, uint8_t count);
+
+    /** shift 'count' bits (1..32) in from the data pin, LSB first.
+     *  The data pin must already be configured as an input.
+     *  The result is right-aligned.
+     *  The default implementation bit-bangs through readBit().
+     */
+    virtual uint32_t shiftIn(uint8_t count);
+
     /** write a single bit to the data pin */
     void writeBit(bool v);
 
@@ -100,6 +115,11 @@ class SWDInterfaceBase
 
     /** calculate the odd parity for a 32-bit data word */
     uint32_t calcParity(uint32_t data);
+
+    /** build the request header, LSB first, including the
+     *  leading zero bit: 9 bits in total.
+     */
+    uint16_t makeRequest(bool APnDP, bool RnW, uint8_t address);
 };
 
 #endif
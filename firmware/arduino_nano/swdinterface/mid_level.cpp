@@ -117,7 +117,7 @@ uint8_t ArduinoSWDInterface::writeAP(uint32_t address, uint32_t data)
     }
 }
 
-uint8_t ArduinoSWDInterface::readAP(uint32_t address, uint32_t &data)
+uint8_t ArduinoSWDInterface::readAPPosted(uint32_t address, uint32_t &data)
 {
     uint8_t retval = selectAP(address);
     if (retval != RXCMD_STATUS_OK)
@@ -133,6 +133,15 @@ uint8_t ArduinoSWDInterface::readAP(uint32_t address, uint32_t &data)
     }
     if (retval != SWD_OK)
       return RXCMD_STATUS_SWDFAULT;
+
+    return RXCMD_STATUS_OK;
+}
+
+uint8_t ArduinoSWDInterface::readAP(uint32_t address, uint32_t &data)
+{
+    uint8_t retval = readAPPosted(address, data);
+    if (retval != RXCMD_STATUS_OK)
+        return retval;
     
     return readDP(DP_RDBUFF, data);
 }
@@ -188,6 +197,90 @@ uint8_t ArduinoSWDInterface::writeMemory(uint32_t address, uint32_t data)
   return writeAP(AHB_AP_DATA, data);
 }
 
+uint8_t ArduinoSWDInterface::readMemoryBlock(uint32_t address, uint32_t words, void (*handler)(uint32_t data))
+{
+  uint8_t retval;
+
+  if ((retval=writeAP(AHB_AP_CSW, 0x22000012)) != RXCMD_STATUS_OK)
+    return retval;
+
+  if ((retval=waitForMemory()) != RXCMD_STATUS_OK)
+    return retval;
+
+  // The data register reads are posted: each read returns
+  // the result of the previous one, the last result is
+  // fetched from RDBUFF. This way a word costs a single
+  // SWD transaction.
+  bool pending = false;
+  uint32_t data;
+  while(words > 0)
+  {
+    if (!pending)
+    {
+      if ((retval=writeAP(AHB_AP_TAR, address)) != RXCMD_STATUS_OK)
+        return retval;
+    }
+
+    if ((retval=readAPPosted(AHB_AP_DATA, data)) != RXCMD_STATUS_OK)
+      return retval;
+
+    if (pending)
+      handler(data);
+
+    pending = true;
+    address += 4;
+    words--;
+
+    // TAR is only guaranteed to auto-increment within
+    // a 1KB block, so flush the pipeline and reload it.
+    if (((address & 0x3FF) == 0) || (words == 0))
+    {
+      if ((retval=readDP(DP_RDBUFF, data)) != RXCMD_STATUS_OK)
+        return retval;
+      handler(data);
+      pending = false;
+    }
+  }
+  return RXCMD_STATUS_OK;
+}
+
+uint8_t ArduinoSWDInterface::writeMemoryBlock(uint32_t address, uint32_t words, const uint8_t *data, void (*handler)())
+{
+  uint8_t retval;
+
+  if ((retval=writeAP(AHB_AP_CSW, 0x22000012)) != RXCMD_STATUS_OK)
+    return retval;
+
+  if ((retval=waitForMemory()) != RXCMD_STATUS_OK)
+    return retval;
+
+  bool first = true;
+  while(words > 0)
+  {
+    // TAR is only guaranteed to auto-increment within
+    // a 1KB block, reload it at every block boundary.
+    if (first || ((address & 0x3FF) == 0))
+    {
+      if ((retval=writeAP(AHB_AP_TAR, address)) != RXCMD_STATUS_OK)
+        return retval;
+      first = false;
+    }
+
+    uint32_t w = data[0];
+    w |= ((uint32_t)data[1]) << 8;
+    w |= ((uint32_t)data[2]) << 16;
+    w |= ((uint32_t)data[3]) << 24;
+    if ((retval=writeAP(AHB_AP_DATA, w)) != RXCMD_STATUS_OK)
+      return retval;
+    handler();
+
+    data += 4;
+    address += 4;
+    words--;
+  }
+  return RXCMD_STATUS_OK;
+}
+
 uint8_t ArduinoSWDInterface::waitMemoryTrue(uint32_t address, uint32_t data, uint32_t mask)
 {
   uint8_t retval;
@@ -57,6 +57,17 @@ class ArduinoSWDInterface : private SWDInterfaceBase
     /** read from a debug port */
     uint8_t readDP(uint32_t address, uint32_t &data);
 
+    /** Read a block of memory words using address auto-increment.
+     *  handler is called for every word read, in order.
+     */
+    uint8_t readMemoryBlock(uint32_t address, uint32_t words, void (*handler)(uint32_t data));
+
+    /** Write a block of memory words using address auto-increment.
+     *  data points to the little-endian words to write.
+     *  handler is called after every word written.
+     */
+    uint8_t writeMemoryBlock(uint32_t address, uint32_t words, const uint8_t *data, void (*handler)());
+
     /** wait until data at memory address equals (data & mask) */
     uint8_t waitMemoryTrue(uint32_t address, uint32_t data, uint32_t mask);
 
@@ -72,6 +83,11 @@ class ArduinoSWDInterface : private SWDInterfaceBase
     /** set the current the access port */
     uint8_t selectAP(uint32_t address);
 
+    /** issue an access port read without fetching the result:
+     *  data will contain the result of the previous access port read.
+     */
+    uint8_t readAPPosted(uint32_t address, uint32_t &data);
+
     //
     // pin related functions
     //
@@ -48,6 +48,10 @@
 #define TXCMD_TYPE_READMEM      6   // read a memory address
 #define TXCMD_TYPE_WRITEMEM     7   // write to a memory address
 #define TXCMD_TYPE_WAITMEMTRUE  8   // wait for memory contents
+#define TXCMD_TYPE_WAITMEMFALSE 9   // wait for memory contents
+#define TXCMD_TYPE_CHECKSUMMEM  10  // CRC32 over a memory range
+#define TXCMD_TYPE_READMEMBLOCK 11  // read consecutive memory words
+#define TXCMD_TYPE_WRITEMEMBLOCK 12 // write consecutive memory words
 
 #define TXCMD_TYPE_GETPROGID    0xFF // get programmer ID string (appended after HardwareRXCommand struct)
 
@@ -22,11 +22,32 @@
 
 const uint32_t MAX_RETRIES = 100;
 
-uint8_t g_rxbuffer[64]; // packet receive buffer
-uint8_t g_rxidx = 0;    // read index into receive buffer
-
-uint8_t g_txbuffer[64]; // packet transmit buffer
-uint8_t g_txidx = 1;    // write index into transmit buffer,
+#define RXBUFFERS   2       // number of packet receive buffers
+#define RXBUFSIZE   256     // size of each receive buffer (decoded bytes)
+#define RXOVERFLOW  0xFFFF  // packet length marker for an overflowed packet
+#define RXPROTOERR  0xFFFE  // packet length marker for a malformed packet
+#define TXBUFSIZE   256     // size of the transmit buffer, including the status byte
+
+// Packets are received into one buffer while the
+// previously received packet is executed from the
+// other one, so the host can send the next packet
+// before the reply to the current one arrives.
+//
+// The packets are COBS decoded on the fly, so the
+// buffers hold decoded data only.
+uint8_t  g_rxbuffer[RXBUFFERS][RXBUFSIZE];  // packet receive buffers
+uint16_t g_rxlen[RXBUFFERS];        // decoded packet length
+bool     g_rxready[RXBUFFERS];      // buffer holds a complete packet
+uint8_t g_rxhead = 0;   // buffer currently being received into
+uint8_t g_rxtail = 0;   // buffer holding the next packet to execute
+uint16_t g_rxidx = 0;   // write index into the head receive buffer
+bool g_rxdiscard = false; // discard bytes until the next zero byte
+
+uint8_t g_cobsLeft = 0;     // data bytes left in the current COBS block
+bool g_cobsZero = false;    // the current COBS block ends in a zero
+
+uint8_t g_txbuffer[TXBUFSIZE]; // packet transmit buffer
+uint16_t g_txidx = 1;   // write index into transmit buffer,
                         // leave room for status byte at
                         // the beginning so it can be
                         // added later.
@@ -39,75 +60,13 @@ uint8_t g_txidx = 1;    // write index into transmit buffer,
 
 ArduinoSWDInterface *g_interface = 0;
 
-// *********************************************************
-//   COBS decoder (source: wikipedia)
-//
-//   Returns the number of bytes decoded.
-//
-// *********************************************************
-
-uint32_t UnStuffData(const uint8_t *ptr, uint8_t N, uint8_t *dst)
-{
-  uint32_t bytes = 0;
-  const uint8_t *endptr = ptr + N;
-  while (ptr < endptr)
-  {
-    uint8_t code = *ptr++;
-    
-    for (uint32_t i=1; (ptr<endptr) && (i<code); i++)
-    {
-      *dst++ = *ptr++;
-      bytes++;
-    }
-      
-    if (code < 0xFF)
-    {
-      *dst++ = 0;
-      bytes++;
-    }
-  }
-  return bytes;
-}
-
-// *********************************************************
-//   COBS encoder (source: wikipedia)
-//
-//   Appends a zero terminator byte at the end of the 
-//   encoded result
-// *********************************************************
-
-#define FinishBlock(X) (*code_ptr = (X), code_ptr = dst++, code = 0x01)
-
-void StuffData(const uint8_t *ptr, uint8_t N, uint8_t *dst)
-{
-  const unsigned char *endptr = ptr + N;
-  unsigned char *code_ptr = dst++;
-  unsigned char code = 0x01;
-
-  while (ptr < endptr)
-  {
-    if (*ptr == 0)
-      FinishBlock(code);
-    else
-    {
-      *dst++ = *ptr;
-      if (++code == 0xFF)
-        FinishBlock(code);
-    }
-    ptr++;
-  }
-
-  *dst = 0;
-  FinishBlock(code);  
-}
-
 // *********************************************************
 //   Get a uint32_t from memory address,
 //   can be unaligned!
 // *********************************************************
 
 
-uint32_t getUInt32(uint8_t *ptr)
+uint32_t getUInt32(const uint8_t *ptr)
 {
   uint32_t w = ptr[0];
   w |= ((uint32_t)ptr[1]) << 8;
@@ -144,7 +103,7 @@ bool queueReplyUInt8(uint8_t b)
 
 bool queueReplyUInt32(uint32_t w)
 {
-  if ((g_txidx+4) >= sizeof(g_txbuffer))
+  if ((g_txidx+4) > sizeof(g_txbuffer))
   {
     return false; // TX buffer overflow
   }
@@ -162,19 +121,43 @@ bool queueReplyUInt32(uint32_t w)
 // *********************************************************
 //   Send reply
 //
-//   COBS encodes all the queued data and sends it.
+//   COBS encodes all the queued data and sends it,
+//   block by block, straight from the transmit buffer.
 //
 // *********************************************************
 
+void sendBlock(uint8_t code, uint16_t blockStart)
+{
+  Serial.write(code);
+  Serial.write(&g_txbuffer[blockStart], code-1);
+}
+
 void sendReply(uint8_t replyStatus)
 {
-  uint8_t encodebuffer[sizeof(g_txbuffer)+2];
-  
-  // Send COBS encoded packet 
   g_txbuffer[0] = replyStatus;
-  StuffData((uint8_t*)&g_txbuffer, g_txidx, encodebuffer);
-  Serial.write((char*)encodebuffer, strlen((char*)encodebuffer)+1);
-  Serial.flush(); // wait for TX to be done. (do we need this?)
+
+  uint8_t code = 1;
+  uint16_t blockStart = 0;
+  for(uint16_t idx=0; idx<g_txidx; idx++)
+  {
+    if (g_txbuffer[idx] == 0)
+    {
+      sendBlock(code, blockStart);
+      code = 1;
+      blockStart = idx+1;
+    }
+    else if (++code == 0xFF)
+    {
+      sendBlock(code, blockStart);
+      code = 1;
+      blockStart = idx+1;
+    }
+  }
+  sendBlock(code, blockStart);
+  Serial.write((uint8_t)0);
+
+  // note: no Serial.flush() here, the reply is sent
+  // while the next packet is being executed.
 
   g_txidx = 1; // reset tx index, leave room for status byte.
 }
@@ -202,197 +185,362 @@ void setup()
   digitalWrite(GND_PIN, LOW);
 }
 
-void loop() 
+// *********************************************************
+//   Receive packets
+//
+//   Drains the serial port into the free receive buffer
+//   and COBS decodes the bytes as they arrive. Must be
+//   called regularly, also while a packet is being
+//   executed.
+// *********************************************************
+
+void storeRxByte(uint8_t b)
 {
-  // read data from the serial port
-  // until we get a zero byte
-  // now we have a complete packet 
-  // in the buffer
-  while (Serial.available()) 
+  if (g_rxidx >= RXBUFSIZE)
+  {
+    // overflow! discard the rest of this packet
+    g_rxdiscard = true;
+    return;
+  }
+  g_rxbuffer[g_rxhead][g_rxidx++] = b;
+}
+
+void serviceSerial()
+{
+  // stop reading when all buffers are full,
+  // the serial driver will hold on to the data
+  while (!g_rxready[g_rxhead] && Serial.available())
   {
     uint8_t byteRead = Serial.read();
 
     if (byteRead != 0)
     {
-      // store byte, check for overflow! 
-      if (g_rxidx >= sizeof(g_rxbuffer))
+      if (g_rxdiscard)
+        continue;
+
+      if (g_cobsLeft == 0)
       {
-        // overflow!
-        g_txidx = 1; // discard previous information
-        g_rxidx = 0; // avoid buffer overrun
-        sendReply(RXCMD_STATUS_RXOVERFLOW);
-        return;
+        // COBS code byte: emit the zero that ended
+        // the previous block, if any.
+        if (g_cobsZero)
+          storeRxByte(0);
+        g_cobsLeft = byteRead - 1;
+        g_cobsZero = (byteRead < 0xFF);
       }
-      g_rxbuffer[g_rxidx++] = byteRead;
-    }    
+      else
+      {
+        storeRxByte(byteRead);
+        g_cobsLeft--;
+      }
+    }
     else
-    {      
-      digitalWrite(13, HIGH);
-      
-      //decode COBS packet      
-      uint8_t decodebuffer[sizeof(g_rxbuffer)]; // decode bytes is always less than encoded bytes..
-      uint32_t bytes = UnStuffData(g_rxbuffer, g_rxidx, decodebuffer);
-      bytes--; // remove the zero terminator to avoid triggering additional commands..       
-      uint8_t *ptr = (uint8_t*)decodebuffer;
-      uint8_t *endptr = ((uint8_t*)decodebuffer) + bytes;
+    {
+      // end of packet, the zero ending the last
+      // block is the terminator and is dropped.
+      if (g_rxdiscard)
+        g_rxlen[g_rxhead] = RXOVERFLOW;
+      else if (g_cobsLeft != 0)
+        g_rxlen[g_rxhead] = RXPROTOERR;   // truncated block
+      else
+        g_rxlen[g_rxhead] = g_rxidx;
+
+      g_rxready[g_rxhead] = true;
       g_rxidx = 0;
+      g_rxdiscard = false;
+      g_cobsLeft = 0;
+      g_cobsZero = false;
+      g_rxhead = (g_rxhead + 1) % RXBUFFERS;
+    }
+  }
+}
 
-      while(ptr < endptr)
-      {      
-        // execute command
-        uint32_t data32, address, mask32, retries;
-        uint8_t data8, stat;
-        switch(ptr[0])
-        {          
-          default:  // unknown command, abort & send reply
-            queueReplyUInt32(0xDEADBEEF);
-            sendReply(RXCMD_STATUS_UNKNOWNCMD);
-            return;
-          case TXCMD_TYPE_RESET:
-            // set target reset
-            g_interface->setReset(ptr[1] > 0);
-            ptr += 2;
-            break;
-          case TXCMD_TYPE_CONNECT:
-            stat = g_interface->tryConnect(data32);
-            if (stat == RXCMD_STATUS_OK)
-            {
-              ptr++;              
-              queueReplyUInt32(data32); // IDCODE              
-            }
-            else
-            {
-              sendReply(stat);
-              return;
-            }
-            break;
-          case TXCMD_TYPE_READDP:
-            address = ptr[1];
-            stat = g_interface->readDP(address, data32);
-            if (stat == RXCMD_STATUS_OK)
-            {
-              queueReplyUInt32(data32);
-              ptr+=2;
-            }
-            else
-            {
-              sendReply(stat);
-              return;
-            }
-            break;
-          case TXCMD_TYPE_WRITEDP:
-            address = ptr[1];
-            data32 = getUInt32(ptr+2);
-            stat = g_interface->writeDP(address, data32);
-            if (stat == RXCMD_STATUS_OK)
-            {
-              ptr+=6;    // 1 cmd byte, 1 byte address, 1 32-bit word
-            }
-            else
-            {
-              sendReply(stat);
-              return;
-            }
-            break;           
-          case TXCMD_TYPE_READAP:
-            address = getUInt32(ptr+1);
-            stat = g_interface->readAP(address, data32);
-            if (stat == RXCMD_STATUS_OK)
-            {
-              queueReplyUInt32(data32);
-              ptr+=5;    // 1 cmd byte, 1 32-bit word address
-            }
-            else
-            {
-              sendReply(stat);
-              return;
-            }
-            break;
-          case TXCMD_TYPE_WRITEAP:
-            address = getUInt32(ptr+1);
-            data32 = getUInt32(ptr+5);
-            stat = g_interface->writeAP(address, data32);
-            if (stat == RXCMD_STATUS_OK)
-            {
-              ptr+=9;    // 1 cmd byte, 2 32-bit words
-            }
-            else
-            {
-              sendReply(stat);
-              return;
-            }
-            break;
-          case TXCMD_TYPE_READMEM:
-            address = getUInt32(ptr+1);
-            stat = g_interface->readMemory(address, data32);
-            if (stat == RXCMD_STATUS_OK)
-            {
-              queueReplyUInt32(data32);
-              ptr+=5;    // 1 cmd byte, 1 32-bit address
-            }
-            else
-            {
-              sendReply(stat);
-              return;
-            }
-            break;
-          case TXCMD_TYPE_WAITMEMTRUE:
-            address = getUInt32(ptr+1);
-            mask32  = getUInt32(ptr+5);
-            retries = 0;
-            while(retries < MAX_RETRIES)
-            {
-              stat = g_interface->readMemory(address, data32);
-              if (stat == RXCMD_STATUS_OK)
-              {                
-                if ((data32 & mask32) == mask32)
-                {
-                  ptr+=9;   // 1 cmd byte, 2 32-bit data
-                  break;    // break out of while loop       
-                }
-              }
-              else
-              {
-                sendReply(stat);
-                return;
-              }
-              retries++;
-            }
-            if (retries == MAX_RETRIES)
-            {
-              sendReply(RXCMD_STATUS_TIMEOUT);
-            }            
-            break;          
-          case TXCMD_TYPE_WRITEMEM:
-            address = getUInt32(ptr+1);
-            data32 = getUInt32(ptr+5);
-            stat = g_interface->writeMemory(address, data32);
-            if (stat == RXCMD_STATUS_OK)
-            {
-              ptr+=9;    // 1 cmd byte, 1 32-bit address, 1 32-bit data
-            }
-            else
+// *********************************************************
+//   CRC32 (IEEE 802.3, reflected) over memory words,
+//   bytes are processed in little-endian order.
+// *********************************************************
+
+uint32_t g_crc;
+
+void crcWord(uint32_t w)
+{
+  for(uint8_t i=0; i<32; i++)
+  {
+    if ((g_crc ^ w) & 1)
+      g_crc = (g_crc >> 1) ^ 0xEDB88320;
+    else
+      g_crc >>= 1;
+    w >>= 1;
+  }
+
+  // checksumming can take a while,
+  // keep receiving the next packet
+  serviceSerial();
+}
+
+// *********************************************************
+//   Queue a word read by READ MEMORY BLOCK
+// *********************************************************
+
+void replyWord(uint32_t w)
+{
+  queueReplyUInt32(w);
+
+  // a block can take a while,
+  // keep receiving the next packet
+  serviceSerial();
+}
+
+// *********************************************************
+//   Execute a decoded packet and send the reply
+// *********************************************************
+
+void executePacket(const uint8_t *ptr, uint16_t len)
+{
+  const uint8_t *endptr = ptr + len;
+
+  while(ptr < endptr)
+  {
+    // keep receiving the next packet
+    serviceSerial();
+
+    // execute command
+    uint32_t data32, address, mask32, retries;
+    uint8_t stat;
+    switch(ptr[0])
+    {          
+      default:  // unknown command, abort & send reply
+        queueReplyUInt32(0xDEADBEEF);
+        sendReply(RXCMD_STATUS_UNKNOWNCMD);
+        return;
+      case TXCMD_TYPE_RESET:
+        // set target reset
+        g_interface->setReset(ptr[1] > 0);
+        ptr += 2;
+        break;
+      case TXCMD_TYPE_CONNECT:
+        stat = g_interface->tryConnect(data32);
+        if (stat == RXCMD_STATUS_OK)
+        {
+          ptr++;              
+          queueReplyUInt32(data32); // IDCODE              
+        }
+        else
+        {
+          sendReply(stat);
+          return;
+        }
+        break;
+      case TXCMD_TYPE_READDP:
+        address = ptr[1];
+        stat = g_interface->readDP(address, data32);
+        if (stat == RXCMD_STATUS_OK)
+        {
+          queueReplyUInt32(data32);
+          ptr+=2;
+        }
+        else
+        {
+          sendReply(stat);
+          return;
+        }
+        break;
+      case TXCMD_TYPE_WRITEDP:
+        address = ptr[1];
+        data32 = getUInt32(ptr+2);
+        stat = g_interface->writeDP(address, data32);
+        if (stat == RXCMD_STATUS_OK)
+        {
+          ptr+=6;    // 1 cmd byte, 1 byte address, 1 32-bit word
+        }
+        else
+        {
+          sendReply(stat);
+          return;
+        }
+        break;           
+      case TXCMD_TYPE_READAP:
+        address = getUInt32(ptr+1);
+        stat = g_interface->readAP(address, data32);
+        if (stat == RXCMD_STATUS_OK)
+        {
+          queueReplyUInt32(data32);
+          ptr+=5;    // 1 cmd byte, 1 32-bit word address
+        }
+        else
+        {
+          sendReply(stat);
+          return;
+        }
+        break;
+      case TXCMD_TYPE_WRITEAP:
+        address = getUInt32(ptr+1);
+        data32 = getUInt32(ptr+5);
+        stat = g_interface->writeAP(address, data32);
+        if (stat == RXCMD_STATUS_OK)
+        {
+          ptr+=9;    // 1 cmd byte, 2 32-bit words
+        }
+        else
+        {
+          sendReply(stat);
+          return;
+        }
+        break;
+      case TXCMD_TYPE_READMEM:
+        address = getUInt32(ptr+1);
+        stat = g_interface->readMemory(address, data32);
+        if (stat == RXCMD_STATUS_OK)
+        {
+          queueReplyUInt32(data32);
+          ptr+=5;    // 1 cmd byte, 1 32-bit address
+        }
+        else
+        {
+          sendReply(stat);
+          return;
+        }
+        break;
+      case TXCMD_TYPE_WAITMEMTRUE:
+        address = getUInt32(ptr+1);
+        mask32  = getUInt32(ptr+5);
+        retries = 0;
+        while(retries < MAX_RETRIES)
+        {
+          stat = g_interface->readMemory(address, data32);
+          if (stat == RXCMD_STATUS_OK)
+          {                
+            if ((data32 & mask32) == mask32)
             {
-              sendReply(stat);
-              g_rxidx = 0;
-              return;
+              ptr+=9;   // 1 cmd byte, 2 32-bit data
+              break;    // break out of while loop       
             }
-            break;
-          case TXCMD_TYPE_GETPROGID:
-            // get the programmer ID
-            queueReplyUInt8(0x01);                  // protocol version
-            queueReplyUInt8(sizeof(g_rxbuffer));    // rx buffer size
-            queueReplyUInt8(0);                     // rx buffer size (MSB)
-            ptr++;
-            break;
-        } // end switch      
-      } // end while
-      
-      // if we end up here, everything worked out
-      // and we can reply
-      sendReply(RXCMD_STATUS_OK);     
-       
-    } // byte zero read
-  } // while serial available
+          }
+          else
+          {
+            sendReply(stat);
+            return;
+          }
+          serviceSerial();
+          retries++;
+        }
+        if (retries == MAX_RETRIES)
+        {
+          sendReply(RXCMD_STATUS_TIMEOUT);
+          return;
+        }            
+        break;          
+      case TXCMD_TYPE_WRITEMEM:
+        address = getUInt32(ptr+1);
+        data32 = getUInt32(ptr+5);
+        stat = g_interface->writeMemory(address, data32);
+        if (stat == RXCMD_STATUS_OK)
+        {
+          ptr+=9;    // 1 cmd byte, 1 32-bit address, 1 32-bit data
+        }
+        else
+        {
+          sendReply(stat);
+          return;
+        }
+        break;
+      case TXCMD_TYPE_CHECKSUMMEM:
+        address = getUInt32(ptr+1);
+        data32  = getUInt32(ptr+5);   // number of bytes
+        g_crc = 0xFFFFFFFF;
+        stat = g_interface->readMemoryBlock(address, data32 >> 2, crcWord);
+        if (stat == RXCMD_STATUS_OK)
+        {
+          queueReplyUInt32(~g_crc);
+          ptr+=9;    // 1 cmd byte, 1 32-bit address, 1 32-bit length
+        }
+        else
+        {
+          sendReply(stat);
+          return;
+        }
+        break;
+      case TXCMD_TYPE_READMEMBLOCK:
+        // the words must fit in the rest of the reply
+        if ((endptr - ptr < 6) || (g_txidx + 4*(uint16_t)ptr[5] > TXBUFSIZE))
+        {
+          sendReply(RXCMD_STATUS_PROTOERR);
+          return;
+        }
+        address = getUInt32(ptr+1);
+        stat = g_interface->readMemoryBlock(address, ptr[5], replyWord);
+        if (stat == RXCMD_STATUS_OK)
+        {
+          ptr+=6;    // 1 cmd byte, 1 32-bit address, 1 byte word count
+        }
+        else
+        {
+          sendReply(stat);
+          return;
+        }
+        break;
+      case TXCMD_TYPE_WRITEMEMBLOCK:
+        // a bad word count would write the following
+        // commands into the target memory
+        if ((endptr - ptr < 6) || (endptr - ptr < 6 + 4*(uint16_t)ptr[5]))
+        {
+          sendReply(RXCMD_STATUS_PROTOERR);
+          return;
+        }
+        address = getUInt32(ptr+1);
+        stat = g_interface->writeMemoryBlock(address, ptr[5], ptr+6, serviceSerial);
+        if (stat == RXCMD_STATUS_OK)
+        {
+          ptr+=6+4*ptr[5];   // 1 cmd byte, 1 32-bit address, 1 byte word count, data
+        }
+        else
+        {
+          sendReply(stat);
+          return;
+        }
+        break;
+      case TXCMD_TYPE_GETPROGID:
+        // get the programmer ID
+        queueReplyUInt8(0x05);                    // protocol version
+        queueReplyUInt8(RXBUFSIZE & 0xFF);        // rx buffer size
+        queueReplyUInt8(RXBUFSIZE >> 8);          // rx buffer size (MSB)
+        queueReplyUInt8(RXBUFFERS);               // number of rx buffers
+        queueReplyUInt8((TXBUFSIZE-1) & 0xFF);    // max result data size
+        queueReplyUInt8((TXBUFSIZE-1) >> 8);      // max result data size (MSB)
+        ptr++;
+        break;
+    } // end switch      
+  } // end while
+
+  // if we end up here, everything worked out
+  // and we can reply
+  sendReply(RXCMD_STATUS_OK);     
 }
 
+void loop() 
+{
+  serviceSerial();
+
+  // execute the oldest complete packet, if any
+  if (g_rxready[g_rxtail])
+  {
+    digitalWrite(LEDPIN, HIGH);
+
+    if (g_rxlen[g_rxtail] == RXOVERFLOW)
+    {
+      g_txidx = 1; // discard previous information
+      sendReply(RXCMD_STATUS_RXOVERFLOW);
+    }
+    else if (g_rxlen[g_rxtail] == RXPROTOERR)
+    {
+      g_txidx = 1;
+      sendReply(RXCMD_STATUS_PROTOERR);
+    }
+    else
+    {
+      executePacket(g_rxbuffer[g_rxtail], g_rxlen[g_rxtail]);
+    }
+
+    g_rxready[g_rxtail] = false;
+    g_rxtail = (g_rxtail + 1) % RXBUFFERS;
+  }
+}
@@ -0,0 +1,132 @@
+/*
+
+  Swagger - A tool for programming ARM processors using the SWD protocol
+
+  Niels A. Moseley
+
+  This file describes the interface of native target driver plugins.
+
+  A plugin is a shared library that implements one or more target
+  drivers in C or C++, for parts that are too slow to program from
+  a script. The plugin exports one function, swaggerPluginInit,
+  that returns the drivers it implements. The drivers are added to
+  the targets array of the scripts, so to init.nut they look the
+  same as the targets written in Squirrel.
+
+  A driver talks to the programmer through the SwaggerHost it gets
+  with every call: it builds command packets of the TXCMD_xxx
+  commands of protocol.h and executes them, one packet at a time.
+
+  In gang mode several targets are programmed at the same time,
+  each from its own thread and with its own host. A driver must
+  then keep the state of an operation on the stack or per host
+  context, not in its driver context.
+
+  The interface is plain C, so plugins can be built with any
+  compiler. Structures are only ever extended at the end, and
+  SWAGGER_PLUGIN_API_VERSION is incremented when they are.
+
+*/
+
+#ifndef swagger_plugin_include_h
+#define swagger_plugin_include_h
+
+#include <stdint.h>
+
+#define SWAGGER_PLUGIN_API_VERSION  1
+
+#ifdef _WIN32
+#define SWAGGER_PLUGIN_EXPORT __declspec(dllexport)
+#else
+#define SWAGGER_PLUGIN_EXPORT __attribute__((visibility("default")))
+#endif
+
+// log levels, the same as the LOG_xxx constants of the scripts
+#define SWAGGER_LOG_DEBUG       0
+#define SWAGGER_LOG_INFO        1
+#define SWAGGER_LOG_WARNING     2
+#define SWAGGER_LOG_ERROR       3
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** a contiguous part of a firmware image */
+typedef struct SwaggerSegment
+{
+    uint32_t        address;    // target address of the first byte
+    uint32_t        size;       // in bytes
+    const uint8_t   *data;
+} SwaggerSegment;
+
+/** a firmware image, the segments are sorted by address */
+typedef struct SwaggerImage
+{
+    const SwaggerSegment    *segments;
+    uint32_t                segmentCount;
+} SwaggerImage;
+
+/** the services swagger offers to a driver */
+typedef struct SwaggerHost
+{
+    uint32_t    version;        // SWAGGER_PLUGIN_API_VERSION of the host
+    void        *context;       // pass this to the functions below
+
+    /** Execute a packet of commands and receive the result packet.
+        Returns the number of result bytes, or -1 if the packet
+        could not be sent or the result could not be received.
+        Results that do not fit in resultSize bytes are dropped.
+    */
+    int32_t (*execute)(void *context, const uint8_t *commands, uint32_t commandBytes,
+                       uint8_t *results, uint32_t resultSize);
+
+    /** Get the maximum command and result packet sizes of the
+        programmer. Returns 0 if the programmer did not tell.
+    */
+    int (*getPacketSizes)(void *context, uint32_t *commandBytes, uint32_t *resultBytes);
+
+    /** print a message if the level is at least the debug level */
+    void (*log)(void *context, int level, const char *message);
+
+    /** add bytes to the progress of the current operation */
+    void (*progress)(void *context, uint32_t bytes);
+
+    /** time in milliseconds */
+    uint32_t (*millis)(void *context);
+
+    void (*sleep)(void *context, uint32_t ms);
+} SwaggerHost;
+
+/** A target driver. All functions return 0 on success and -1 on
+    failure. Functions the driver does not implement are NULL:
+    the scripts use the generic implementation where there is
+    one, such as verifyFlash() for verify.
+*/
+typedef struct SwaggerTargetDriver
+{
+    const char  *name;          // target name, as used by the manifest
+    uint32_t    idcode;         // DP IDCODE
+    void        *context;       // passed to every function
+
+    int (*check)(void *context, const SwaggerHost *host);
+    int (*halt)(void *context, const SwaggerHost *host);
+    int (*reset)(void *context, const SwaggerHost *host, int state);
+    int (*erase)(void *context, const SwaggerHost *host);
+    int (*program)(void *context, const SwaggerHost *host, const SwaggerImage *image);
+    int (*verify)(void *context, const SwaggerHost *host, const SwaggerImage *image);
+} SwaggerTargetDriver;
+
+/** The entry point of a plugin, called once when it is loaded.
+    Returns a NULL-terminated array of drivers that stays valid
+    until the plugin is unloaded, or NULL if the plugin does not
+    support the API version of the host.
+*/
+typedef const SwaggerTargetDriver* const* (*SwaggerPluginInitFunc)(uint32_t apiVersion);
+
+#define SWAGGER_PLUGIN_INIT "swaggerPluginInit"
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // sentry
@@ -0,0 +1,67 @@
+/*
+
+  Swagger - A tool for programming ARM processors using the SWD protocol
+
+  Niels A. Moseley (c) Moseley Instruments 2016
+
+  Prepared command batches
+
+*/
+
+#include "cmdbatch.h"
+
+void CmdBatch::queueUInt32(uint32_t word)
+{
+    m_data.push_back(word & 0xFF); // LSB first
+    m_data.push_back((word>>8) & 0xFF);
+    m_data.push_back((word>>16) & 0xFF);
+    m_data.push_back((word>>24) & 0xFF);
+}
+
+void CmdBatch::queueSlot(const std::string &name, uint32_t base, uint32_t mask)
+{
+    Slot slot;
+    slot.offset = m_data.size();
+    slot.base = base;
+    slot.mask = mask;
+
+    slot.nameIdx = m_names.size();
+    for(size_t i=0; i<m_names.size(); i++)
+    {
+        if (m_names[i] == name)
+        {
+            slot.nameIdx = i;
+            break;
+        }
+    }
+    if (slot.nameIdx == m_names.size())
+    {
+        m_names.push_back(name);
+    }
+
+    m_slots.push_back(slot);
+    queueUInt32(base);
+}
+
+void CmdBatch::clear()
+{
+    m_data.clear();
+    m_slots.clear();
+    m_names.clear();
+    m_results.clear();
+    m_resultIdx = 0;
+}
+
+void CmdBatch::patch(const std::vector<uint32_t> &values, std::vector<uint8_t> &packet) const
+{
+    packet = m_data;
+    for(size_t i=0; i<m_slots.size(); i++)
+    {
+        const Slot &slot = m_slots[i];
+        uint32_t word = slot.base | (values[slot.nameIdx] & slot.mask);
+        packet[slot.offset]   = word & 0xFF;
+        packet[slot.offset+1] = (word>>8) & 0xFF;
+        packet[slot.offset+2] = (word>>16) & 0xFF;
+        packet[slot.offset+3] = (word>>24) & 0xFF;
+    }
+}
@@ -0,0 +1,86 @@
+/*
+
+  Swagger - A tool for programming ARM processors using the SWD protocol
+
+  Niels A. Moseley (c) Moseley Instruments 2016
+
+  Prepared command batches
+
+  A command batch is built once and executed many times.
+  Arguments that change between executions are queued as
+  named 32-bit slots, which are patched just before the
+  batch is sent. Each batch has its own result queue.
+
+*/
+
+#ifndef cmdbatch_h
+#define cmdbatch_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+class CmdBatch
+{
+public:
+    CmdBatch() : m_resultIdx(0) {}
+
+    /** queue a byte */
+    void queueUInt8(uint8_t byte)
+    {
+        m_data.push_back(byte);
+    }
+
+    /** queue a 32-bit word */
+    void queueUInt32(uint32_t word);
+
+    /** queue a named 32-bit argument slot. When the batch is
+        patched, the slot becomes base | (value & mask).
+        A name can be used for more than one slot.
+    */
+    void queueSlot(const std::string &name, uint32_t base = 0, uint32_t mask = 0xFFFFFFFF);
+
+    /** remove all commands, slots and results */
+    void clear();
+
+    /** the slot names, in order of first appearance */
+    const std::vector<std::string>& slotNames() const
+    {
+        return m_names;
+    }
+
+    /** build a packet from the batch. values holds one
+        value for every slot name, in slotNames() order. */
+    void patch(const std::vector<uint32_t> &values, std::vector<uint8_t> &packet) const;
+
+    /** the result queue of the batch */
+    std::vector<uint8_t>& results()
+    {
+        return m_results;
+    }
+
+    /** read cursor into the result queue */
+    size_t& resultIndex()
+    {
+        return m_resultIdx;
+    }
+
+protected:
+    struct Slot
+    {
+        size_t   offset;    // offset of the slot in the command data
+        size_t   nameIdx;   // index into m_names
+        uint32_t base;
+        uint32_t mask;
+    };
+
+    std::vector<uint8_t>     m_data;
+    std::vector<Slot>        m_slots;
+    std::vector<std::string> m_names;
+
+    std::vector<uint8_t>     m_results;
+    size_t                   m_resultIdx;
+};
+
+#endif
@@ -0,0 +1,309 @@
+/*
+
+  Swagger - A tool for programming ARM processors using the SWD protocol
+
+  Niels A. Moseley (c) Moseley Instruments 2016
+
+  Command queue optimizer
+
+*/
+
+#include <stdio.h>
+#include "cmdoptimizer.h"
+#include "protocol.h"
+
+#define MAX_BLOCKWORDS  255     // the block word count is a u8
+
+static uint32_t getUInt32(const std::vector<uint8_t> &queue, size_t idx)
+{
+    uint32_t w = queue[idx];
+    w |= ((uint32_t)queue[idx+1]) << 8;
+    w |= ((uint32_t)queue[idx+2]) << 16;
+    w |= ((uint32_t)queue[idx+3]) << 24;
+    return w;
+}
+
+static void putUInt32(std::vector<uint8_t> &queue, uint32_t w)
+{
+    queue.push_back(w & 0xFF);  // LSB first
+    queue.push_back((w>>8) & 0xFF);
+    queue.push_back((w>>16) & 0xFF);
+    queue.push_back((w>>24) & 0xFF);
+}
+
+/** Returns true if the address lies in a region that has the
+    'normal memory' attribute in the ARMv6-M/ARMv7-M memory map
+    (code, SRAM and external RAM). Accesses to these regions have
+    no side effects, unlike accesses to peripherals and the
+    system control space.
+*/
+static bool isNormalMemory(uint32_t address)
+{
+    return (address < 0x40000000) || ((address >= 0x60000000) && (address < 0xA0000000));
+}
+
+CmdQueueOptimizer::CmdQueueOptimizer() :
+    m_enabled(true),
+    m_blockCommands(false),
+    m_packets(0),
+    m_bytesIn(0),
+    m_bytesOut(0)
+{
+}
+
+void CmdQueueOptimizer::optimize(const std::vector<uint8_t> &inqueue, std::vector<uint8_t> &outqueue)
+{
+    std::vector<Command> cmds;
+    if (!m_enabled || !parse(inqueue, cmds))
+    {
+        outqueue = inqueue;
+        return;
+    }
+
+    removeDeadWrites(cmds);
+    if (m_blockCommands)
+    {
+        mergeBlocks(cmds);
+    }
+
+    outqueue.clear();
+    serialize(cmds, outqueue);
+
+    m_packets++;
+    m_bytesIn += inqueue.size();
+    m_bytesOut += outqueue.size();
+}
+
+void CmdQueueOptimizer::printStats() const
+{
+    if (m_bytesIn == 0)
+    {
+        return;
+    }
+
+    uint32_t saved = m_bytesIn - m_bytesOut;
+    printf("Command optimizer: %d packets, %d bytes -> %d bytes, saved %d bytes (%.1f%%)\n",
+        m_packets, m_bytesIn, m_bytesOut, saved, 100.0*saved/m_bytesIn);
+}
+
+bool CmdQueueOptimizer::parse(const std::vector<uint8_t> &queue, std::vector<Command> &cmds)
+{
+    size_t idx = 0;
+    size_t N = queue.size();
+    while(idx < N)
+    {
+        Command cmd;
+        cmd.type = queue[idx];
+        cmd.address = 0;
+        cmd.count = 0;
+
+        size_t len;
+        switch(cmd.type)
+        {
+        case TXCMD_TYPE_CONNECT:
+        case TXCMD_TYPE_GETPROGID:
+            len = 1;
+            break;
+        case TXCMD_TYPE_RESET:
+        case TXCMD_TYPE_READDP:
+            len = 2;
+            break;
+        case TXCMD_TYPE_WRITEDP:
+            len = 6;
+            break;
+        case TXCMD_TYPE_READAP:
+        case TXCMD_TYPE_READMEM:
+            len = 5;
+            break;
+        case TXCMD_TYPE_WRITEAP:
+        case TXCMD_TYPE_WRITEMEM:
+        case TXCMD_TYPE_WAITMEMTRUE:
+        case TXCMD_TYPE_WAITMEMFALSE:
+        case TXCMD_TYPE_CHECKSUMMEM:
+            len = 9;
+            break;
+        case TXCMD_TYPE_READMEMBLOCK:
+            len = 6;
+            break;
+        case TXCMD_TYPE_WRITEMEMBLOCK:
+            len = (idx+5 < N) ? 6 + 4*queue[idx+5] : 6;
+            break;
+        default:
+            return false;   // unknown command, leave the queue alone
+        }
+
+        if (idx + len > N)
+        {
+            return false;   // truncated command
+        }
+
+        switch(cmd.type)
+        {
+        case TXCMD_TYPE_RESET:
+        case TXCMD_TYPE_READDP:
+            cmd.address = queue[idx+1];
+            break;
+        case TXCMD_TYPE_WRITEDP:
+            cmd.address = queue[idx+1];
+            cmd.data.push_back(getUInt32(queue, idx+2));
+            break;
+        case TXCMD_TYPE_READAP:
+            cmd.address = getUInt32(queue, idx+1);
+            break;
+        case TXCMD_TYPE_READMEM:
+            cmd.address = getUInt32(queue, idx+1);
+            cmd.count = 1;
+            break;
+        case TXCMD_TYPE_READMEMBLOCK:
+            cmd.address = getUInt32(queue, idx+1);
+            cmd.count = queue[idx+5];
+            break;
+        case TXCMD_TYPE_WRITEMEMBLOCK:
+            cmd.address = getUInt32(queue, idx+1);
+            for(size_t i=idx+6; i<idx+len; i+=4)
+            {
+                cmd.data.push_back(getUInt32(queue, i));
+            }
+            break;
+        case TXCMD_TYPE_WRITEAP:
+        case TXCMD_TYPE_WRITEMEM:
+        case TXCMD_TYPE_WAITMEMTRUE:
+        case TXCMD_TYPE_WAITMEMFALSE:
+        case TXCMD_TYPE_CHECKSUMMEM:
+            cmd.address = getUInt32(queue, idx+1);
+            cmd.data.push_back(getUInt32(queue, idx+5));
+            break;
+        default:
+            break;
+        }
+
+        cmds.push_back(cmd);
+        idx += len;
+    }
+    return true;
+}
+
+void CmdQueueOptimizer::removeDeadWrites(std::vector<Command> &cmds)
+{
+    // A write is dead when the next command overwrites the
+    // same location and the location has no side effects:
+    // a word in normal memory or the DP SELECT register.
+    std::vector<Command> out;
+    size_t N = cmds.size();
+    for(size_t i=0; i<N; i++)
+    {
+        if (i+1 < N)
+        {
+            const Command &cur  = cmds[i];
+            const Command &next = cmds[i+1];
+            if ((cur.type == TXCMD_TYPE_WRITEMEM) && (next.type == TXCMD_TYPE_WRITEMEM) &&
+                (cur.address == next.address) && isNormalMemory(cur.address))
+            {
+                continue;
+            }
+            if ((cur.type == TXCMD_TYPE_WRITEDP) && (next.type == TXCMD_TYPE_WRITEDP) &&
+                (cur.address == 0x08) && (next.address == 0x08))
+            {
+                continue;
+            }
+        }
+        out.push_back(cmds[i]);
+    }
+    cmds.swap(out);
+}
+
+void CmdQueueOptimizer::mergeBlocks(std::vector<Command> &cmds)
+{
+    // The hardware accesses the words of a block in order,
+    // so the bus sees exactly the same transactions as it
+    // would for the individual commands.
+    std::vector<Command> out;
+    size_t N = cmds.size();
+    for(size_t i=0; i<N; i++)
+    {
+        const Command &cmd = cmds[i];
+        if (!out.empty())
+        {
+            Command &prev = out.back();
+            bool isRead = (cmd.type == TXCMD_TYPE_READMEM) || (cmd.type == TXCMD_TYPE_READMEMBLOCK);
+            bool prevIsRead = (prev.type == TXCMD_TYPE_READMEM) || (prev.type == TXCMD_TYPE_READMEMBLOCK);
+            bool isWrite = (cmd.type == TXCMD_TYPE_WRITEMEM) || (cmd.type == TXCMD_TYPE_WRITEMEMBLOCK);
+            bool prevIsWrite = (prev.type == TXCMD_TYPE_WRITEMEM) || (prev.type == TXCMD_TYPE_WRITEMEMBLOCK);
+
+            if (isRead && prevIsRead &&
+                (prev.address + 4*prev.count == cmd.address) &&
+                (prev.count + cmd.count <= MAX_BLOCKWORDS))
+            {
+                prev.type = TXCMD_TYPE_READMEMBLOCK;
+                prev.count += cmd.count;
+                continue;
+            }
+
+            if (isWrite && prevIsWrite &&
+                (prev.address + 4*prev.data.size() == cmd.address) &&
+                (prev.data.size() + cmd.data.size() <= MAX_BLOCKWORDS))
+            {
+                prev.type = TXCMD_TYPE_WRITEMEMBLOCK;
+                prev.data.insert(prev.data.end(), cmd.data.begin(), cmd.data.end());
+                continue;
+            }
+        }
+        out.push_back(cmd);
+    }
+    cmds.swap(out);
+}
+
+void CmdQueueOptimizer::serialize(const std::vector<Command> &cmds, std::vector<uint8_t> &queue)
+{
+    size_t N = cmds.size();
+    for(size_t i=0; i<N; i++)
+    {
+        const Command &cmd = cmds[i];
+        uint8_t type = cmd.type;
+
+        // single word blocks are shorter as plain commands
+        if ((type == TXCMD_TYPE_READMEMBLOCK) && (cmd.count == 1))
+            type = TXCMD_TYPE_READMEM;
+        if ((type == TXCMD_TYPE_WRITEMEMBLOCK) && (cmd.data.size() == 1))
+            type = TXCMD_TYPE_WRITEMEM;
+
+        queue.push_back(type);
+        switch(type)
+        {
+        case TXCMD_TYPE_RESET:
+        case TXCMD_TYPE_READDP:
+            queue.push_back(cmd.address);
+            break;
+        case TXCMD_TYPE_WRITEDP:
+            queue.push_back(cmd.address);
+            putUInt32(queue, cmd.data[0]);
+            break;
+        case TXCMD_TYPE_READAP:
+        case TXCMD_TYPE_READMEM:
+            putUInt32(queue, cmd.address);
+            break;
+        case TXCMD_TYPE_READMEMBLOCK:
+            putUInt32(queue, cmd.address);
+            queue.push_back(cmd.count);
+            break;
+        case TXCMD_TYPE_WRITEMEMBLOCK:
+            putUInt32(queue, cmd.address);
+            queue.push_back(cmd.data.size());
+            for(size_t j=0; j<cmd.data.size(); j++)
+            {
+                putUInt32(queue, cmd.data[j]);
+            }
+            break;
+        case TXCMD_TYPE_WRITEAP:
+        case TXCMD_TYPE_WRITEMEM:
+        case TXCMD_TYPE_WAITMEMTRUE:
+        case TXCMD_TYPE_WAITMEMFALSE:
+        case TXCMD_TYPE_CHECKSUMMEM:
+            putUInt32(queue, cmd.address);
+            putUInt32(queue, cmd.data[0]);
+            break;
+        default:
+            break;
+        }
+    }
+}
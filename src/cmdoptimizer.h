@@ -0,0 +1,86 @@
+/*
+
+  Swagger - A tool for programming ARM processors using the SWD protocol
+
+  Niels A. Moseley (c) Moseley Instruments 2016
+
+  Command queue optimizer
+
+  The scripts build packets one command at a time, which results
+  in a lot of redundant traffic. The optimizer parses the command
+  queue into a list of commands, removes writes that are provably
+  redundant, merges runs of memory reads and writes to adjacent
+  addresses into block commands and serializes the result.
+
+  The order of the bus accesses and the layout of the result
+  packet are never changed.
+
+*/
+
+#ifndef cmdoptimizer_h
+#define cmdoptimizer_h
+
+#include <stdint.h>
+#include <vector>
+
+class CmdQueueOptimizer
+{
+public:
+    CmdQueueOptimizer();
+
+    /** enable or disable the optimizer */
+    void setEnabled(bool enabled)
+    {
+        m_enabled = enabled;
+    }
+
+    /** returns true if the optimizer is enabled */
+    bool isEnabled() const
+    {
+        return m_enabled;
+    }
+
+    /** allow the use of the block memory commands,
+        the hardware must support protocol version 4 */
+    void setBlockCommands(bool enabled)
+    {
+        m_blockCommands = enabled;
+    }
+
+    /** optimize a command queue. When the optimizer is disabled
+        or the queue cannot be parsed, it is copied unchanged.
+    */
+    void optimize(const std::vector<uint8_t> &inqueue, std::vector<uint8_t> &outqueue);
+
+    /** print the number of bytes saved to the console */
+    void printStats() const;
+
+protected:
+    struct Command
+    {
+        uint8_t  type;
+        uint32_t address;               // address, port number or reset state
+        uint32_t count;                 // number of words read
+        std::vector<uint32_t> data;     // payload words
+    };
+
+    /** parse a command queue, returns false if it contains unknown commands */
+    bool parse(const std::vector<uint8_t> &queue, std::vector<Command> &cmds);
+
+    /** remove writes that are overwritten before they can be observed */
+    void removeDeadWrites(std::vector<Command> &cmds);
+
+    /** merge memory accesses to adjacent addresses into block commands */
+    void mergeBlocks(std::vector<Command> &cmds);
+
+    /** serialize the commands into a command queue */
+    void serialize(const std::vector<Command> &cmds, std::vector<uint8_t> &queue);
+
+    bool     m_enabled;
+    bool     m_blockCommands;
+    uint32_t m_packets;         // number of packets seen
+    uint32_t m_bytesIn;         // command bytes before optimization
+    uint32_t m_bytesOut;        // command bytes after optimization
+};
+
+#endif
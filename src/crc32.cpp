@@ -0,0 +1,60 @@
+/*
+
+  CRC32 (IEEE 802.3) checksum, as computed by the
+  CHECKSUM MEMORY command of the programming hardware.
+
+*/
+
+#include "crc32.h"
+
+static uint32_t crcTable[256];
+
+static bool makeTable()
+{
+    for(uint32_t i=0; i<256; i++)
+    {
+        uint32_t c = i;
+        for(uint32_t k=0; k<8; k++)
+        {
+            c = (c & 1) ? (c >> 1) ^ 0xEDB88320 : (c >> 1);
+        }
+        crcTable[i] = c;
+    }
+    return true;
+}
+
+// built before main(), so the sessions of gang mode can use it
+static bool crcTableValid = makeTable();
+
+uint32_t CRC32::calc(const uint8_t *data, size_t bytes, uint32_t crc)
+{
+    crc = ~crc;
+    for(size_t i=0; i<bytes; i++)
+    {
+        crc = crcTable[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+bool CRC32::test()
+{
+    const uint8_t in1[] = {'1','2','3','4','5','6','7','8','9'};
+
+    if (calc(in1, sizeof(in1)) != 0xCBF43926)
+    {
+        return false;
+    }
+
+    // continued checksum must match the one-shot checksum
+    if (calc(in1+4, sizeof(in1)-4, calc(in1, 4)) != 0xCBF43926)
+    {
+        return false;
+    }
+
+    if (calc(in1, 0) != 0)
+    {
+        return false;
+    }
+
+    return true;
+}
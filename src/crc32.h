@@ -0,0 +1,21 @@
+/*
+
+  CRC32 (IEEE 802.3) checksum, as computed by the
+  CHECKSUM MEMORY command of the programming hardware.
+
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace CRC32
+{
+    /** Calculate the CRC32 of a byte buffer.
+        Pass the result of a previous call as crc
+        to continue a checksum over multiple buffers.
+    */
+    uint32_t calc(const uint8_t *data, size_t bytes, uint32_t crc = 0);
+
+    /** perform built-in testing */
+    bool test();
+}
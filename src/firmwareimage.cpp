@@ -0,0 +1,578 @@
+/*
+
+  Swagger - A tool for programming ARM processors using the SWD protocol
+
+  Niels A. Moseley (c) Moseley Instruments 2016
+
+  Firmware image loader
+
+*/
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <map>
+#include <algorithm>
+#include <QFileInfo>
+#include <QMutex>
+#include "firmwareimage.h"
+
+// smaller files are read instead of mapped, so
+// rewriting the file cannot fault the programming
+#define IMAGE_COPY_MAX_BYTES    (4*1024*1024)
+
+thread_local std::string FirmwareImage::m_lastError;
+
+static std::map<std::string, FirmwareImage*> g_imageCache;
+static std::vector<FirmwareImage*> g_retiredImages;    // replaced, but scripts may still use them
+static QMutex g_imageCacheLock;     // the sessions of gang mode share the cache
+
+static uint16_t getUInt16(const uint8_t *ptr)
+{
+    return ptr[0] | (((uint16_t)ptr[1]) << 8);
+}
+
+static uint32_t getUInt32(const uint8_t *ptr)
+{
+    uint32_t w = ptr[0];
+    w |= ((uint32_t)ptr[1]) << 8;
+    w |= ((uint32_t)ptr[2]) << 16;
+    w |= ((uint32_t)ptr[3]) << 24;
+    return w;
+}
+
+/** convert a hex digit, returns -1 if it is not one */
+static int hexDigit(char c)
+{
+    if ((c >= '0') && (c <= '9')) return c - '0';
+    if ((c >= 'A') && (c <= 'F')) return c - 'A' + 10;
+    if ((c >= 'a') && (c <= 'f')) return c - 'a' + 10;
+    return -1;
+}
+
+/** decode the hex pairs of a record line into bytes */
+static bool decodeHexBytes(const char *text, size_t len, std::vector<uint8_t> &bytes)
+{
+    if ((len & 1) != 0)
+    {
+        return false;
+    }
+    bytes.clear();
+    for(size_t i=0; i<len; i+=2)
+    {
+        int hi = hexDigit(text[i]);
+        int lo = hexDigit(text[i+1]);
+        if ((hi < 0) || (lo < 0))
+        {
+            return false;
+        }
+        bytes.push_back((hi << 4) | lo);
+    }
+    return true;
+}
+
+static bool hasSuffix(const std::string &name, const char *suffix)
+{
+    std::string s(suffix);
+    if (name.size() < s.size())
+    {
+        return false;
+    }
+    std::string end = name.substr(name.size() - s.size());
+    std::transform(end.begin(), end.end(), end.begin(), ::tolower);
+    return end == s;
+}
+
+void FirmwareImage::setError(const char *fmt, ...)
+{
+    char buf[128];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+    m_lastError = buf;
+}
+
+FirmwareImage::FirmwareImage() :
+    m_fileSize(0),
+    m_map(0),
+    m_mapped(false),
+    m_refs(0),
+    m_retired(false),
+    m_format("bin")
+{
+}
+
+FirmwareImage::~FirmwareImage()
+{
+    if (m_mapped)
+    {
+        m_file.unmap((uchar*)m_map);
+    }
+    m_file.close();
+}
+
+FirmwareImage* FirmwareImage::get(const std::string &filename)
+{
+    QMutexLocker lock(&g_imageCacheLock);
+    QFileInfo info(QString::fromStdString(filename));
+
+    // the same relative name is another file in
+    // another working directory
+    std::string path = info.canonicalFilePath().toStdString();
+    if (path.empty())
+    {
+        path = filename;
+    }
+
+    std::map<std::string, FirmwareImage*>::iterator iter = g_imageCache.find(path);
+    if (iter != g_imageCache.end())
+    {
+        FirmwareImage *image = iter->second;
+        if ((info.lastModified() == image->m_modified) && (info.size() == image->m_fileSize))
+        {
+            image->m_refs++;
+            return image;
+        }
+        // the file has changed: load it again
+        g_imageCache.erase(iter);
+        image->m_retired = true;
+        if (image->m_refs == 0)
+        {
+            delete image;
+        }
+        else
+        {
+            g_retiredImages.push_back(image);
+        }
+    }
+
+    FirmwareImage *image = new FirmwareImage();
+    if (!image->load(filename))
+    {
+        delete image;
+        return NULL;
+    }
+    image->m_modified = info.lastModified();
+    image->m_refs = 1;
+    g_imageCache[path] = image;
+    return image;
+}
+
+void FirmwareImage::release(FirmwareImage *image)
+{
+    QMutexLocker lock(&g_imageCacheLock);
+    image->m_refs--;
+    if (image->m_retired && (image->m_refs == 0))
+    {
+        g_retiredImages.erase(std::find(g_retiredImages.begin(), g_retiredImages.end(), image));
+        delete image;
+    }
+}
+
+void FirmwareImage::releaseAll()
+{
+    QMutexLocker lock(&g_imageCacheLock);
+    std::map<std::string, FirmwareImage*>::iterator iter;
+    for(iter = g_imageCache.begin(); iter != g_imageCache.end(); ++iter)
+    {
+        delete iter->second;
+    }
+    g_imageCache.clear();
+    for(size_t i=0; i<g_retiredImages.size(); i++)
+    {
+        delete g_retiredImages[i];
+    }
+    g_retiredImages.clear();
+}
+
+bool FirmwareImage::streamKey(const std::string &algoTag, uint32_t &key) const
+{
+    QMutexLocker lock(&g_imageCacheLock);
+    std::map<std::string, uint32_t>::const_iterator iter = m_streamKeys.find(algoTag);
+    if (iter == m_streamKeys.end())
+    {
+        return false;
+    }
+    key = iter->second;
+    return true;
+}
+
+void FirmwareImage::setStreamKey(const std::string &algoTag, uint32_t key) const
+{
+    QMutexLocker lock(&g_imageCacheLock);
+    m_streamKeys[algoTag] = key;
+}
+
+size_t FirmwareImage::totalBytes() const
+{
+    size_t bytes = 0;
+    for(size_t i=0; i<m_segments.size(); i++)
+    {
+        bytes += m_segments[i].size;
+    }
+    return bytes;
+}
+
+const uint8_t* FirmwareImage::data(uint32_t address, uint32_t bytes) const
+{
+    for(size_t i=0; i<m_segments.size(); i++)
+    {
+        const Segment &seg = m_segments[i];
+        if ((address >= seg.address) && (address - seg.address + (uint64_t)bytes <= seg.size))
+        {
+            return seg.data + (address - seg.address);
+        }
+    }
+    return NULL;
+}
+
+bool FirmwareImage::load(const std::string &filename)
+{
+    m_file.setFileName(QString::fromStdString(filename));
+    if (!m_file.open(QIODevice::ReadOnly))
+    {
+        m_lastError = "Cannot open file " + filename;
+        return false;
+    }
+
+    m_fileSize = m_file.size();
+    if (m_fileSize == 0)
+    {
+        m_lastError = "File " + filename + " is empty";
+        return false;
+    }
+
+    if (m_fileSize <= IMAGE_COPY_MAX_BYTES)
+    {
+        m_copy.resize(m_fileSize);
+        if (m_file.read((char*)&m_copy[0], m_fileSize) != m_fileSize)
+        {
+            m_lastError = "Cannot read file " + filename;
+            return false;
+        }
+        m_file.close();
+        m_map = &m_copy[0];
+    }
+    else
+    {
+        m_map = m_file.map(0, m_fileSize);
+        if (m_map == 0)
+        {
+            m_lastError = "Cannot map file " + filename;
+            return false;
+        }
+        m_mapped = true;
+    }
+
+    if ((m_fileSize >= 4) && (m_map[0] == 0x7F) && (m_map[1] == 'E') &&
+        (m_map[2] == 'L') && (m_map[3] == 'F'))
+    {
+        m_format = "elf";
+        return loadELF();
+    }
+
+    if (hasSuffix(filename, ".hex") || hasSuffix(filename, ".ihex") || hasSuffix(filename, ".ihx"))
+    {
+        m_format = "hex";
+        return loadHex((const char*)m_map, m_fileSize);
+    }
+
+    if (hasSuffix(filename, ".srec") || hasSuffix(filename, ".s19") || hasSuffix(filename, ".s28") ||
+        hasSuffix(filename, ".s37") || hasSuffix(filename, ".mot"))
+    {
+        m_format = "srec";
+        return loadSRec((const char*)m_map, m_fileSize);
+    }
+
+    // raw binary, starting at address 0
+    Segment seg;
+    seg.address = 0;
+    seg.data = m_map;
+    seg.size = m_fileSize;
+    m_segments.push_back(seg);
+    return true;
+}
+
+static bool segmentLess(const FirmwareImage::Segment &a, const FirmwareImage::Segment &b)
+{
+    return a.address < b.address;
+}
+
+bool FirmwareImage::loadELF()
+{
+    const uint8_t *hdr = m_map;
+    if ((m_fileSize < 52) || (hdr[4] != 1) || (hdr[5] != 1))
+    {
+        m_lastError = "Only 32-bit little-endian ELF files are supported";
+        return false;
+    }
+
+    uint32_t phoff = getUInt32(hdr + 28);
+    uint32_t phentsize = getUInt16(hdr + 42);
+    uint32_t phnum = getUInt16(hdr + 44);
+    if ((phentsize < 32) || ((uint64_t)phoff + (uint64_t)phentsize*phnum > (uint64_t)m_fileSize))
+    {
+        m_lastError = "ELF program header table is outside the file";
+        return false;
+    }
+
+    for(uint32_t i=0; i<phnum; i++)
+    {
+        const uint8_t *ph = hdr + phoff + i*phentsize;
+        uint32_t type   = getUInt32(ph);
+        uint32_t offset = getUInt32(ph + 4);
+        uint32_t paddr  = getUInt32(ph + 12);
+        uint32_t filesz = getUInt32(ph + 16);
+
+        // only PT_LOAD segments with file data end up in the memory.
+        // The physical address is the load address, which differs
+        // from the virtual address for initialised data in RAM.
+        if ((type != 1) || (filesz == 0))
+        {
+            continue;
+        }
+        if ((uint64_t)offset + filesz > (uint64_t)m_fileSize)
+        {
+            m_lastError = "ELF segment is outside the file";
+            return false;
+        }
+
+        Segment seg;
+        seg.address = paddr;
+        seg.data = m_map + offset;
+        seg.size = filesz;
+        m_segments.push_back(seg);
+    }
+
+    if (m_segments.empty())
+    {
+        m_lastError = "ELF file has no loadable segments";
+        return false;
+    }
+    std::stable_sort(m_segments.begin(), m_segments.end(), segmentLess);
+    return true;
+}
+
+bool FirmwareImage::loadHex(const char *text, size_t len)
+{
+    std::vector<uint8_t> rec;
+    uint32_t base = 0;
+    size_t lineNum = 0;
+    size_t idx = 0;
+    while(idx < len)
+    {
+        // find the end of the line
+        size_t end = idx;
+        while((end < len) && (text[end] != '\n') && (text[end] != '\r'))
+        {
+            end++;
+        }
+        const char *line = text + idx;
+        size_t lineLen = end - idx;
+        idx = end + 1;
+        if (lineLen == 0)
+        {
+            continue;
+        }
+        lineNum++;
+
+        // layout: ':' count:u8 address:u16 type:u8 data checksum:u8
+        if ((line[0] != ':') || !decodeHexBytes(line+1, lineLen-1, rec) ||
+            (rec.size() < 5) || (rec.size() != (size_t)rec[0] + 5))
+        {
+            setError("Malformed Intel HEX record on line %d", (int)lineNum);
+            return false;
+        }
+
+        uint8_t sum = 0;
+        for(size_t i=0; i<rec.size(); i++)
+        {
+            sum += rec[i];
+        }
+        if (sum != 0)
+        {
+            setError("Intel HEX checksum error on line %d", (int)lineNum);
+            return false;
+        }
+
+        uint8_t count = rec[0];
+        uint32_t offset = (rec[1] << 8) | rec[2];
+        switch(rec[3])
+        {
+        case 0x00:  // data
+            addDecoded(base + offset, &rec[4], count);
+            break;
+        case 0x01:  // end of file
+            return finishDecoded();
+        case 0x02:  // extended segment address
+            if (count != 2) break;
+            base = ((rec[4] << 8) | rec[5]) << 4;
+            break;
+        case 0x04:  // extended linear address
+            if (count != 2) break;
+            base = ((rec[4] << 8) | rec[5]) << 16;
+            break;
+        default:    // start addresses
+            break;
+        }
+    }
+    return finishDecoded();
+}
+
+bool FirmwareImage::loadSRec(const char *text, size_t len)
+{
+    std::vector<uint8_t> rec;
+    size_t lineNum = 0;
+    size_t idx = 0;
+    while(idx < len)
+    {
+        size_t end = idx;
+        while((end < len) && (text[end] != '\n') && (text[end] != '\r'))
+        {
+            end++;
+        }
+        const char *line = text + idx;
+        size_t lineLen = end - idx;
+        idx = end + 1;
+        if (lineLen == 0)
+        {
+            continue;
+        }
+        lineNum++;
+
+        // layout: 'S' type count:u8 address data checksum:u8
+        // where count includes the address and checksum bytes
+        if ((lineLen < 4) || (line[0] != 'S') || !decodeHexBytes(line+2, lineLen-2, rec) ||
+            (rec.size() < 2) || (rec.size() != (size_t)rec[0] + 1))
+        {
+            setError("Malformed S-record on line %d", (int)lineNum);
+            return false;
+        }
+
+        uint8_t sum = 0;
+        for(size_t i=0; i<rec.size()-1; i++)
+        {
+            sum += rec[i];
+        }
+        if ((uint8_t)~sum != rec.back())
+        {
+            setError("S-record checksum error on line %d", (int)lineNum);
+            return false;
+        }
+
+        size_t addrBytes;
+        switch(line[1])
+        {
+        case '1':
+            addrBytes = 2;
+            break;
+        case '2':
+            addrBytes = 3;
+            break;
+        case '3':
+            addrBytes = 4;
+            break;
+        default:    // header, record count and start address
+            continue;
+        }
+
+        if (rec.size() < addrBytes + 2)
+        {
+            setError("Malformed S-record on line %d", (int)lineNum);
+            return false;
+        }
+
+        uint32_t address = 0;
+        for(size_t i=0; i<addrBytes; i++)
+        {
+            address = (address << 8) | rec[1+i];
+        }
+        addDecoded(address, &rec[1+addrBytes], rec.size() - addrBytes - 2);
+    }
+    return finishDecoded();
+}
+
+void FirmwareImage::addDecoded(uint32_t address, const uint8_t *data, uint32_t bytes)
+{
+    if (bytes == 0)
+    {
+        return;
+    }
+
+    // records are usually in order, so most of them
+    // extend the current run.
+    if (!m_runs.empty())
+    {
+        Run &run = m_runs.back();
+        if (run.address + run.size == address)
+        {
+            m_decoded.insert(m_decoded.end(), data, data + bytes);
+            run.size += bytes;
+            return;
+        }
+    }
+
+    Run run;
+    run.address = address;
+    run.offset = m_decoded.size();
+    run.size = bytes;
+    m_decoded.insert(m_decoded.end(), data, data + bytes);
+    m_runs.push_back(run);
+}
+
+static bool runLess(const FirmwareImage::Run &a, const FirmwareImage::Run &b)
+{
+    return a.address < b.address;
+}
+
+bool FirmwareImage::finishDecoded()
+{
+    if (m_runs.empty())
+    {
+        m_lastError = "File contains no data";
+        return false;
+    }
+
+    // sort the runs by address and merge the adjacent ones
+    // into a new buffer, so every segment is contiguous.
+    std::stable_sort(m_runs.begin(), m_runs.end(), runLess);
+
+    std::vector<uint8_t> merged;
+    merged.reserve(m_decoded.size());
+    std::vector<Run> segs;
+    for(size_t i=0; i<m_runs.size(); i++)
+    {
+        const Run &run = m_runs[i];
+        if (!segs.empty())
+        {
+            Run &last = segs.back();
+            if ((uint64_t)last.address + last.size > run.address)
+            {
+                setError("Overlapping data at address 0x%08X", run.address);
+                return false;
+            }
+            if (last.address + last.size == run.address)
+            {
+                merged.insert(merged.end(), m_decoded.begin() + run.offset, m_decoded.begin() + run.offset + run.size);
+                last.size += run.size;
+                continue;
+            }
+        }
+        Run seg = run;
+        seg.offset = merged.size();
+        merged.insert(merged.end(), m_decoded.begin() + run.offset, m_decoded.begin() + run.offset + run.size);
+        segs.push_back(seg);
+    }
+
+    m_decoded.swap(merged);
+    m_runs.clear();
+    for(size_t i=0; i<segs.size(); i++)
+    {
+        Segment seg;
+        seg.address = segs[i].address;
+        seg.data = &m_decoded[segs[i].offset];
+        seg.size = segs[i].size;
+        m_segments.push_back(seg);
+    }
+    return true;
+}
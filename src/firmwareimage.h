@@ -0,0 +1,146 @@
+/*
+
+  Swagger - A tool for programming ARM processors using the SWD protocol
+
+  Niels A. Moseley (c) Moseley Instruments 2016
+
+  Firmware image loader
+
+  Loads a firmware image as a list of segments, each holding
+  the target address and the data that goes there. Gaps between
+  the segments are not part of the image, so they are neither
+  padded nor programmed.
+
+  Files up to IMAGE_COPY_MAX_BYTES are read into a buffer, larger
+  files are memory mapped. Binary files and the loadable program
+  segments of 32-bit little-endian ELF files point straight into
+  the buffer or the mapping. Intel HEX and Motorola S-record files
+  are text, so their data is decoded once into a buffer owned by
+  the image. A mapped file must be replaced, not rewritten in
+  place, while it is being programmed.
+
+  Images are cached by their canonical path, so programming and
+  verifying the same file only reads and parses it once. The cache
+  is shared by all the sessions, images are never changed after
+  they are loaded. An image that is replaced because its file has
+  changed is deleted once its last reference is released.
+
+*/
+
+#ifndef firmwareimage_h
+#define firmwareimage_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include <string>
+#include <map>
+#include <QFile>
+#include <QDateTime>
+
+class FirmwareImage
+{
+public:
+    struct Segment
+    {
+        uint32_t        address;    // target address of the first byte
+        const uint8_t   *data;
+        uint32_t        size;       // in bytes
+    };
+
+    ~FirmwareImage();
+
+    /** Get the image of a file, loading it when it is not in the
+        cache or when the file has changed since it was loaded.
+        Every image that is returned must be given back with
+        release(). Returns NULL on error, see lastError().
+    */
+    static FirmwareImage* get(const std::string &filename);
+
+    /** give back an image returned by get() */
+    static void release(FirmwareImage *image);
+
+    /** Release all the cached images. Pointers returned by
+        get() are valid until this is called. */
+    static void releaseAll();
+
+    /** get the description of the last error of get()
+        on the calling thread */
+    static std::string lastError()
+    {
+        return m_lastError;
+    }
+
+    const std::vector<Segment>& segments() const
+    {
+        return m_segments;
+    }
+
+    /** Get the key of the packet stream of the image for an
+        algorithm, see PacketStream::algorithmTag. A changed file
+        is loaded as a new image, so a key is never out of date.
+        Returns false if the key is not known yet. */
+    bool streamKey(const std::string &algoTag, uint32_t &key) const;
+
+    /** remember the key of the packet stream for an algorithm */
+    void setStreamKey(const std::string &algoTag, uint32_t key) const;
+
+    /** name of the file format: "bin", "hex", "srec" or "elf" */
+    const char* format() const
+    {
+        return m_format;
+    }
+
+    /** total number of data bytes in all segments */
+    size_t totalBytes() const;
+
+    /** Get a pointer to the image data of an address range.
+        Returns NULL if the range is not completely inside
+        a single segment.
+    */
+    const uint8_t* data(uint32_t address, uint32_t bytes) const;
+
+protected:
+    FirmwareImage();
+
+    bool load(const std::string &filename);
+    bool loadELF();
+    bool loadHex(const char *text, size_t len);
+    bool loadSRec(const char *text, size_t len);
+
+    /** add decoded text format data to the runs */
+    void addDecoded(uint32_t address, const uint8_t *data, uint32_t bytes);
+
+    /** sort the decoded runs into segments */
+    bool finishDecoded();
+
+    static void setError(const char *fmt, ...);
+
+public:
+    /** decoded text format data */
+    struct Run
+    {
+        uint32_t address;
+        size_t   offset;        // into m_decoded
+        uint32_t size;
+    };
+
+protected:
+    QFile                   m_file;
+    QDateTime               m_modified;
+    qint64                  m_fileSize;
+    const uint8_t           *m_map;     // the mapping or m_copy
+    bool                    m_mapped;
+    std::vector<uint8_t>    m_copy;     // a small file
+    int                     m_refs;     // references returned by get()
+    bool                    m_retired;  // no longer in the cache
+    mutable std::map<std::string, uint32_t> m_streamKeys;   // by algorithm tag
+    const char              *m_format;
+    std::vector<Segment>    m_segments;
+    std::vector<Run>        m_runs;
+    std::vector<uint8_t>    m_decoded;
+
+    static thread_local std::string m_lastError;
+};
+
+#endif
@@ -0,0 +1,746 @@
+/*
+
+  Swagger - A tool for programming ARM processors using the SWD protocol
+
+  Niels A. Moseley (c) Moseley Instruments 2016
+
+  Flash programming engine
+
+*/
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <deque>
+#include <QThread>
+#include "flashengine.h"
+#include "imagescan.h"
+#include "pipeline.h"
+#include "cobs.h"
+#include "crc32.h"
+
+static void pushUInt32(std::vector<uint8_t> &queue, uint32_t word)
+{
+    queue.push_back(word & 0xFF); // LSB first
+    queue.push_back((word>>8) & 0xFF);
+    queue.push_back((word>>16) & 0xFF);
+    queue.push_back((word>>24) & 0xFF);
+}
+
+static void pushWriteMem(std::vector<uint8_t> &queue, uint32_t address, uint32_t value)
+{
+    queue.push_back(TXCMD_TYPE_WRITEMEM);
+    pushUInt32(queue, address);
+    pushUInt32(queue, value);
+}
+
+static void pushWaitMem(std::vector<uint8_t> &queue, uint32_t address, uint32_t mask)
+{
+    queue.push_back(TXCMD_TYPE_WAITMEMTRUE);
+    pushUInt32(queue, address);
+    pushUInt32(queue, mask);
+}
+
+static void pushReadMem(std::vector<uint8_t> &queue, uint32_t address)
+{
+    queue.push_back(TXCMD_TYPE_READMEM);
+    pushUInt32(queue, address);
+}
+
+static uint32_t getUInt32(const uint8_t *ptr)
+{
+    uint32_t w = ptr[0];
+    w |= ((uint32_t)ptr[1]) << 8;
+    w |= ((uint32_t)ptr[2]) << 16;
+    w |= ((uint32_t)ptr[3]) << 24;
+    return w;
+}
+
+/** format an error message */
+static void setError(std::string &error, const char *fmt, ...)
+{
+    char buf[128];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+    error = buf;
+}
+
+/** get a word of the padded image, which has lead erased
+    bytes in front of the data and erased bytes after it. */
+static uint32_t getImageWord(const uint8_t *data, size_t bytes, size_t lead, size_t offset)
+{
+    if ((offset >= lead) && (offset - lead + 4 <= bytes))
+    {
+        return getUInt32(data + offset - lead);
+    }
+
+    uint32_t w = 0;
+    for(size_t i=0; i<4; i++)
+    {
+        size_t idx = offset + i;
+        uint32_t b = ((idx >= lead) && (idx - lead < bytes)) ? data[idx - lead] : 0xFF;
+        w |= b << (8*i);
+    }
+    return w;
+}
+
+/** the programming units of an image and how they are
+    packed into packets */
+struct Layout
+{
+    /** the part of a verify sector that is inside the image */
+    struct Check
+    {
+        size_t  begin;          // offsets from startAddress
+        size_t  end;
+        size_t  unitsBefore;    // units that are programmed before the checksum
+    };
+
+    /** the units and checks of a packet */
+    struct Packet
+    {
+        size_t  firstUnit;
+        size_t  lastUnit;       // one past the last unit
+        size_t  firstCheck;
+        size_t  lastCheck;
+    };
+
+    uint32_t                startAddress;   // flash address of the first unit
+    size_t                  lead;           // erased bytes in front of the data
+    uint32_t                unitBytes;
+    std::vector<uint32_t>   units;          // offsets from startAddress
+    std::vector<Check>      checks;         // the verify sectors in address order
+    std::vector<Packet>     packets;
+    size_t                  paddedBytes;    // bytes from startAddress to the end of the last unit
+    bool                    useBlock;       // use WRITEMEMBLOCK for the parameters
+
+    size_t packetCount() const
+    {
+        return packets.size();
+    }
+};
+
+static bool getLayout(const InterfaceInfo &info, const FlashAlgorithm &algo, const uint8_t *data, size_t bytes,
+    Layout &layout, std::string &error)
+{
+    if ((algo.programSize < 4) || ((algo.programSize & (algo.programSize-1)) != 0))
+    {
+        error = "flash program size must be a power of 2";
+        return false;
+    }
+    if ((algo.verifySize % algo.programSize) != 0)
+    {
+        error = "flash verify size must be a multiple of the program size";
+        return false;
+    }
+
+    // the programming units are aligned to the program size.
+    // The bytes of the first and last unit that are outside
+    // of the data are taken as erased bytes.
+    size_t unitBytes = algo.programSize;
+    layout.unitBytes = unitBytes;
+    layout.lead = algo.baseAddress % unitBytes;
+    layout.startAddress = algo.baseAddress - layout.lead;
+    size_t imageBytes = ((layout.lead + bytes + unitBytes - 1) / unitBytes) * unitBytes;
+
+    // find the units that need programming
+    layout.units.clear();
+    if (algo.skipErased)
+    {
+        std::vector<ImageScan::Range> runs;
+        ImageScan::findDataRuns(data, bytes, algo.baseAddress, unitBytes, 0, runs);
+        for(size_t r=0; r<runs.size(); r++)
+        {
+            for(uint32_t i=0; i<runs[r].bytes; i+=unitBytes)
+            {
+                layout.units.push_back(runs[r].address - layout.startAddress + i);
+            }
+        }
+    }
+    else
+    {
+        for(size_t offset=0; offset<imageBytes; offset+=unitBytes)
+        {
+            layout.units.push_back(offset);
+        }
+    }
+
+    layout.paddedBytes = imageBytes;
+
+    // size of the commands for a single unit:
+    // wait for ready, read the status of the previous unit,
+    // write the parameters and launch.
+    layout.useBlock = (info.version >= 4);
+    uint32_t paramWords = 1 + unitBytes/4;
+    uint32_t unitCmdBytes = 9 + 5 + (layout.useBlock ? 6 + 4*paramWords : 9*paramWords) + 9;
+    uint32_t checkCmdBytes = 9 + 9;       // wait for ready and checksum
+    uint32_t fixedCmdBytes = 9 + 9 + 5;   // clear errors, final wait and status read
+    uint32_t cmdBytes = (info.rxBufSize > fixedCmdBytes) ? info.rxBufSize - fixedCmdBytes : 0;
+    uint32_t resultWords = info.txBufSize / 4U;
+
+    // every verify sector of the image is checked, including the
+    // erased ones. A sector is checked after its last programmed unit,
+    // a sector without programmed units where it is in the address order.
+    size_t count = layout.units.size();
+    layout.checks.clear();
+    if ((algo.verifySize != 0) && (info.version >= 3) && (imageBytes != 0))
+    {
+        uint32_t first = layout.startAddress / algo.verifySize;
+        uint32_t last = (layout.startAddress + imageBytes - 1) / algo.verifySize;
+        size_t k = 0;
+        for(uint32_t sector=first; sector<=last; sector++)
+        {
+            size_t sectorStart = (size_t)sector * algo.verifySize;
+            Layout::Check check;
+            check.begin = (sectorStart > layout.startAddress) ? sectorStart - layout.startAddress : 0;
+            check.end = sectorStart + algo.verifySize - layout.startAddress;
+            if (check.end > imageBytes)
+                check.end = imageBytes;
+            while((k < count) && (layout.units[k] < check.end))
+            {
+                k++;
+            }
+            check.unitsBefore = k;
+            layout.checks.push_back(check);
+        }
+    }
+
+    // pack the units and checks into packets, every unit and
+    // check returns one result word
+    layout.packets.clear();
+    Layout::Packet packet = {0, 0, 0, 0};
+    uint32_t packetBytes = 0;
+    size_t k = 0;
+    size_t c = 0;
+    while((k < count) || (c < layout.checks.size()))
+    {
+        bool isCheck = (c < layout.checks.size()) && (layout.checks[c].unitsBefore == k);
+        uint32_t itemBytes = isCheck ? checkCmdBytes : unitCmdBytes;
+        size_t items = (k - packet.firstUnit) + (c - packet.firstCheck);
+        if ((items != 0) && ((packetBytes + itemBytes > cmdBytes) || (items >= resultWords)))
+        {
+            layout.packets.push_back(packet);
+            packet.firstUnit = k;
+            packet.firstCheck = c;
+            packetBytes = 0;
+        }
+        packetBytes += itemBytes;
+        if (isCheck)
+            c++;
+        else
+            k++;
+        packet.lastUnit = k;
+        packet.lastCheck = c;
+    }
+    if ((k != 0) || (c != 0))
+    {
+        layout.packets.push_back(packet);
+    }
+    return true;
+}
+
+/** the work of a single packet */
+struct PacketWork
+{
+    std::vector<uint32_t>   units;      // flash address of every unit
+    std::vector<uint32_t>   words;      // image words of every unit
+    std::vector<FlashEngine::SectorCheck> checks;
+    std::vector<size_t>     checkAfter; // units of the packet before every check
+    size_t                  packetEnd;  // image bytes done after the packet
+    std::vector<uint8_t>    packet;     // the commands
+    std::vector<uint8_t>    encoded;    // COBS encoded packet
+    std::vector<uint8_t>    result;
+};
+
+/** get the image words of packet number index */
+static void readPacketWords(const FlashAlgorithm &algo, const Layout &layout, const uint8_t *data, size_t bytes,
+    size_t index, PacketWork &work)
+{
+    const Layout::Packet &packet = layout.packets[index];
+
+    work.units.clear();
+    work.words.clear();
+    work.checks.clear();
+    work.checkAfter.clear();
+    size_t end = 0;
+    for(size_t k=packet.firstUnit; k<packet.lastUnit; k++)
+    {
+        uint32_t offset = layout.units[k];
+        work.units.push_back(layout.startAddress + offset);
+        for(uint32_t i=0; i<layout.unitBytes; i+=4)
+        {
+            work.words.push_back(getImageWord(data, bytes, layout.lead, offset+i));
+        }
+        end = offset + layout.unitBytes;
+    }
+
+    for(size_t c=packet.firstCheck; c<packet.lastCheck; c++)
+    {
+        // the CRC is taken over the words that are programmed
+        // and the erased words in between
+        const Layout::Check &range = layout.checks[c];
+        uint32_t crc = 0;
+        for(size_t i=range.begin; i<range.end; i+=4)
+        {
+            uint32_t w = getImageWord(data, bytes, layout.lead, i);
+            uint8_t b[4] = {(uint8_t)w, (uint8_t)(w >> 8), (uint8_t)(w >> 16), (uint8_t)(w >> 24)};
+            crc = CRC32::calc(b, 4, crc);
+        }
+
+        // the status of the unit right before the check
+        // is read after the checksum
+        size_t after = range.unitsBefore - packet.firstUnit;
+        FlashEngine::SectorCheck check;
+        check.address = layout.startAddress + range.begin;
+        check.bytes = range.end - range.begin;
+        check.crc = crc;
+        check.wordIndex = (after != 0) ? after - 1 : 0;
+        work.checks.push_back(check);
+        work.checkAfter.push_back(after);
+        if (range.end > end)
+            end = range.end;
+    }
+
+    // the image bytes up to the end of the packet,
+    // including the skipped erased units.
+    end -= layout.lead;
+    work.packetEnd = (end < bytes) ? end : bytes;
+}
+
+/** wait for the previous unit and checksum a sector */
+static void pushSectorCheck(std::vector<uint8_t> &packet, const FlashAlgorithm &algo,
+    const FlashEngine::SectorCheck &check)
+{
+    pushWaitMem(packet, algo.statusReg, algo.readyMask);
+    packet.push_back(TXCMD_TYPE_CHECKSUMMEM);
+    pushUInt32(packet, check.address);
+    pushUInt32(packet, check.bytes);
+}
+
+/** build the commands of a packet from its image words */
+static void buildPacket(const FlashAlgorithm &algo, const Layout &layout, PacketWork &work)
+{
+    std::vector<uint8_t> &packet = work.packet;
+    packet.clear();
+    pushWriteMem(packet, algo.statusReg, algo.clearValue);
+
+    uint32_t unitWords = layout.unitBytes / 4;
+    size_t c = 0;
+    for(size_t k=0; k<work.units.size(); k++)
+    {
+        for(; (c < work.checks.size()) && (work.checkAfter[c] == k); c++)
+        {
+            pushSectorCheck(packet, algo, work.checks[c]);
+        }
+
+        pushWaitMem(packet, algo.statusReg, algo.readyMask);
+        if (k != 0)
+        {
+            pushReadMem(packet, algo.statusReg);  // status of the previous unit
+        }
+
+        uint32_t command = algo.command | (work.units[k] & algo.addressMask);
+        const uint32_t *words = &work.words[k*unitWords];
+        if (layout.useBlock)
+        {
+            packet.push_back(TXCMD_TYPE_WRITEMEMBLOCK);
+            pushUInt32(packet, algo.paramReg);
+            packet.push_back(1 + unitWords);
+            pushUInt32(packet, command);
+            for(uint32_t i=0; i<unitWords; i++)
+                pushUInt32(packet, words[i]);
+        }
+        else
+        {
+            pushWriteMem(packet, algo.paramReg, command);
+            for(uint32_t i=0; i<unitWords; i++)
+                pushWriteMem(packet, algo.paramReg + 4*(i+1), words[i]);
+        }
+
+        pushWriteMem(packet, algo.statusReg, algo.launchValue);
+    }
+
+    // the checks after the last unit
+    for(; c<work.checks.size(); c++)
+    {
+        pushSectorCheck(packet, algo, work.checks[c]);
+    }
+
+    if (!work.units.empty())
+    {
+        pushWaitMem(packet, algo.statusReg, algo.readyMask);
+        pushReadMem(packet, algo.statusReg);
+    }
+}
+
+bool FlashEngine::build(const InterfaceInfo &info, const FlashAlgorithm &algo, const uint8_t *data, size_t bytes,
+    Plan &plan, std::string &error)
+{
+    Layout layout;
+    if (!getLayout(info, algo, data, bytes, layout, error))
+    {
+        return false;
+    }
+
+    size_t packetCount = layout.packetCount();
+    plan.packets.resize(packetCount);
+    plan.packetEnd.resize(packetCount);
+    plan.units.resize(packetCount);
+    plan.checks.resize(packetCount);
+    PacketWork work;
+    for(size_t p=0; p<packetCount; p++)
+    {
+        readPacketWords(algo, layout, data, bytes, p, work);
+        buildPacket(algo, layout, work);
+        plan.packets[p].swap(work.packet);
+        plan.packetEnd[p] = work.packetEnd;
+        plan.units[p].swap(work.units);
+        plan.checks[p].swap(work.checks);
+    }
+    return true;
+}
+
+bool FlashEngine::checkResult(const std::vector<uint8_t> &result, uint32_t errorMask,
+    const std::vector<uint32_t> &units, const std::vector<SectorCheck> &checks, std::string &error)
+{
+    if (result.empty() || (units.empty() && checks.empty()))
+    {
+        return true;
+    }
+
+    // the status words, without the checksums in between
+    size_t words = (result.size() - 1) / 4;
+    size_t statusCount = 0;
+    size_t c = 0;
+    for(size_t i=0; i<words; i++)
+    {
+        if ((c < checks.size()) && (checks[c].wordIndex + c == i))
+        {
+            c++;
+            continue;
+        }
+        uint32_t status = getUInt32(&result[1+4*i]);
+        if ((statusCount < units.size()) && ((status & errorMask) != 0))
+        {
+            setError(error, "flash programming failed at 0x%08X, status register = 0x%08X",
+                units[statusCount], status);
+            return false;
+        }
+        statusCount++;
+    }
+    if (result[0] != RXCMD_STATUS_OK)
+    {
+        uint32_t address = (statusCount < units.size()) ? units[statusCount] :
+                           units.empty() ? checks[0].address : units[0];
+        setError(error, "flash programming failed near 0x%08X with interface status %d",
+            address, result[0]);
+        return false;
+    }
+
+    // the units were programmed, now compare the sectors
+    for(size_t k=0; k<checks.size(); k++)
+    {
+        size_t i = checks[k].wordIndex + k;
+        if (i >= words)
+        {
+            continue;
+        }
+        uint32_t crc = getUInt32(&result[1+4*i]);
+        if (crc != checks[k].crc)
+        {
+            setError(error, "verify failed in 0x%08X..0x%08X, checksum 0x%08X, expected 0x%08X",
+                checks[k].address, checks[k].address + checks[k].bytes - 1, crc, checks[k].crc);
+            return false;
+        }
+    }
+    return true;
+}
+
+// *****************************************
+// ** the stages of program()
+// *****************************************
+
+#define STAGE_QUEUE_PACKETS 16      // packets between two stages
+
+typedef SpscQueue<PacketWork*> WorkQueue;
+
+/** reads the image words of the packets */
+class ProducerStage : public QThread
+{
+public:
+    ProducerStage(const FlashAlgorithm &algo, const Layout &layout, const uint8_t *data, size_t bytes,
+        WorkQueue &out, StageStats &stats) :
+        m_algo(algo), m_layout(layout), m_data(data), m_bytes(bytes), m_out(out), m_stats(stats)
+    {
+    }
+
+protected:
+    void run()
+    {
+        StageTimer timer(m_stats);
+        for(size_t p=0; p<m_layout.packetCount(); p++)
+        {
+            PacketWork *work = new PacketWork;
+            readPacketWords(m_algo, m_layout, m_data, m_bytes, p, *work);
+            m_stats.items++;
+            if (!m_out.push(work, m_stats))
+            {
+                delete work;
+                break;
+            }
+        }
+        m_out.close();
+    }
+
+    const FlashAlgorithm    &m_algo;
+    const Layout    &m_layout;
+    const uint8_t   *m_data;
+    size_t          m_bytes;
+    WorkQueue       &m_out;
+    StageStats      &m_stats;
+};
+
+/** builds the commands of the packets and COBS encodes them */
+class EncoderStage : public QThread
+{
+public:
+    EncoderStage(const FlashAlgorithm &algo, const Layout &layout, WorkQueue &in, WorkQueue &out,
+        StageStats &stats) :
+        m_algo(algo), m_layout(layout), m_in(in), m_out(out), m_stats(stats), m_failed(false)
+    {
+    }
+
+    bool failed() const
+    {
+        return m_failed;
+    }
+
+protected:
+    void run()
+    {
+        StageTimer timer(m_stats);
+        PacketWork *work;
+        while(m_in.pop(work, m_stats))
+        {
+            buildPacket(m_algo, m_layout, *work);
+            if (!COBS::encode(work->packet, work->encoded))
+            {
+                m_failed = true;
+                delete work;
+                m_in.abort();
+                break;
+            }
+            m_stats.items++;
+            if (!m_out.push(work, m_stats))
+            {
+                delete work;
+                break;
+            }
+        }
+        m_out.close();
+    }
+
+    const FlashAlgorithm    &m_algo;
+    const Layout            &m_layout;
+    WorkQueue               &m_in;
+    WorkQueue               &m_out;
+    StageStats              &m_stats;
+    bool                    m_failed;
+};
+
+/** checks the status words in the result packets */
+class CheckerStage : public QThread
+{
+public:
+    CheckerStage(uint32_t errorMask, WorkQueue &in, WorkQueue &abortQueue, StageStats &stats) :
+        m_errorMask(errorMask), m_in(in), m_abortQueue(abortQueue), m_stats(stats), m_failed(false)
+    {
+    }
+
+    bool failed() const
+    {
+        return m_failed;
+    }
+
+    /** the reason of the failure, read it after the stage has finished */
+    const std::string& error() const
+    {
+        return m_error;
+    }
+
+protected:
+    void run()
+    {
+        StageTimer timer(m_stats);
+        PacketWork *work;
+        while(m_in.pop(work, m_stats))
+        {
+            if (!m_failed && !FlashEngine::checkResult(work->result, m_errorMask, work->units, work->checks, m_error))
+            {
+                // stop building packets, a unit failed
+                m_failed = true;
+                m_abortQueue.abort();
+            }
+            m_stats.items++;
+            delete work;
+        }
+    }
+
+    uint32_t        m_errorMask;
+    WorkQueue       &m_in;
+    WorkQueue       &m_abortQueue;
+    StageStats      &m_stats;
+    bool            m_failed;
+    std::string     m_error;
+};
+
+/** the serial I/O stage, it runs on the thread that opened
+    the serial port */
+class IOStage : public PacketSource
+{
+public:
+    IOStage(WorkQueue &in, WorkQueue &out, ProgressReporter *progress, size_t bytes, StageStats &stats) :
+        m_in(in), m_out(out), m_progress(progress), m_bytes(bytes), m_reported(0), m_stats(stats)
+    {
+    }
+
+    ~IOStage()
+    {
+        for(size_t i=0; i<m_inFlight.size(); i++)
+        {
+            delete m_inFlight[i];
+        }
+    }
+
+    bool nextPacket(EncodedPacket &packet)
+    {
+        PacketWork *work;
+        if (!m_in.pop(work, m_stats))
+        {
+            return false;
+        }
+        m_inFlight.push_back(work);
+        packet.data = &work->encoded[0];
+        packet.bytes = work->encoded.size();
+        return true;
+    }
+
+    void resultPacket(std::vector<uint8_t> &result)
+    {
+        PacketWork *work = m_inFlight.front();
+        m_inFlight.pop_front();
+        work->result.swap(result);
+        m_stats.items++;
+        if ((m_progress != 0) && (work->packetEnd > m_reported))
+        {
+            m_progress->advance(work->packetEnd - m_reported);
+            m_reported = work->packetEnd;
+        }
+        if (!m_out.push(work, m_stats))
+        {
+            delete work;
+        }
+    }
+
+    /** report the bytes after the last packet */
+    void finish(bool ok)
+    {
+        if ((m_progress != 0) && ok && (m_reported < m_bytes))
+        {
+            m_progress->advance(m_bytes - m_reported);
+        }
+        m_out.close();
+    }
+
+protected:
+    WorkQueue               &m_in;
+    WorkQueue               &m_out;
+    ProgressReporter        *m_progress;
+    size_t                  m_bytes;
+    size_t                  m_reported;
+    StageStats              &m_stats;
+    std::deque<PacketWork*> m_inFlight;
+};
+
+bool FlashEngine::program(HardwareInterface *hw, const FlashAlgorithm &algo, const uint8_t *data, size_t bytes,
+    std::string &error, ProgressReporter *progress, PipelineStats *stats)
+{
+    InterfaceInfo info;
+    if (!hw->getInterfaceInfo(info))
+    {
+        error = hw->getLastError();
+        return false;
+    }
+
+    Layout layout;
+    if (!getLayout(info, algo, data, bytes, layout, error))
+    {
+        return false;
+    }
+
+    StageStats producerStats("producer");
+    StageStats encoderStats("encoder");
+    StageStats ioStats("serial I/O");
+    StageStats checkerStats("checker");
+    WorkQueue wordQueue(STAGE_QUEUE_PACKETS);
+    WorkQueue packetQueue(STAGE_QUEUE_PACKETS);
+    WorkQueue resultQueue(STAGE_QUEUE_PACKETS);
+
+    ProducerStage producer(algo, layout, data, bytes, wordQueue, producerStats);
+    EncoderStage encoder(algo, layout, wordQueue, packetQueue, encoderStats);
+    CheckerStage checker(algo.errorMask, resultQueue, packetQueue, checkerStats);
+    producer.start();
+    encoder.start();
+    checker.start();
+
+    bool ok;
+    {
+        IOStage io(packetQueue, resultQueue, progress, bytes, ioStats);
+        StageTimer timer(ioStats);
+        ok = hw->executeStream(io);
+        io.finish(ok);
+
+        // unblock the producer and the encoder when the
+        // packets were not all sent
+        wordQueue.abort();
+        packetQueue.abort();
+    }
+    producer.wait();
+    encoder.wait();
+    checker.wait();
+
+    // drop the packets that were not sent
+    PacketWork *work;
+    while(wordQueue.take(work) || packetQueue.take(work))
+    {
+        delete work;
+    }
+
+    if (stats != 0)
+    {
+        std::vector<StageStats> stages;
+        stages.push_back(producerStats);
+        stages.push_back(encoderStats);
+        stages.push_back(ioStats);
+        stages.push_back(checkerStats);
+        stats->add(stages);
+    }
+
+    if (checker.failed())
+    {
+        error = checker.error();
+        return false;
+    }
+    if (encoder.failed())
+    {
+        error = "cannot COBS encode a program packet";
+        return false;
+    }
+    if (!ok)
+    {
+        error = hw->getLastError();
+        return false;
+    }
+    return true;
+}
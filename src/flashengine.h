@@ -0,0 +1,119 @@
+/*
+
+  Swagger - A tool for programming ARM processors using the SWD protocol
+
+  Niels A. Moseley (c) Moseley Instruments 2016
+
+  Flash programming engine
+
+  Programs an image using a flash controller that is driven
+  through memory mapped registers, like the Kinetis FTFA:
+  a status register with a command-complete flag and error
+  flags, and a block of parameter registers that holds the
+  command, the flash address and the data.
+
+  For every programming unit the engine waits until the
+  controller is ready, writes the parameter registers, launches
+  the command and reads back the status register. Many units
+  are sent in each packet.
+
+  The packets are built while the earlier packets are on the
+  wire. A producer thread reads the image words of the packets,
+  an encoder thread builds the commands and COBS encodes them,
+  the calling thread sends them and receives the results, and a
+  checker thread checks the status of every unit. The serial
+  port stays on the calling thread, the thread that opened it.
+
+  When the algorithm has a verify size, the interface checksums
+  every sector of the image right after its last unit is
+  programmed, in the same packet, while the next packets are
+  already on the wire. Erased sectors are checksummed as well.
+  The checker compares the checksums with the image, so a bad
+  sector stops the programming early instead of being found by
+  a verify pass after the whole image is written.
+
+*/
+
+#ifndef flashengine_h
+#define flashengine_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+#include "hardwareinterface.h"
+#include "progress.h"
+#include "pipeline.h"
+
+/** description of the flash controller and its program command */
+struct FlashAlgorithm
+{
+    uint32_t statusReg;     // address of the status register
+    uint32_t clearValue;    // written to the status register to clear the error flags
+    uint32_t launchValue;   // written to the status register to launch a command
+    uint32_t readyMask;     // status bits that are set when the controller is ready
+    uint32_t errorMask;     // status bits that signal an error
+    uint32_t paramReg;      // address of the first parameter register
+    uint32_t command;       // first parameter word, the flash address is or-ed in
+    uint32_t addressMask;   // bits of the flash address that go into the command word
+    uint32_t programSize;   // bytes programmed by one command, a power of 2, at least 4
+    uint32_t baseAddress;   // flash address of the first byte of the image
+    bool     skipErased;    // don't program units that are all 0xFF
+    uint32_t verifySize;    // bytes of a sector that is checksummed after programming, 0 = off
+};
+
+namespace FlashEngine
+{
+    /** the checksum of a sector, taken after programming */
+    struct SectorCheck
+    {
+        uint32_t    address;    // flash address of the checked bytes
+        uint32_t    bytes;
+        uint32_t    crc;        // CRC32 of the image bytes
+        uint32_t    wordIndex;  // status words in the result before the checksum
+    };
+
+    /** the packets that program an image */
+    struct Plan
+    {
+        std::vector< std::vector<uint8_t> > packets;
+        std::vector<size_t>                 packetEnd;  // image bytes done after each packet
+        std::vector< std::vector<uint32_t> > units;     // flash address of the units of each packet
+        std::vector< std::vector<SectorCheck> > checks; // sector checksums of each packet
+    };
+
+    /** Build the packets that program an image with an interface.
+        Returns false, with the reason in error, if the algorithm
+        cannot be used.
+    */
+    bool build(const InterfaceInfo &info, const FlashAlgorithm &algo, const uint8_t *data, size_t bytes,
+        Plan &plan, std::string &error);
+
+    /** Check the result packet of a program packet, which holds
+        the status register after every unit and the checksums
+        of the sectors. units holds the flash addresses of the
+        units of the packet. On failure, error names the failing
+        flash address or sector.
+    */
+    bool checkResult(const std::vector<uint8_t> &result, uint32_t errorMask,
+        const std::vector<uint32_t> &units, const std::vector<SectorCheck> &checks, std::string &error);
+
+    /** Program an image. Returns true on success.
+        The image does not have to start or end on a programming
+        unit boundary; the rest of the unit is filled with 0xFF.
+        On failure, error holds the reason, such as the failing
+        flash address and the value of the status register; it
+        is printed by the caller, on the thread of its session.
+        When a progress reporter is given, the image bytes
+        are added to it as the packets complete.
+        Reading the image, building the packets and checking
+        the results run on their own threads while the packets
+        are sent, see pipeline.h. When stats is given, the
+        counters of the stages are added to it.
+    */
+    bool program(HardwareInterface *hw, const FlashAlgorithm &algo, const uint8_t *data, size_t bytes,
+        std::string &error, ProgressReporter *progress = 0, PipelineStats *stats = 0);
+}
+
+#endif
@@ -7,9 +7,14 @@
 */
 
 #include <stdexcept>
+#include <algorithm>
+#include <QElapsedTimer>
 #include "hardwareinterface.h"
 #include "cobs.h"
 
+#define READY_FIRST_TIMEOUT_MS  10
+#define READY_MAX_TIMEOUT_MS    160
+
 HardwareInterface* HardwareInterface::open(const char *comport, uint32_t baudrate)
 {    
     try
@@ -36,6 +41,9 @@ HardwareInterface::~HardwareInterface()
 HardwareInterface::HardwareInterface(const char *comport, uint32_t baudrate) : m_timeout(1000)
 {
     m_debug = false;
+    m_infoValid = false;
+    m_nextHandle = 1;
+    m_packetsReceived = 0;
     switch(baudrate)
     {
     case 1200:
@@ -97,28 +105,36 @@ bool HardwareInterface::writePacket(const std::vector<uint8_t> &data)
 
     // do COBS encoding
     std::vector<uint8_t> cobsbuffer;
-    if (COBS::encode(data, cobsbuffer))
+    if (!COBS::encode(data, cobsbuffer))
     {
-        if (m_debug)
-        {
-            printf("TX (COBS) ");
-            printPacket(cobsbuffer);
-        }
-        if (m_port.write((const char*)&cobsbuffer[0], cobsbuffer.size()) != cobsbuffer.size())
-        {
-            // unexpected fragmentation .. :-0
-            m_lastError = "Unexpected fragmentation";
-            return false;
-        }
-        if (!m_port.waitForBytesWritten(m_timeout))
-        {
-            m_lastError = "COM port timed out on write";
-            return false;
-        }
+        m_lastError = "Error COBS encoding";
+        return false;
     }
-    else
+    return writeEncoded(&cobsbuffer[0], cobsbuffer.size());
+}
+
+bool HardwareInterface::writeEncoded(const uint8_t *data, size_t bytes)
+{
+    if (!isOpen())
     {
-        m_lastError = "Error COBS encoding";
+        m_lastError = "COM port not open";
+        return false;
+    }
+
+    if (m_debug)
+    {
+        printf("TX (COBS) ");
+        printPacket(std::vector<uint8_t>(data, data + bytes));
+    }
+    if (m_port.write((const char*)data, bytes) != (qint64)bytes)
+    {
+        // unexpected fragmentation .. :-0
+        m_lastError = "Unexpected fragmentation";
+        return false;
+    }
+    if (!m_port.waitForBytesWritten(m_timeout))
+    {
+        m_lastError = "COM port timed out on write";
         return false;
     }
     return true;
@@ -184,9 +200,353 @@ bool HardwareInterface::readPacket(std::vector<uint8_t> &data)
         m_lastError = "Error COBS encoding";
         return false;
     }
+    m_packetsReceived++;
+    return true;
+}
+
+bool HardwareInterface::queryInterfaceInfo()
+{
+    std::vector<uint8_t> cmd;
+    std::vector<uint8_t> result;
+    cmd.push_back(TXCMD_TYPE_GETPROGID);
+    if (!writePacket(cmd) || !readPacket(result))
+    {
+        return false;
+    }
+
+    if ((result.size() < 4) || (result[0] != RXCMD_STATUS_OK))
+    {
+        m_lastError = "Unexpected reply to GET INTERFACE INFO";
+        return false;
+    }
+
+    m_info.version = result[1];
+    m_info.rxBufSize = result[2] | (result[3] << 8);
+    m_info.rxBufCount = 1;
+    if ((m_info.version >= 2) && (result.size() >= 5))
+    {
+        m_info.rxBufCount = result[4];
+    }
+    m_info.txBufSize = 60;
+    if ((m_info.version >= 5) && (result.size() >= 7))
+    {
+        m_info.txBufSize = result[5] | (result[6] << 8);
+    }
     return true;
 }
 
+bool HardwareInterface::getInterfaceInfo(InterfaceInfo &info)
+{
+    if (!m_infoValid)
+    {
+        if (!flushAsync())
+        {
+            return false;
+        }
+        m_infoValid = queryInterfaceInfo();
+    }
+
+    info = m_info;
+    return m_infoValid;
+}
+
+bool HardwareInterface::waitUntilReady(uint32_t maxWaitMs)
+{
+    if (m_infoValid)
+    {
+        return true;
+    }
+    if (!flushAsync())
+    {
+        return false;
+    }
+
+    uint32_t savedTimeout = m_timeout;
+    uint32_t timeout = READY_FIRST_TIMEOUT_MS;
+    bool retried = false;
+    QElapsedTimer timer;
+    timer.start();
+    while(true)
+    {
+        // drop what a starting interface may have sent
+        m_port.clear(QSerialPort::Input);
+
+        QElapsedTimer attempt;
+        attempt.start();
+        m_timeout = timeout;
+        if (queryInterfaceInfo())
+        {
+            m_infoValid = true;
+            break;
+        }
+        if (timer.elapsed() >= maxWaitMs)
+        {
+            break;
+        }
+
+        // a garbled reply fails early, don't retry faster
+        // than the timeout.
+        qint64 spent = attempt.elapsed();
+        if (spent < timeout)
+        {
+            m_port.waitForReadyRead(timeout - spent);
+        }
+        retried = true;
+        timeout = std::min(timeout*2, (uint32_t)READY_MAX_TIMEOUT_MS);
+    }
+
+    if (m_infoValid && retried)
+    {
+        // an earlier query may still be answered late,
+        // that reply would be taken for the next result.
+        // Drop everything, including a partial frame, until
+        // the line has been quiet for the last timeout.
+        QElapsedTimer drain;
+        drain.start();
+        m_port.readAll();
+        while(m_port.waitForReadyRead(timeout) && (drain.elapsed() < maxWaitMs))
+        {
+            m_port.readAll();
+        }
+        m_port.readAll();
+    }
+
+    m_timeout = savedTimeout;
+    if (!m_infoValid)
+    {
+        m_lastError = "The programming interface does not answer";
+    }
+    return m_infoValid;
+}
+
+bool HardwareInterface::executePackets(const std::vector< std::vector<uint8_t> > &packets,
+                                       std::vector< std::vector<uint8_t> > &results,
+                                       PacketDoneFunc done, void *context)
+{
+    if (m_debug)
+    {
+        for(size_t i=0; i<packets.size(); i++)
+        {
+            printf("TX ");
+            printPacket(packets[i]);
+        }
+    }
+
+    std::vector< std::vector<uint8_t> > cobsbuffers(packets.size());
+    std::vector<EncodedPacket> encoded(packets.size());
+    for(size_t i=0; i<packets.size(); i++)
+    {
+        if (!COBS::encode(packets[i], cobsbuffers[i]))
+        {
+            m_lastError = "Error COBS encoding";
+            return false;
+        }
+        encoded[i].data = &cobsbuffers[i][0];
+        encoded[i].bytes = cobsbuffers[i].size();
+    }
+    return executeEncodedPackets(encoded, results, done, context);
+}
+
+/** the packets and results of executeEncodedPackets */
+class VectorSource : public PacketSource
+{
+public:
+    VectorSource(const std::vector<EncodedPacket> &packets, std::vector< std::vector<uint8_t> > &results,
+                 PacketDoneFunc done, void *context) :
+        m_packets(packets), m_results(results), m_done(done), m_context(context), m_next(0)
+    {
+    }
+
+    bool nextPacket(EncodedPacket &packet)
+    {
+        if (m_next >= m_packets.size())
+        {
+            return false;
+        }
+        packet = m_packets[m_next++];
+        return true;
+    }
+
+    void resultPacket(std::vector<uint8_t> &result)
+    {
+        m_results.push_back(std::vector<uint8_t>());
+        m_results.back().swap(result);
+        if (m_done != 0)
+        {
+            m_done(m_results.size()-1, m_context);
+        }
+    }
+
+protected:
+    const std::vector<EncodedPacket>        &m_packets;
+    std::vector< std::vector<uint8_t> >     &m_results;
+    PacketDoneFunc                          m_done;
+    void                                    *m_context;
+    size_t                                  m_next;
+};
+
+bool HardwareInterface::executeEncodedPackets(const std::vector<EncodedPacket> &packets,
+                                              std::vector< std::vector<uint8_t> > &results,
+                                              PacketDoneFunc done, void *context)
+{
+    results.clear();
+    VectorSource source(packets, results, done, context);
+    return executeStream(source);
+}
+
+bool HardwareInterface::executeStream(PacketSource &source)
+{
+    InterfaceInfo info;
+    uint32_t maxInFlight = 1;
+    if (getInterfaceInfo(info) && (info.rxBufCount > 1))
+    {
+        maxInFlight = info.rxBufCount;
+    }
+
+    if (!flushAsync())
+    {
+        return false;
+    }
+
+    size_t sent = 0;
+    size_t received = 0;
+    bool failed = false;
+    bool more = true;
+    while(true)
+    {
+        // keep the receive buffers of the hardware busy
+        if (!failed && more && (sent - received < maxInFlight))
+        {
+            EncodedPacket packet;
+            more = source.nextPacket(packet);
+            if (!more)
+            {
+                continue;
+            }
+            if (!writeEncoded(packet.data, packet.bytes))
+            {
+                failed = true;
+                continue;
+            }
+            sent++;
+            continue;
+        }
+        if (received == sent)
+        {
+            break;
+        }
+
+        std::vector<uint8_t> result;
+        if (!readPacket(result))
+        {
+            return false;
+        }
+        received++;
+        if (result.empty() || (result[0] != RXCMD_STATUS_OK))
+        {
+            // don't send more packets, but collect
+            // the results of the packets in flight
+            failed = true;
+        }
+        source.resultPacket(result);
+    }
+    return !failed;
+}
+
+uint32_t HardwareInterface::sendPacketAsync(const std::vector<uint8_t> &packet)
+{
+    InterfaceInfo info;
+    size_t maxInFlight = 1;
+    if (getInterfaceInfo(info) && (info.rxBufCount > 1))
+    {
+        maxInFlight = info.rxBufCount;
+    }
+
+    while(m_inFlight.size() >= maxInFlight)
+    {
+        if (receiveNextResult() == 0)
+        {
+            return 0;
+        }
+    }
+
+    if (!writePacket(packet))
+    {
+        return 0;
+    }
+
+    uint32_t handle = m_nextHandle++;
+    if (m_nextHandle == 0)
+    {
+        m_nextHandle = 1;   // 0 is not a valid handle
+    }
+    m_inFlight.push_back(handle);
+    return handle;
+}
+
+uint32_t HardwareInterface::receiveNextResult()
+{
+    if (m_inFlight.empty())
+    {
+        m_lastError = "No packets in flight";
+        return 0;
+    }
+
+    std::vector<uint8_t> data;
+    if (!readPacket(data))
+    {
+        // the packet stream is out of sync,
+        // the results in flight are lost.
+        m_inFlight.clear();
+        return 0;
+    }
+
+    uint32_t handle = m_inFlight.front();
+    m_inFlight.pop_front();
+    m_asyncResults[handle].swap(data);
+    return handle;
+}
+
+bool HardwareInterface::waitForResult(uint32_t handle, std::vector<uint8_t> &data)
+{
+    while(!isResultReady(handle))
+    {
+        if (std::find(m_inFlight.begin(), m_inFlight.end(), handle) == m_inFlight.end())
+        {
+            m_lastError = "Unknown or lost packet handle";
+            return false;
+        }
+        if (receiveNextResult() == 0)
+        {
+            return false;
+        }
+    }
+
+    std::map<uint32_t, std::vector<uint8_t> >::iterator iter = m_asyncResults.find(handle);
+    data.swap(iter->second);
+    m_asyncResults.erase(iter);
+    return true;
+}
+
+bool HardwareInterface::flushAsync()
+{
+    while(!m_inFlight.empty())
+    {
+        if (receiveNextResult() == 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool HardwareInterface::discardAsync()
+{
+    bool ok = flushAsync();
+    m_asyncResults.clear();
+    return ok;
+}
+
 void HardwareInterface::printPacket(const std::vector<uint8_t> &data)
 {
     size_t N = data.size();
@@ -11,6 +11,8 @@
 #define HardwareInterface_h
 
 #include <stdint.h>
+#include <deque>
+#include <map>
 #include <QtSerialPort>
 #include <QtSerialPort/QSerialPortInfo>
 
@@ -18,6 +20,41 @@
 
 typedef uint32_t HWResult;
 
+/** called by executePackets when the result of a packet has arrived */
+typedef void (*PacketDoneFunc)(size_t packetIndex, void *context);
+
+/** a packet that is COBS encoded already, including the
+    terminating zero byte */
+struct EncodedPacket
+{
+    const uint8_t   *data;
+    size_t          bytes;
+};
+
+/** supplies the packets of executeStream one at a time */
+class PacketSource
+{
+public:
+    virtual ~PacketSource() {}
+
+    /** get the next packet, returns false when there are no
+        more packets. The packet data must stay valid until
+        the next call. */
+    virtual bool nextPacket(EncodedPacket &packet) = 0;
+
+    /** called with every result packet, in the order the
+        packets were sent */
+    virtual void resultPacket(std::vector<uint8_t> &result) = 0;
+};
+
+/** information returned by the GET INTERFACE INFO command */
+struct InterfaceInfo
+{
+    uint8_t  version;       // protocol version
+    uint16_t rxBufSize;     // receive buffer size in bytes
+    uint8_t  rxBufCount;    // number of receive buffers
+    uint16_t txBufSize;     // maximum result data size in bytes
+};
 
 
 class HardwareInterface
@@ -59,18 +96,114 @@ public:
     /** write packet to the hardware interface */
     bool writePacket(const std::vector<uint8_t> &data);
 
+    /** write a COBS encoded packet to the hardware interface */
+    bool writeEncoded(const uint8_t *data, size_t bytes);
+
     /** read packet from the hardware interface */
     bool readPacket(std::vector<uint8_t> &data);
 
+    /** query the hardware interface for its protocol version
+        and receive buffers. The reply is cached once the
+        interface answered, returns false if it did not respond.
+    */
+    bool getInterfaceInfo(InterfaceInfo &info);
+
+    /** wait until the hardware interface answers GET INTERFACE
+        INFO. The query is repeated with short timeouts that
+        double after every attempt, so an interface that is
+        online answers the first query and an interface that
+        resets when the port is opened is found as soon as it
+        has started. The information is cached for
+        getInterfaceInfo. Returns false if the interface did
+        not answer within maxWaitMs.
+    */
+    bool waitUntilReady(uint32_t maxWaitMs);
+
+    /** send a list of packets and collect the result packets.
+        Up to one packet per receive buffer of the hardware is
+        kept in flight. Sending stops at the first result packet
+        that does not have an OK status; results holds all the
+        result packets received. When given, done is called for
+        every result packet as it arrives.
+    */
+    bool executePackets(const std::vector< std::vector<uint8_t> > &packets,
+                        std::vector< std::vector<uint8_t> > &results,
+                        PacketDoneFunc done = 0, void *context = 0);
+
+    /** executePackets for packets that are COBS encoded already */
+    bool executeEncodedPackets(const std::vector<EncodedPacket> &packets,
+                               std::vector< std::vector<uint8_t> > &results,
+                               PacketDoneFunc done = 0, void *context = 0);
+
+    /** executeEncodedPackets for packets that are produced while
+        the earlier packets are being sent, see PacketSource. */
+    bool executeStream(PacketSource &source);
+
+    /** send a packet without waiting for the result packet.
+        When all receive buffers of the hardware are in use,
+        the oldest result packet is received first.
+        Returns a handle to get the result with, or 0 on error.
+    */
+    uint32_t sendPacketAsync(const std::vector<uint8_t> &packet);
+
+    /** returns true if the result packet of an asynchronous
+        packet has been received. */
+    bool isResultReady(uint32_t handle) const
+    {
+        return m_asyncResults.find(handle) != m_asyncResults.end();
+    }
+
+    /** returns the number of result packets received so far */
+    uint32_t packetsReceived() const
+    {
+        return m_packetsReceived;
+    }
+
+    /** returns the number of asynchronous packets in flight */
+    size_t packetsInFlight() const
+    {
+        return m_inFlight.size();
+    }
+
+    /** receive the result packet of the oldest asynchronous
+        packet in flight. Returns its handle, or 0 on error. */
+    uint32_t receiveNextResult();
+
+    /** get the result packet of an asynchronous packet,
+        receiving result packets until it arrives.
+        The result can only be collected once.
+    */
+    bool waitForResult(uint32_t handle, std::vector<uint8_t> &data);
+
+    /** receive the result packets of all asynchronous packets
+        in flight, so the next packet can be handled synchronously. */
+    bool flushAsync();
+
+    /** receive the result packets in flight and drop all the
+        results that were not collected, their handles are no
+        longer valid. */
+    bool discardAsync();
+
 protected:
     void printPacket(const std::vector<uint8_t> &data);
 
+    /** send GET INTERFACE INFO and store the reply in m_info */
+    bool queryInterfaceInfo();
+
     HardwareInterface(const char *comport, uint32_t baudrate);
 
     bool        m_debug;
     uint32_t    m_timeout;
     QSerialPort m_port;
     std::string m_lastError;
+
+    bool          m_infoValid;
+    InterfaceInfo m_info;
+
+    uint32_t                                    m_packetsReceived;
+    uint32_t                                    m_nextHandle;
+    std::deque<uint32_t>                        m_inFlight;     // oldest first
+    std::map<uint32_t, std::vector<uint8_t> >   m_asyncResults; // results not yet collected
 };
 
 #endif
@@ -0,0 +1,264 @@
+/*
+
+  Swagger - A tool for programming ARM processors using the SWD protocol
+
+  Niels A. Moseley (c) Moseley Instruments 2016
+
+  Image scanning
+
+  All scans compare a buffer a with a buffer b, or with blank
+  (0xFF) bytes when b is NULL.
+
+*/
+
+#include <string.h>
+#include "imagescan.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define IMAGESCAN_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(IMAGESCAN_SSE2) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define IMAGESCAN_AVX2
+#include <immintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+static inline uint32_t countTrailingZeros(uint32_t x)
+{
+    unsigned long idx;
+    _BitScanForward(&idx, x);
+    return idx;
+}
+#else
+static inline uint32_t countTrailingZeros(uint32_t x)
+{
+    return __builtin_ctz(x);
+}
+#endif
+
+typedef size_t (*MatchPrefixFunc)(const uint8_t *a, const uint8_t *b, size_t n);
+
+/** number of leading bytes of a that match b,
+    one at a time. */
+static size_t matchPrefixBytes(const uint8_t *a, const uint8_t *b, size_t n)
+{
+    size_t i = 0;
+    if (b == 0)
+    {
+        while((i < n) && (a[i] == 0xFF)) i++;
+    }
+    else
+    {
+        while((i < n) && (a[i] == b[i])) i++;
+    }
+    return i;
+}
+
+/** number of leading bytes of a that match b,
+    8 bytes at a time. */
+static size_t matchPrefixScalar(const uint8_t *a, const uint8_t *b, size_t n)
+{
+    size_t i = 0;
+    uint64_t wa, wb = ~(uint64_t)0;
+    while(i + 8 <= n)
+    {
+        memcpy(&wa, a+i, 8);
+        if (b != 0)
+        {
+            memcpy(&wb, b+i, 8);
+        }
+        if (wa != wb)
+        {
+            break;
+        }
+        i += 8;
+    }
+    return i + matchPrefixBytes(a+i, b ? b+i : 0, n-i);
+}
+
+#ifdef IMAGESCAN_SSE2
+/** bit i is set when byte i of a matches b */
+static inline uint32_t matchMaskSSE2(const uint8_t *a, const uint8_t *b)
+{
+    __m128i va = _mm_loadu_si128((const __m128i*)a);
+    __m128i vb = (b != 0) ? _mm_loadu_si128((const __m128i*)b) : _mm_set1_epi8((char)0xFF);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(va, vb));
+}
+
+static size_t matchPrefixSSE2(const uint8_t *a, const uint8_t *b, size_t n)
+{
+    size_t i = 0;
+    while(i + 16 <= n)
+    {
+        uint32_t m = matchMaskSSE2(a+i, b ? b+i : 0);
+        if (m != 0xFFFF)
+        {
+            return i + countTrailingZeros(~m);
+        }
+        i += 16;
+    }
+    return i + matchPrefixBytes(a+i, b ? b+i : 0, n-i);
+}
+#endif
+
+#ifdef IMAGESCAN_AVX2
+__attribute__((target("avx2")))
+static size_t matchPrefixAVX2(const uint8_t *a, const uint8_t *b, size_t n)
+{
+    size_t i = 0;
+    __m256i ones = _mm256_set1_epi8((char)0xFF);
+    while(i + 32 <= n)
+    {
+        __m256i va = _mm256_loadu_si256((const __m256i*)(a+i));
+        __m256i vb = (b != 0) ? _mm256_loadu_si256((const __m256i*)(b+i)) : ones;
+        uint32_t m = _mm256_movemask_epi8(_mm256_cmpeq_epi8(va, vb));
+        if (m != 0xFFFFFFFF)
+        {
+            return i + countTrailingZeros(~m);
+        }
+        i += 32;
+    }
+    return i + matchPrefixSSE2(a+i, b ? b+i : 0, n-i);
+}
+#endif
+
+static const char *g_kernelName = "scalar";
+
+/** select the fastest kernel the host supports */
+static MatchPrefixFunc selectMatchPrefix()
+{
+    MatchPrefixFunc func = matchPrefixScalar;
+#ifdef IMAGESCAN_SSE2
+    func = matchPrefixSSE2;
+    g_kernelName = "sse2";
+#endif
+#ifdef IMAGESCAN_AVX2
+    __builtin_cpu_init();   // we run before main()
+    if (__builtin_cpu_supports("avx2"))
+    {
+        func = matchPrefixAVX2;
+        g_kernelName = "avx2";
+    }
+#endif
+    return func;
+}
+
+// selected before main(), so the sessions of gang mode can use it
+static MatchPrefixFunc g_matchPrefix = selectMatchPrefix();
+
+/** Number of leading bytes of a that are in units with at least
+    one byte that does not match b. a must start at a unit
+    boundary. A partial unit at the end counts as a whole unit,
+    so the result is a multiple of unitBytes.
+*/
+static size_t mismatchUnitsPrefix(const uint8_t *a, const uint8_t *b, size_t n, uint32_t unitBytes)
+{
+    MatchPrefixFunc matchPrefix = g_matchPrefix;
+    size_t i = 0;
+
+#ifdef IMAGESCAN_SSE2
+    if (unitBytes <= 16)
+    {
+        // fold the match mask so that the bit at the start of
+        // each unit is set only if all bytes of the unit match.
+        uint32_t starts = 0;
+        for(uint32_t j=0; j<16; j+=unitBytes)
+        {
+            starts |= 1U << j;
+        }
+        while(i + 16 <= n)
+        {
+            uint32_t m = matchMaskSSE2(a+i, b ? b+i : 0);
+            for(uint32_t s=1; s<unitBytes; s<<=1)
+            {
+                m &= m >> s;
+            }
+            m &= starts;
+            if (m != 0)
+            {
+                return i + countTrailingZeros(m);
+            }
+            i += 16;
+        }
+    }
+#endif
+
+    while(i < n)
+    {
+        size_t len = (n - i < unitBytes) ? n - i : unitBytes;
+        if (matchPrefix(a+i, b ? b+i : 0, len) == len)
+        {
+            return i;
+        }
+        i += unitBytes;
+    }
+    return i;
+}
+
+/** find the runs of units where a does not match b */
+static void findRuns(const uint8_t *a, const uint8_t *b, size_t bytes, uint32_t address,
+    uint32_t unitBytes, uint32_t sectorBytes, std::vector<ImageScan::Range> &runs)
+{
+    MatchPrefixFunc matchPrefix = g_matchPrefix;
+    uint64_t dataEnd = (uint64_t)address + bytes;
+    size_t i = 0;
+    while(i < bytes)
+    {
+        // skip the matching bytes
+        i += matchPrefix(a+i, b ? b+i : 0, bytes-i);
+        if (i >= bytes)
+        {
+            break;
+        }
+
+        // the run starts with the unit that holds the mismatch
+        uint64_t runStart = ((uint64_t)address + i) & ~(uint64_t)(unitBytes-1);
+        uint64_t runEnd = runStart + unitBytes;
+
+        // extend it with the following units that have a
+        // mismatch, up to the end of the sector
+        uint64_t limit = dataEnd;
+        if (sectorBytes != 0)
+        {
+            uint64_t sectorEnd = (runStart & ~(uint64_t)(sectorBytes-1)) + sectorBytes;
+            if (sectorEnd < limit)
+            {
+                limit = sectorEnd;
+            }
+        }
+        if (runEnd < limit)
+        {
+            size_t offset = runEnd - address;
+            runEnd += mismatchUnitsPrefix(a + offset, b ? b + offset : 0, limit - runEnd, unitBytes);
+        }
+
+        ImageScan::Range range;
+        range.address = runStart;
+        range.bytes = runEnd - runStart;
+        runs.push_back(range);
+
+        i = ((runEnd < dataEnd) ? runEnd : dataEnd) - address;
+    }
+}
+
+void ImageScan::findDataRuns(const uint8_t *data, size_t bytes, uint32_t address,
+    uint32_t unitBytes, uint32_t sectorBytes, std::vector<Range> &runs)
+{
+    findRuns(data, 0, bytes, address, unitBytes, sectorBytes, runs);
+}
+
+bool ImageScan::findMismatches(const uint8_t *image, const uint8_t *readback, size_t bytes,
+    uint32_t address, std::vector<Range> &mismatches)
+{
+    size_t before = mismatches.size();
+    findRuns(readback, image, bytes, address, 4, 0, mismatches);
+    return mismatches.size() == before;
+}
+
+const char* ImageScan::kernelName()
+{
+    return g_kernelName;
+}
@@ -0,0 +1,57 @@
+/*
+
+  Swagger - A tool for programming ARM processors using the SWD protocol
+
+  Niels A. Moseley (c) Moseley Instruments 2016
+
+  Image scanning
+
+  Finds the parts of an image that hold data (are not blank,
+  i.e. 0xFF) and the parts of a read back buffer that differ
+  from the image. Both work on units: a flash programming
+  phrase or a 32-bit word. A unit belongs to a run when any
+  of its bytes is non-blank or differs, so a run covers whole
+  units and is aligned to the unit size.
+
+  The scanning is done 16 or 32 bytes at a time using SSE2 or
+  AVX2 when the host supports it, with a portable fallback.
+
+*/
+
+#ifndef imagescan_h
+#define imagescan_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+namespace ImageScan
+{
+    /** an address range */
+    struct Range
+    {
+        uint32_t address;
+        uint32_t bytes;
+    };
+
+    /** Find the runs of units that are not blank. The first byte
+        of data is at the given address. Bytes of the first and
+        last unit that are outside the data count as blank.
+        When sectorBytes is not 0, runs are split at the sector
+        boundaries. unitBytes and sectorBytes must be powers of 2.
+    */
+    void findDataRuns(const uint8_t *data, size_t bytes, uint32_t address,
+        uint32_t unitBytes, uint32_t sectorBytes, std::vector<Range> &runs);
+
+    /** Find the runs of 32-bit words where the read back data
+        differs from the image. Returns true if they are equal.
+    */
+    bool findMismatches(const uint8_t *image, const uint8_t *readback, size_t bytes,
+        uint32_t address, std::vector<Range> &mismatches);
+
+    /** Returns the name of the scanning code in use:
+        "avx2", "sse2" or "scalar" */
+    const char* kernelName();
+}
+
+#endif
@@ -0,0 +1,446 @@
+/*
+
+  Swagger - A tool for programming ARM processors using the SWD protocol
+
+  Niels A. Moseley (c) Moseley Instruments 2016
+
+  Daemon mode job server
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#ifndef _WIN32
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#endif
+#include "jobserver.h"
+
+#define REQUEST_TIMEOUT_MS  5000
+#define MAX_REQUEST_BYTES   65536
+
+#ifdef _WIN32
+
+JobServer::JobServer() : m_fd(-1)
+{
+}
+
+JobServer::~JobServer()
+{
+}
+
+bool JobServer::listen(const std::string &path)
+{
+    printf("Error: daemon mode is not supported on Windows\n");
+    return false;
+}
+
+void JobServer::serve(HSQUIRRELVM v)
+{
+}
+
+int JobServer::submit(const std::string &path, const std::vector<std::string> &job)
+{
+    printf("Error: daemon mode is not supported on Windows\n");
+    return -1;
+}
+
+#else
+
+/** fill in the address of a socket, returns false if the path is too long */
+static bool getAddress(const std::string &path, struct sockaddr_un &addr)
+{
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path))
+    {
+        printf("Error: socket path %s is too long\n", path.c_str());
+        return false;
+    }
+    strcpy(addr.sun_path, path.c_str());
+    return true;
+}
+
+static bool writeAll(int fd, const char *data, size_t bytes)
+{
+    while(bytes > 0)
+    {
+        ssize_t n = write(fd, data, bytes);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+        data += n;
+        bytes -= n;
+    }
+    return true;
+}
+
+/** split a job into words, see jobserver.h */
+static void splitWords(const std::string &line, std::vector<std::string> &words)
+{
+    size_t i = 0;
+    while(i < line.size())
+    {
+        if (line[i] == ' ')
+        {
+            i++;
+            continue;
+        }
+        std::string word;
+        if (line[i] == '"')
+        {
+            size_t end = line.find('"', i+1);
+            if (end == std::string::npos)
+            {
+                end = line.size();
+            }
+            word = line.substr(i+1, end-i-1);
+            i = end + 1;
+        }
+        else
+        {
+            size_t end = line.find(' ', i);
+            if (end == std::string::npos)
+            {
+                end = line.size();
+            }
+            word = line.substr(i, end-i);
+            i = end;
+        }
+        words.push_back(word);
+    }
+}
+
+JobServer::JobServer() : m_fd(-1)
+{
+}
+
+JobServer::~JobServer()
+{
+    if (m_fd >= 0)
+    {
+        close(m_fd);
+        unlink(m_path.c_str());
+    }
+}
+
+bool JobServer::listen(const std::string &path)
+{
+    struct sockaddr_un addr;
+    if (!getAddress(path, addr))
+    {
+        return false;
+    }
+
+    m_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (m_fd < 0)
+    {
+        printf("Error: cannot create socket: %s\n", strerror(errno));
+        return false;
+    }
+
+    // only the user that runs the daemon may connect,
+    // a job can flash and read out the attached boards.
+    mode_t mask = umask(077);
+    if (bind(m_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0)
+    {
+        // a socket file is left behind when a daemon is
+        // killed: replace it if nobody listens on it.
+        int error = errno;
+        bool inUse = false;
+        if (error == EADDRINUSE)
+        {
+            int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+            inUse = (probe >= 0) && (connect(probe, (struct sockaddr*)&addr, sizeof(addr)) == 0);
+            if (probe >= 0)
+            {
+                close(probe);
+            }
+            if (!inUse && (unlink(path.c_str()) == 0) &&
+                (bind(m_fd, (struct sockaddr*)&addr, sizeof(addr)) == 0))
+            {
+                error = 0;
+            }
+            else
+            {
+                error = inUse ? EADDRINUSE : errno;
+            }
+        }
+        if (error != 0)
+        {
+            umask(mask);
+            printf("Error: cannot listen on %s: %s\n", path.c_str(),
+                inUse ? "a daemon is running already" : strerror(error));
+            close(m_fd);
+            m_fd = -1;
+            return false;
+        }
+    }
+
+    umask(mask);
+
+    if (::listen(m_fd, 4) != 0)
+    {
+        printf("Error: cannot listen on %s: %s\n", path.c_str(), strerror(errno));
+        close(m_fd);
+        unlink(path.c_str());
+        m_fd = -1;
+        return false;
+    }
+    m_path = path;
+    return true;
+}
+
+bool JobServer::readRequest(int fd, std::string &dir, std::vector<std::string> &job)
+{
+    std::string request;
+    size_t lines = 0;
+    while(lines < 2)
+    {
+        struct pollfd pfd;
+        pfd.fd = fd;
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, REQUEST_TIMEOUT_MS) <= 0)
+        {
+            return false;
+        }
+
+        char buffer[1024];
+        ssize_t n = read(fd, buffer, sizeof(buffer));
+        if (n <= 0)
+        {
+            return false;
+        }
+        for(ssize_t i=0; i<n; i++)
+        {
+            if (buffer[i] == '\n')
+            {
+                lines++;
+            }
+        }
+        request.append(buffer, n);
+        if (request.size() > MAX_REQUEST_BYTES)
+        {
+            return false;
+        }
+    }
+
+    size_t eol = request.find('\n');
+    dir = request.substr(0, eol);
+    splitWords(request.substr(eol+1, request.find('\n', eol+1) - eol - 1), job);
+    return !job.empty();
+}
+
+int JobServer::runJob(HSQUIRRELVM v, int fd, const std::vector<std::string> &job)
+{
+    // the output of the job, including the output of
+    // the natives and the progress, goes to the client.
+    fflush(stdout);
+    fflush(stderr);
+    int savedOut = dup(STDOUT_FILENO);
+    int savedErr = dup(STDERR_FILENO);
+    dup2(fd, STDOUT_FILENO);
+    dup2(fd, STDERR_FILENO);
+
+    SQInteger result = -1;
+    SQInteger top = sq_gettop(v);
+    sq_pushroottable(v);
+    sq_pushstring(v, _SC("runJob"), -1);
+    if (SQ_SUCCEEDED(sq_get(v, -2)))
+    {
+        sq_pushroottable(v);
+        sq_newarray(v, 0);
+        for(size_t i=0; i<job.size(); i++)
+        {
+            sq_pushstring(v, job[i].c_str(), -1);
+            sq_arrayappend(v, -2);
+        }
+        if (SQ_SUCCEEDED(sq_call(v, 2, SQTrue, SQTrue)))
+        {
+            sq_getinteger(v, -1, &result);
+        }
+    }
+    else
+    {
+        printf("Error: the scripts have no runJob function\n");
+    }
+    sq_settop(v, top);
+
+    fflush(stdout);
+    fflush(stderr);
+    dup2(savedOut, STDOUT_FILENO);
+    dup2(savedErr, STDERR_FILENO);
+    close(savedOut);
+    close(savedErr);
+    return result;
+}
+
+void JobServer::serve(HSQUIRRELVM v)
+{
+    // a client that goes away must not stop the daemon
+    signal(SIGPIPE, SIG_IGN);
+
+    char cwd[4096];
+    if (getcwd(cwd, sizeof(cwd)) == 0)
+    {
+        cwd[0] = 0;
+    }
+
+    printf("Waiting for jobs on %s\n", m_path.c_str());
+    fflush(stdout);
+
+    bool done = false;
+    while(!done)
+    {
+        int client = accept(m_fd, 0, 0);
+        if (client < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            printf("Error: accept %s\n", strerror(errno));
+            break;
+        }
+
+        std::string dir;
+        std::vector<std::string> job;
+        if (!readRequest(client, dir, job))
+        {
+            close(client);
+            continue;
+        }
+
+        int result = 0;
+        if (job[0] == "quit")
+        {
+            done = true;
+        }
+        else if (chdir(dir.c_str()) != 0)
+        {
+            const char *msg = "Error: the daemon cannot use the working directory of the client\n";
+            writeAll(client, msg, strlen(msg));
+            result = -1;
+        }
+        else
+        {
+            result = runJob(v, client, job);
+            if ((cwd[0] != 0) && (chdir(cwd) != 0))
+            {
+                printf("Warning: cannot return to %s\n", cwd);
+            }
+        }
+
+        std::string line = job[0];
+        for(size_t i=1; i<job.size(); i++)
+        {
+            line += " " + job[i];
+        }
+        printf("Job %s: %s\n", line.c_str(), (result == 0) ? "ok" : "FAILED");
+        fflush(stdout);
+
+        char tail[32];
+        int n = snprintf(tail, sizeof(tail), "%c%d\n", 0, result);
+        writeAll(client, tail, n);
+        close(client);
+    }
+}
+
+int JobServer::submit(const std::string &path, const std::vector<std::string> &job)
+{
+    struct sockaddr_un addr;
+    if (!getAddress(path, addr))
+    {
+        return -1;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if ((fd < 0) || (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0))
+    {
+        printf("Error: cannot connect to the daemon on %s: %s\n", path.c_str(), strerror(errno));
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        return -1;
+    }
+
+    char cwd[4096];
+    if (getcwd(cwd, sizeof(cwd)) == 0)
+    {
+        cwd[0] = 0;
+    }
+    std::string request = cwd;
+    request += '\n';
+    for(size_t i=0; i<job.size(); i++)
+    {
+        if (i > 0)
+        {
+            request += ' ';
+        }
+        bool quote = job[i].empty() || (job[i].find(' ') != std::string::npos);
+        request += quote ? "\"" + job[i] + "\"" : job[i];
+    }
+    request += '\n';
+    if (!writeAll(fd, request.data(), request.size()))
+    {
+        printf("Error: cannot send the job to the daemon: %s\n", strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    // stream the output until the NUL byte, the result follows it
+    bool ended = false;
+    std::string resultText;
+    char buffer[4096];
+    ssize_t n;
+    while((n = read(fd, buffer, sizeof(buffer))) != 0)
+    {
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            break;
+        }
+        ssize_t text = n;
+        if (!ended)
+        {
+            char *nul = (char*)memchr(buffer, 0, n);
+            if (nul != 0)
+            {
+                ended = true;
+                text = nul - buffer;
+                resultText.append(nul+1, n-text-1);
+            }
+            fwrite(buffer, 1, text, stdout);
+            fflush(stdout);
+        }
+        else
+        {
+            resultText.append(buffer, n);
+        }
+    }
+    close(fd);
+
+    if (!ended)
+    {
+        printf("Error: the daemon closed the connection\n");
+        return -1;
+    }
+    return atoi(resultText.c_str());
+}
+
+#endif
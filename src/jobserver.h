@@ -0,0 +1,64 @@
+/*
+
+  Swagger - A tool for programming ARM processors using the SWD protocol
+
+  Niels A. Moseley (c) Moseley Instruments 2016
+
+  Daemon mode job server
+
+  In daemon mode swagger keeps the programmer open and the
+  scripts loaded, and runs jobs it receives on a Unix domain
+  socket. Every job is handled by the runJob function of the
+  scripts, see targets/jobs.nut, so a job costs only the time
+  to connect to the target and do the work.
+
+  A client connects, sends a request and receives the output
+  of the job until the job ends:
+
+  request  : working directory '\n' job '\n'
+             job is a list of words separated by spaces, words
+             with spaces are put between double quotes.
+  response : the output of the job, a NUL byte, the result
+             of the job as a decimal number.
+
+  The job "quit" stops the daemon.
+
+*/
+
+#ifndef jobserver_h
+#define jobserver_h
+
+#include <string>
+#include <vector>
+#include <squirrel.h>
+
+class JobServer
+{
+public:
+    JobServer();
+    ~JobServer();
+
+    /** Listen on a socket. A socket file that is left behind
+        by a daemon that no longer runs is replaced. */
+    bool listen(const std::string &path);
+
+    /** run the jobs until a quit job is received */
+    void serve(HSQUIRRELVM v);
+
+    /** Submit a job to a daemon and copy its output to stdout.
+        Returns the result of the job, or -1 if the daemon
+        could not be reached. */
+    static int submit(const std::string &path, const std::vector<std::string> &job);
+
+protected:
+    /** read the request of a client */
+    static bool readRequest(int fd, std::string &dir, std::vector<std::string> &job);
+
+    /** call runJob of the scripts, the output goes to fd */
+    static int runJob(HSQUIRRELVM v, int fd, const std::vector<std::string> &job);
+
+    int         m_fd;
+    std::string m_path;
+};
+
+#endif
@@ -15,15 +15,46 @@
 #include <QString>
 #include <QCoreApplication>
 #include <QCommandLineParser>
+#include <QStandardPaths>
+#include <QDir>
+#include <QFileInfo>
+#include <QThread>
+#include <QElapsedTimer>
+#ifdef _WIN32
+#include <QRegExp>
+#endif
 
 #include "cobs.h"
 #include "hardwareinterface.h"
 #include "squirrel_funcs.h"
+#include "cmdoptimizer.h"
+#include "firmwareimage.h"
+#include "jobserver.h"
+#include "scriptbundle.h"
+#include "scriptcache.h"
+#include "session.h"
+#include "targetplugin.h"
 
 #define VERSION "0.1"
 
-// dirty hack ..
-HardwareInterface* g_interface = NULL;
+/** the settings of a programming session, from the command line */
+struct SessionOptions
+{
+    std::string binFile;
+    std::string procType;
+    std::string scriptDir;      // ends with a path separator
+    std::string pluginDir;
+    std::string cacheDir;       // empty when the script cache is disabled
+    std::string socketPath;     // job socket in daemon mode, else empty
+    std::string streamFile;     // precompiled packet stream, else empty
+    uint32_t    probeInterval;  // ms between two target probes in the production loop
+    uint32_t    baudrate;
+    bool        optimizer;
+    bool        verbose;
+    bool        interactive;
+    bool        production;     // program board after board
+    bool        verifyInterleaved;  // verify every sector right after programming it
+};
 
 
 void Interactive(HSQUIRRELVM v)
@@ -109,21 +140,326 @@ void dumpSerialPortNames()
     }
 }
 
+/** get the device name of a COM port */
+std::string getDeviceName(const QString &port)
+{
+    std::stringstream deviceName;
+#ifdef _WIN32
+    deviceName << "\\\\.\\COM" << port.toStdString().c_str();
+#else
+    deviceName << "/dev/tty." << port.toStdString().c_str();
+#endif
+    return deviceName.str();
+}
+
+/** Get the COM ports of a -c argument: a comma separated list
+    of port names. Names with wildcards (* and ?) are replaced
+    by the names of the ports that match them. */
+QStringList getPortNames(const QString &ports)
+{
+    QStringList names;
+    for (const QString &item : ports.split(',', QString::SkipEmptyParts))
+    {
+        QString port = item.trimmed();
+        if (!port.contains('*') && !port.contains('?'))
+        {
+            names << port;
+            continue;
+        }
+#ifdef _WIN32
+        QRegExp wildcard(port, Qt::CaseInsensitive, QRegExp::Wildcard);
+        for (const QSerialPortInfo &info : QSerialPortInfo::availablePorts())
+        {
+            QString name = info.portName();
+            if (name.startsWith("COM", Qt::CaseInsensitive))
+            {
+                name = name.mid(3);
+            }
+            if (wildcard.exactMatch(name))
+            {
+                names << name;
+            }
+        }
+#else
+        QStringList devices = QDir("/dev").entryList(QStringList() << ("tty." + port),
+            QDir::Files | QDir::System, QDir::Name);
+        for (const QString &device : devices)
+        {
+            names << device.mid(4);
+        }
+#endif
+    }
+    names.removeDuplicates();
+    return names;
+}
+
+/** Run init.nut in a new VM, using the programmer of the session.
+    Returns the result of init.nut, 0 if the target was programmed.
+*/
+int runSession(Session &session, const SessionOptions &options)
+{
+    session.optimizer.setEnabled(options.optimizer);
+    session.progress.setInterface(session.hw);
+
+    // the bundled scripts are compiled already, the cache
+    // is only used for scripts loaded from a directory.
+    session.scriptCache.setBundle(g_scriptBundle);
+    session.scriptCache.setDirectory(options.cacheDir);
+
+    HSQUIRRELVM v = sq_open(1024);
+    session.attach(v);
+    sq_enabledebuginfo(v, SQTrue);
+    sq_pushroottable(v);
+
+    sq_setprintfunc(v, printfunc, errorfunc);
+
+    sqstd_register_bloblib(v);
+    sqstd_register_iolib(v);
+    sqstd_register_systemlib(v);
+    sqstd_register_mathlib(v);
+    sqstd_register_stringlib(v);
+    session.scriptCache.registerFunctions(v);
+
+    // register our own functions
+    register_global_func(v, queueUInt8, _SC("queueUInt8"));
+    register_global_func(v, queueUInt32, _SC("queueUInt32"));
+    register_global_func(v, executeCmdQueue, _SC("executeCmdQueue"));
+    register_global_func(v, executeAsync, _SC("executeAsync"));
+    register_global_func(v, asyncReady, _SC("asyncReady"));
+    register_global_func(v, asyncReceiveNext, _SC("asyncReceiveNext"));
+    register_global_func(v, awaitResult, _SC("awaitResult"));
+    register_global_func(v, asyncDiscard, _SC("asyncDiscard"));
+    register_global_func(v, popUInt8, _SC("popUInt8"));
+    register_global_func(v, popUInt32, _SC("popUInt32"));
+    register_global_func(v, popUInt32Array, _SC("popUInt32Array"));
+    register_global_func(v, popBlob, _SC("popBlob"));
+    register_global_func(v, readMemoryBlock, _SC("readMemoryBlock"));
+    register_global_func(v, writeMemoryBlock, _SC("writeMemoryBlock"));
+    register_global_func(v, readCoreRegisters, _SC("readCoreRegisters"));
+    register_global_func(v, writeCoreRegisters, _SC("writeCoreRegisters"));
+    register_global_func(v, flashImage, _SC("flashImage"));
+    register_global_func(v, flashStream, _SC("flashStream"));
+    register_global_func(v, loadImage, _SC("loadImage"));
+    register_global_func(v, loadTargetPlugin, _SC("loadTargetPlugin"));
+    register_global_func(v, progressBegin, _SC("progressBegin"));
+    register_global_func(v, progressAdvance, _SC("progressAdvance"));
+    register_global_func(v, progressEnd, _SC("progressEnd"));
+    register_global_func(v, benchmarkScriptCache, _SC("benchmarkScriptCache"));
+    register_global_func(v, dumpCmdQueue, _SC("dumpCmdQueue"));
+    register_global_func(v, clearCmdQueue, _SC("clearCmdQueue"));
+    register_global_func(v, dumpResultQueue, _SC("dumpResultQueue"));
+    register_global_func(v, printLastPacketError, _SC("printLastPacketError"));
+    register_global_func(v, sleep, _SC("sleep"));
+    register_global_func(v, getMillis, _SC("getMillis"));
+    register_global_func(v, waitForInterface, _SC("waitForInterface"));
+    register_global_func(v, getInterfaceInfo, _SC("getInterfaceInfo"));
+    register_global_func(v, stopRequested, _SC("stopRequested"));
+    register_global_func(v, setCmdOptimizer, _SC("setCmdOptimizer"));
+    register_global_func(v, crc32, _SC("crc32"));
+    registerCmdBatchClass(v);
+    registerFirmwareImageClass(v);
+    registerTargetDriverClass(v);
+
+    // pass on command line parameters to squirrel environment
+    createStringVariable(v,"procType",options.procType.c_str());
+    createStringVariable(v,"binFile",options.binFile.c_str());
+    createStringVariable(v,"streamFile",options.streamFile.c_str());
+    createBooleanVariable(v, "verbose", options.verbose);
+    createBooleanVariable(v, "interactive", options.interactive);
+    createBooleanVariable(v, "daemon", !options.socketPath.empty());
+    createBooleanVariable(v, "production", options.production);
+    createIntegerVariable(v, "probeInterval", options.probeInterval);
+    createBooleanVariable(v, "verifyInterleaved", options.verifyInterleaved);
+    createStringVariable(v,"scriptDir",options.scriptDir.c_str());
+    createStringVariable(v,"pluginDir",options.pluginDir.c_str());
+
+    // load all the targets
+    sq_setcompilererrorhandler(v, compile_error_handler);
+
+    SQInteger result = -1;
+    std::string scriptpath = options.scriptDir + "init.nut";
+    if (!doScript(v, scriptpath.c_str(), &result))
+    {
+        printf("Cannot execute %s!\n", scriptpath.c_str());
+        result = -1;
+    }
+    else if (options.interactive)
+    {
+        Interactive(v);
+    }
+    else if (!options.socketPath.empty())
+    {
+        JobServer server;
+        if (server.listen(options.socketPath))
+        {
+            server.serve(v);
+        }
+        else
+        {
+            result = -1;
+        }
+    }
+
+    sq_close(v);
+    session.flush();
+    return result;
+}
+
+/** A programmer of gang mode. It opens the programmer and runs
+    its session on its own thread, a serial port can only be
+    used by the thread that opened it. */
+class GangSlot : public QThread
+{
+public:
+    GangSlot(const QString &port, const SessionOptions &options) :
+        m_port(port),
+        m_options(options),
+        m_opened(false),
+        m_result(-1),
+        m_ms(0)
+    {
+        m_session.setName(port.toStdString());
+    }
+
+    const QString& port() const
+    {
+        return m_port;
+    }
+
+    const Session& session() const
+    {
+        return m_session;
+    }
+
+    /** returns true if the target was programmed */
+    bool passed() const
+    {
+        return m_opened && (m_result == 0);
+    }
+
+    /** returns a description of the result */
+    const char* resultText() const
+    {
+        if (!m_opened)
+        {
+            return "no port";
+        }
+        return (m_result == 0) ? "ok" : "FAILED";
+    }
+
+    /** time from the start of the thread until the end of the session */
+    qint64 milliseconds() const
+    {
+        return m_ms;
+    }
+
+protected:
+    void run()
+    {
+        QElapsedTimer timer;
+        timer.start();
+
+        std::string device = getDeviceName(m_port);
+        m_session.hw = HardwareInterface::open(device.c_str(), m_options.baudrate);
+        if (m_session.hw != 0)
+        {
+            m_opened = true;
+            m_result = runSession(m_session, m_options);
+            delete m_session.hw;
+            m_session.hw = 0;
+        }
+        else
+        {
+            fprintf(stderr, "Error: could not open communication port %s!\n", device.c_str());
+        }
+        m_ms = timer.elapsed();
+    }
+
+    QString         m_port;
+    SessionOptions  m_options;
+    Session         m_session;
+    bool            m_opened;
+    int             m_result;
+    qint64          m_ms;
+};
+
+/** Program the targets on all the ports at the same time and
+    print the result of every port. Returns the exit code. */
+int runGang(const QStringList &ports, const SessionOptions &options)
+{
+    // the sessions share the cached image,
+    // load it before they start.
+    uint32_t imageBytes = 0;
+    FirmwareImage *image = FirmwareImage::get(options.binFile);
+    if (image != 0)
+    {
+        imageBytes = image->totalBytes();
+        FirmwareImage::release(image);
+    }
+
+    printf("Gang programming %d targets\n", (int)ports.size());
+
+    QElapsedTimer timer;
+    timer.start();
+
+    std::vector<GangSlot*> gang;
+    for (const QString &port : ports)
+    {
+        gang.push_back(new GangSlot(port, options));
+        gang.back()->start();
+    }
+
+    uint32_t passed = 0;
+    for(size_t i=0; i<gang.size(); i++)
+    {
+        gang[i]->wait();
+        if (gang[i]->passed())
+        {
+            passed++;
+        }
+    }
+    double seconds = timer.elapsed() / 1000.0;
+
+    printf("\nSlot  Port                  Result    Time\n");
+    for(size_t i=0; i<gang.size(); i++)
+    {
+        printf("%4d  %-20s  %-8s  %.2f s\n", (int)i+1, qPrintable(gang[i]->port()),
+            gang[i]->resultText(), gang[i]->milliseconds() / 1000.0);
+    }
+    printf("%u of %d targets programmed in %.2f s", passed, (int)gang.size(), seconds);
+    if ((seconds > 0) && (imageBytes > 0))
+    {
+        printf(", %.1f kB/s aggregate", (double)passed * imageBytes / seconds / 1024.0);
+    }
+    printf("\n");
+
+    for(size_t i=0; i<gang.size(); i++)
+    {
+        if (options.verbose)
+        {
+            printf("\n%s:\n", qPrintable(gang[i]->port()));
+            gang[i]->session().scriptCache.printStats();
+            gang[i]->session().flashStats.printStats();
+            gang[i]->session().optimizer.printStats();
+        }
+        delete gang[i];
+    }
+
+    return (passed == gang.size()) ? 0 : 1;
+}
+
 int main(int argc, char *argv[])
 {
     QCoreApplication coreApplication(argc, argv);
     QCoreApplication::setApplicationName("Swagger");
     QCoreApplication::setApplicationVersion( VERSION );
 
-    HSQUIRRELVM v;
-    SQInteger retval = 0;
-
     QCommandLineParser parser;
     parser.setApplicationDescription("");
     parser.addHelpOption();
 
     // Add -f for binary source file
-    QCommandLineOption binFile(QStringList() << "f" << "file", "file name of firmware (.bin).", "filename");
+    QCommandLineOption binFile(QStringList() << "f" << "file", "file name of firmware (.bin, .hex, .srec or .elf).", "filename");
     parser.addOption(binFile);
 
     // Add -p for processor identification
@@ -146,6 +482,22 @@ int main(int argc, char *argv[])
     QCommandLineOption disableVerify(QStringList() << "V" << "disable-verify", "Disable auto-verify.");
     parser.addOption(disableVerify);
 
+    // Add -N for disable command queue optimizer
+    QCommandLineOption disableOptimizer(QStringList() << "N" << "disable-optimizer", "Disable the command queue optimizer.");
+    parser.addOption(disableOptimizer);
+
+    // Add --script-dir to load the scripts from a directory
+    QCommandLineOption scriptDir(QStringList() << "script-dir", "Load the target scripts from a directory instead of the built-in bundle.", "directory");
+    parser.addOption(scriptDir);
+
+    // Add --script-cache for the compiled script directory
+    QCommandLineOption scriptCacheDir(QStringList() << "script-cache", "Directory of the compiled script cache.", "directory");
+    parser.addOption(scriptCacheDir);
+
+    // Add --no-script-cache to always compile the scripts
+    QCommandLineOption noScriptCache(QStringList() << "no-script-cache", "Disable the compiled script cache.");
+    parser.addOption(noScriptCache);
+
     // Add -v for verbose mode
     QCommandLineOption verboseMode(QStringList() << "v" << "verbose", "Set to verbose mode.");
     parser.addOption(verboseMode);
@@ -154,17 +506,76 @@ int main(int argc, char *argv[])
     QCommandLineOption interactiveOption(QStringList() << "I" << "interactive", "Interactive mode.");
     parser.addOption(interactiveOption);
 
+    // Add --daemon to keep the programmer open and wait for jobs
+    QCommandLineOption daemonOption(QStringList() << "daemon", "Keep the port open and run the jobs submitted on the job socket.");
+    parser.addOption(daemonOption);
+
+    // Add --submit to send a job to a daemon
+    QCommandLineOption submitOption(QStringList() << "submit", "Submit a job to the daemon of the COM port: flash <file>, verify <file>, uid, dump <address> <bytes> or quit.");
+    parser.addOption(submitOption);
+
+    // Add --socket for the job socket of the daemon
+    QCommandLineOption socketOption(QStringList() << "socket", "Job socket of the daemon, the default depends on the COM port.", "path");
+    parser.addOption(socketOption);
+
+    // Add --loop for the production loop
+    QCommandLineOption loopOption(QStringList() << "loop", "Production loop: program every board that is put in the fixture, until Ctrl-C is pressed.");
+    parser.addOption(loopOption);
+
+    // Add --probe-interval for the board detection of the production loop
+    QCommandLineOption probeInterval(QStringList() << "probe-interval", "Time between two probes for a board in the production loop.", "ms", "100");
+    parser.addOption(probeInterval);
+
+    // Add --stream for the precompiled packets of the image
+    QCommandLineOption streamOption(QStringList() << "stream", "Program from a precompiled packet stream file, which is compiled from the firmware when it is missing or out of date.", "filename");
+    parser.addOption(streamOption);
+
+    // Add --verify-interleaved to verify while programming
+    QCommandLineOption verifyInterleavedOption(QStringList() << "verify-interleaved", "Checksum every flash sector right after it is programmed and stop at the first bad sector, instead of verifying after the whole image is written.");
+    parser.addOption(verifyInterleavedOption);
+
+    parser.addPositionalArgument("job", "The job to submit.", "[job...]");
+
     parser.process(coreApplication);
 
-    if (!parser.isSet(binFile))
+    if (!parser.isSet(comPort) && !(parser.isSet(submitOption) && parser.isSet(socketOption)))
     {
-        fprintf(stderr, "Error: please specify the file to flash.\n\n");
+        fprintf(stderr, "Error: please specify the COM port to use.\n\n");
         parser.showHelp(1);
     }
 
-    if (!parser.isSet(comPort))
+    QString ports = parser.value(comPort);
+    QString socketPath = parser.value(socketOption);
+    if (socketPath.isEmpty())
     {
-        fprintf(stderr, "Error: please specify the COM port to use.\n\n");
+        // the per-user runtime directory is not readable by
+        // other users, /tmp is the fallback
+        QString runtimeDir = QStandardPaths::writableLocation(QStandardPaths::RuntimeLocation);
+        if (runtimeDir.isEmpty())
+        {
+            runtimeDir = QDir::tempPath();
+        }
+        socketPath = runtimeDir + "/swagger-" + ports + ".sock";
+    }
+
+    if (parser.isSet(submitOption))
+    {
+        std::vector<std::string> job;
+        for (const QString &word : parser.positionalArguments())
+        {
+            job.push_back(word.toStdString());
+        }
+        if (job.empty())
+        {
+            fprintf(stderr, "Error: please specify the job to submit.\n\n");
+            parser.showHelp(1);
+        }
+        return (JobServer::submit(socketPath.toStdString(), job) == 0) ? 0 : 1;
+    }
+
+    if (!parser.isSet(binFile) && !parser.isSet(daemonOption))
+    {
+        fprintf(stderr, "Error: please specify the file to flash.\n\n");
         parser.showHelp(1);
     }
 
@@ -176,33 +587,84 @@ int main(int argc, char *argv[])
     }
     */
 
-    // try to open the COM port interface
-    // and produce an error if we're not able
-    // including a list of possible ports
-
-    std::stringstream deviceName;
-#ifdef _WIN32
-    deviceName << "\\\\.\\COM" << parser.value(comPort).toStdString().c_str();
-#else
-    deviceName << "/dev/tty." << parser.value(comPort).toStdString().c_str();
-#endif
+    SessionOptions options;
+    options.binFile = parser.value(binFile).toStdString();
+    options.procType = parser.value(procType).toStdString();
+    if (parser.isSet(streamOption))
+    {
+        // jobs of the daemon run in the working directory of the client
+        options.streamFile = QFileInfo(parser.value(streamOption)).absoluteFilePath().toStdString();
+    }
+    options.optimizer = !parser.isSet(disableOptimizer);
+    options.verbose = parser.isSet(verboseMode);
+    options.interactive = parser.isSet(interactiveOption);
+    if (parser.isSet(daemonOption))
+    {
+        options.socketPath = socketPath.toStdString();
+    }
+    options.production = parser.isSet(loopOption);
+    options.verifyInterleaved = parser.isSet(verifyInterleavedOption);
+    if (options.production && (options.interactive || !options.socketPath.empty()))
+    {
+        fprintf(stderr, "Error: the production loop cannot be combined with interactive or daemon mode.\n\n");
+        return 1;
+    }
 
     bool ok = false;
-    uint32_t baud = parser.value(baudrate).toInt(&ok);
+    options.baudrate = parser.value(baudrate).toInt(&ok);
     if (!ok)
     {
         printf("Baudrate %s is not an integer!", qPrintable(parser.value(baudrate)));
         return 1;
     }
 
-    g_interface = HardwareInterface::open(deviceName.str().c_str(), baud);
-    if (g_interface == 0)
+    options.probeInterval = parser.value(probeInterval).toUInt(&ok);
+    if (!ok)
     {
-        fprintf(stderr, "Error: could not open communication port %s!\n\n", deviceName.str().c_str());
-        dumpSerialPortNames();
+        printf("Probe interval %s is not an integer!", qPrintable(parser.value(probeInterval)));
         return 1;
     }
 
+    if (options.production)
+    {
+        // Ctrl-C ends the loop, the scripts print the statistics
+        enableStopRequests();
+    }
+
+    if ((parser.isSet(scriptDir) || parser.isSet(scriptCacheDir)) && !parser.isSet(noScriptCache))
+    {
+        QString cacheDir = parser.value(scriptCacheDir);
+        if (cacheDir.isEmpty())
+        {
+            cacheDir = QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/scripts";
+        }
+        if (QDir().mkpath(cacheDir))
+        {
+            options.cacheDir = QDir(cacheDir).absolutePath().toStdString();
+        }
+        else
+        {
+            printf("Warning: cannot create script cache directory %s\n", qPrintable(cacheDir));
+        }
+    }
+
+    QString scriptpath = SCRIPT_BUNDLE_DIR;
+    if (parser.isSet(scriptDir))
+    {
+        // absolute, the jobs of the daemon run in the
+        // working directory of the client
+        scriptpath = QDir(parser.value(scriptDir)).absolutePath();
+        if (!scriptpath.endsWith("/") && !scriptpath.endsWith("\\"))
+        {
+            scriptpath.append("/");
+        }
+    }
+    options.scriptDir = scriptpath.toStdString();
+
+    QString pluginpath = QCoreApplication::applicationDirPath();
+    pluginpath.append("/plugins/");
+    options.pluginDir = pluginpath.toStdString();
+
 #if 0
     printf("Swagger version " VERSION " "__DATE__"\n");
     printf("Using %s (%d bits)\n",SQUIRREL_VERSION,((int)(sizeof(SQInteger)*8)));
@@ -217,57 +679,56 @@ int main(int argc, char *argv[])
     printf("\n");
 #endif
 
-    v=sq_open(1024);
-    sq_enabledebuginfo(v, SQTrue);
-    sq_pushroottable(v);
-
-    sq_setprintfunc(v, printfunc, errorfunc);
-
-    sqstd_register_bloblib(v);
-    sqstd_register_iolib(v);
-    sqstd_register_systemlib(v);
-    sqstd_register_mathlib(v);
-    sqstd_register_stringlib(v);
-
-    // register our own functions
-    register_global_func(v, queueUInt8, _SC("queueUInt8"));
-    register_global_func(v, queueUInt32, _SC("queueUInt32"));
-    register_global_func(v, executeCmdQueue, _SC("executeCmdQueue"));
-    register_global_func(v, popUInt8, _SC("popUInt8"));
-    register_global_func(v, popUInt32, _SC("popUInt32"));
-    register_global_func(v, dumpCmdQueue, _SC("dumpCmdQueue"));
-    register_global_func(v, clearCmdQueue, _SC("clearCmdQueue"));
-    register_global_func(v, dumpResultQueue, _SC("dumpResultQueue"));
-    register_global_func(v, printLastPacketError, _SC("printLastPacketError"));
-    register_global_func(v, sleep, _SC("sleep"));
-
-    // pass on command line parameters to squirrel environment
-    createStringVariable(v,"procType",qPrintable(parser.value(procType)));
-    createStringVariable(v,"binFile",qPrintable(parser.value(binFile)));
-    createBooleanVariable(v, "verbose", parser.isSet(verboseMode));
-    createBooleanVariable(v, "interactive", parser.isSet(interactiveOption));
-
-    QString scriptpath = QCoreApplication::applicationDirPath();
-    scriptpath.append("\\..\\targets\\");
-    createStringVariable(v,"scriptDir",qPrintable(scriptpath));
+    // a list or a wildcard selects gang mode: one
+    // session per port, all running at the same time.
+    if (ports.contains(',') || ports.contains('*') || ports.contains('?'))
+    {
+        if (options.interactive || !options.socketPath.empty())
+        {
+            fprintf(stderr, "Error: interactive and daemon mode need a single COM port.\n\n");
+            return 1;
+        }
+        QStringList portNames = getPortNames(ports);
+        if (portNames.isEmpty())
+        {
+            fprintf(stderr, "Error: no COM port matches %s!\n\n", qPrintable(ports));
+            dumpSerialPortNames();
+            return 1;
+        }
+        int exitCode = runGang(portNames, options);
+        FirmwareImage::releaseAll();
+        TargetPlugin::unloadAll();
+        return exitCode;
+    }
 
-    // load all the targets
-    sq_setcompilererrorhandler(v, compile_error_handler);
+    // try to open the COM port interface
+    // and produce an error if we're not able
+    // including a list of possible ports
 
-    scriptpath.append("init.nut");
-    if (!doScript(v, scriptpath.toStdString().c_str()))
+    Session session;
+    std::string deviceName = getDeviceName(ports);
+    session.hw = HardwareInterface::open(deviceName.c_str(), options.baudrate);
+    if (session.hw == 0)
     {
-        printf("Cannot execute %s!\n", qPrintable(scriptpath));
+        fprintf(stderr, "Error: could not open communication port %s!\n\n", deviceName.c_str());
+        dumpSerialPortNames();
         return 1;
     }
 
-    if (parser.isSet(interactiveOption))
-            Interactive(v);
+    int result = runSession(session, options);
 
-    sq_close(v);
+    FirmwareImage::releaseAll();
+    TargetPlugin::unloadAll();
+
+    if (options.verbose)
+    {
+        session.scriptCache.printStats();
+        session.flashStats.printStats();
+    }
+    session.optimizer.printStats();
 
-    if (g_interface != 0)
-        g_interface->close();
+    session.hw->close();
+    delete session.hw;
 
-    return 0;
+    return (result == 0) ? 0 : 1;
 }
@@ -0,0 +1,399 @@
+/*
+
+  Swagger - A tool for programming ARM processors using the SWD protocol
+
+  Niels A. Moseley (c) Moseley Instruments 2016
+
+  Precompiled packet stream
+
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <QCoreApplication>
+#include <QThread>
+#include "packetstream.h"
+#include "cobs.h"
+#include "crc32.h"
+
+#define STREAM_MAGIC    "SWPS"
+#define STREAM_VERSION  3
+
+static void pushUInt16(std::string &out, uint32_t word)
+{
+    out.push_back(word & 0xFF); // LSB first
+    out.push_back((word>>8) & 0xFF);
+}
+
+static void pushUInt32(std::string &out, uint32_t word)
+{
+    pushUInt16(out, word);
+    pushUInt16(out, word >> 16);
+}
+
+static uint32_t getUInt32(const uint8_t *ptr)
+{
+    uint32_t w = ptr[0];
+    w |= ((uint32_t)ptr[1]) << 8;
+    w |= ((uint32_t)ptr[2]) << 16;
+    w |= ((uint32_t)ptr[3]) << 24;
+    return w;
+}
+
+/** read the next word of a stream file, returns false at the end */
+static bool readUInt32(const uint8_t *&p, const uint8_t *end, uint32_t &word)
+{
+    if (end - p < 4)
+    {
+        return false;
+    }
+    word = getUInt32(p);
+    p += 4;
+    return true;
+}
+
+/** the packets of a replay, every result is checked
+    when it is received */
+class ReplaySource : public PacketSource
+{
+public:
+    ReplaySource(const std::vector<EncodedPacket> &packets, const std::vector<size_t> &packetEnd,
+                 const std::vector< std::vector<uint32_t> > &units,
+                 const std::vector< std::vector<FlashEngine::SectorCheck> > &checks,
+                 uint32_t errorMask, ProgressReporter *progress, std::string &error) :
+        m_packets(packets), m_packetEnd(packetEnd), m_units(units), m_checks(checks),
+        m_errorMask(errorMask), m_progress(progress), m_error(error),
+        m_next(0), m_received(0), m_reported(0), m_failed(false)
+    {
+    }
+
+    bool nextPacket(EncodedPacket &packet)
+    {
+        if (m_failed || (m_next >= m_packets.size()))
+        {
+            return false;
+        }
+        packet = m_packets[m_next++];
+        return true;
+    }
+
+    void resultPacket(std::vector<uint8_t> &result)
+    {
+        size_t p = m_received++;
+        if (m_failed)
+        {
+            return;     // a packet that was in flight after the failure
+        }
+
+        // check the status of every unit that was programmed
+        // and the checksums of the sectors
+        if (!FlashEngine::checkResult(result, m_errorMask, m_units[p], m_checks[p], m_error))
+        {
+            m_failed = true;
+            return;
+        }
+        if ((m_progress != 0) && (m_packetEnd[p] > m_reported))
+        {
+            m_progress->advance(m_packetEnd[p] - m_reported);
+            m_reported = m_packetEnd[p];
+        }
+    }
+
+    bool failed() const
+    {
+        return m_failed;
+    }
+
+    size_t reported() const
+    {
+        return m_reported;
+    }
+
+protected:
+    const std::vector<EncodedPacket>    &m_packets;
+    const std::vector<size_t>           &m_packetEnd;
+    const std::vector< std::vector<uint32_t> > &m_units;
+    const std::vector< std::vector<FlashEngine::SectorCheck> > &m_checks;
+    uint32_t            m_errorMask;
+    ProgressReporter    *m_progress;
+    std::string         &m_error;
+    size_t              m_next;
+    size_t              m_received;
+    size_t              m_reported;
+    bool                m_failed;
+};
+
+PacketStream::PacketStream() : m_map(0), m_fileSize(0)
+{
+}
+
+PacketStream::~PacketStream()
+{
+    close();
+}
+
+std::string PacketStream::algorithmTag(const FlashAlgorithm &algo)
+{
+    std::string header;
+    pushUInt32(header, algo.statusReg);
+    pushUInt32(header, algo.clearValue);
+    pushUInt32(header, algo.launchValue);
+    pushUInt32(header, algo.readyMask);
+    pushUInt32(header, algo.errorMask);
+    pushUInt32(header, algo.paramReg);
+    pushUInt32(header, algo.command);
+    pushUInt32(header, algo.addressMask);
+    pushUInt32(header, algo.programSize);
+    pushUInt32(header, algo.baseAddress);
+    pushUInt32(header, algo.skipErased ? 1 : 0);
+    pushUInt32(header, algo.verifySize);
+    return header;
+}
+
+uint32_t PacketStream::makeKey(const std::vector<Part> &parts)
+{
+    uint32_t crc = 0;
+    for(size_t i=0; i<parts.size(); i++)
+    {
+        std::string header = algorithmTag(parts[i].algo);
+        pushUInt32(header, parts[i].bytes);
+        crc = CRC32::calc((const uint8_t*)header.data(), header.size(), crc);
+        crc = CRC32::calc(parts[i].data, parts[i].bytes, crc);
+    }
+    return crc;
+}
+
+bool PacketStream::compile(const std::string &filename, const InterfaceInfo &info, uint32_t key,
+    const std::vector<Part> &parts, std::string &error)
+{
+    std::string packets;
+    uint32_t packetCount = 0;
+    uint32_t errorMask = 0;
+    size_t imageBytes = 0;
+    for(size_t i=0; i<parts.size(); i++)
+    {
+        const Part &part = parts[i];
+        FlashEngine::Plan plan;
+        if (!FlashEngine::build(info, part.algo, part.data, part.bytes, plan, error))
+        {
+            return false;
+        }
+        if ((i > 0) && (part.algo.errorMask != errorMask))
+        {
+            error = "the parts of a packet stream must use the same error mask";
+            return false;
+        }
+        errorMask = part.algo.errorMask;
+
+        for(size_t p=0; p<plan.packets.size(); p++)
+        {
+            std::vector<uint8_t> encoded;
+            if (!COBS::encode(plan.packets[p], encoded))
+            {
+                error = "cannot COBS encode a packet of the packet stream";
+                return false;
+            }
+
+            // the gaps between combined segments are not
+            // part of the image
+            size_t end = (plan.packetEnd[p] < part.imageBytes) ? plan.packetEnd[p] : part.imageBytes;
+            pushUInt32(packets, imageBytes + end);
+            pushUInt32(packets, plan.units[p].size());
+            for(size_t u=0; u<plan.units[p].size(); u++)
+            {
+                pushUInt32(packets, plan.units[p][u]);
+            }
+            pushUInt32(packets, plan.checks[p].size());
+            for(size_t c=0; c<plan.checks[p].size(); c++)
+            {
+                const FlashEngine::SectorCheck &check = plan.checks[p][c];
+                pushUInt32(packets, check.address);
+                pushUInt32(packets, check.bytes);
+                pushUInt32(packets, check.crc);
+                pushUInt32(packets, check.wordIndex);
+            }
+            pushUInt32(packets, encoded.size());
+            packets.append((const char*)&encoded[0], encoded.size());
+            packetCount++;
+        }
+        imageBytes += part.imageBytes;
+    }
+
+    std::string data = STREAM_MAGIC;
+    pushUInt32(data, STREAM_VERSION);
+    pushUInt32(data, key);
+    data.push_back(info.version);
+    data.push_back(info.rxBufCount);
+    pushUInt16(data, info.rxBufSize);
+    pushUInt16(data, info.txBufSize);
+    pushUInt16(data, 0);
+    pushUInt32(data, errorMask);
+    pushUInt32(data, imageBytes);
+    pushUInt32(data, packetCount);
+    data += packets;
+    pushUInt32(data, CRC32::calc((const uint8_t*)data.data(), data.size()));
+
+    // write to a temporary file first, the sessions of gang
+    // mode and other processes may compile the same stream at
+    // the same time.
+    char suffix[64];
+    snprintf(suffix, sizeof(suffix), ".%lld.%p.tmp", (long long)QCoreApplication::applicationPid(),
+        (void*)QThread::currentThreadId());
+    std::string tmpName = filename + suffix;
+    FILE *f = fopen(tmpName.c_str(), "wb");
+    if (f == 0)
+    {
+        error = "cannot write " + tmpName;
+        return false;
+    }
+    bool ok = (fwrite(data.data(), 1, data.size(), f) == data.size());
+    ok = (fclose(f) == 0) && ok;
+#ifdef _WIN32
+    remove(filename.c_str());   // rename does not replace a file
+#endif
+    if (!ok || (rename(tmpName.c_str(), filename.c_str()) != 0))
+    {
+        error = "cannot write " + filename;
+        remove(tmpName.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool PacketStream::load(const std::string &filename, std::string &error)
+{
+    close();
+    error.clear();
+
+    m_file.setFileName(QString::fromStdString(filename));
+    if (!m_file.open(QIODevice::ReadOnly))
+    {
+        return false;
+    }
+    m_fileSize = m_file.size();
+    if (m_fileSize < 36)
+    {
+        close();
+        return false;
+    }
+    m_map = m_file.map(0, m_fileSize);
+    if (m_map == 0)
+    {
+        close();
+        return false;
+    }
+
+    const uint8_t *p = m_map;
+    const uint8_t *end = m_map + m_fileSize - 4;
+    uint32_t version, sizes, count;
+    bool ok = (memcmp(p, STREAM_MAGIC, 4) == 0) &&
+              (getUInt32(end) == CRC32::calc(m_map, m_fileSize - 4));
+    p += 4;
+    ok = ok && readUInt32(p, end, version) && (version == STREAM_VERSION) &&
+         readUInt32(p, end, m_key);
+    if (ok)
+    {
+        m_info.version = p[0];
+        m_info.rxBufCount = p[1];
+        m_info.rxBufSize = p[2] | (p[3] << 8);
+        p += 4;
+    }
+    ok = ok && readUInt32(p, end, sizes) && readUInt32(p, end, m_errorMask) &&
+         readUInt32(p, end, m_imageBytes) && readUInt32(p, end, count);
+    m_info.txBufSize = sizes & 0xFFFF;
+
+    for(uint32_t i=0; ok && (i<count); i++)
+    {
+        uint32_t done, units, bytes;
+        ok = readUInt32(p, end, done) && readUInt32(p, end, units) && (units <= (uint32_t)(end - p) / 4);
+        if (!ok)
+        {
+            break;
+        }
+        m_packetEnd.push_back(done);
+        m_units.push_back(std::vector<uint32_t>(units));
+        for(uint32_t u=0; u<units; u++)
+        {
+            readUInt32(p, end, m_units.back()[u]);
+        }
+
+        uint32_t checks;
+        ok = readUInt32(p, end, checks) && (checks <= (uint32_t)(end - p) / 16);
+        if (!ok)
+        {
+            break;
+        }
+        m_checks.push_back(std::vector<FlashEngine::SectorCheck>(checks));
+        for(uint32_t c=0; c<checks; c++)
+        {
+            FlashEngine::SectorCheck &check = m_checks.back()[c];
+            readUInt32(p, end, check.address);
+            readUInt32(p, end, check.bytes);
+            readUInt32(p, end, check.crc);
+            readUInt32(p, end, check.wordIndex);
+        }
+
+        ok = readUInt32(p, end, bytes) && (bytes > 0) && (bytes <= (uint32_t)(end - p)) && (p[bytes-1] == 0);
+        if (ok)
+        {
+            EncodedPacket packet;
+            packet.data = p;
+            packet.bytes = bytes;
+            m_packets.push_back(packet);
+            p += bytes;
+        }
+    }
+
+    if (!ok || (p != end))
+    {
+        error = filename + " is not a valid packet stream";
+        close();
+        return false;
+    }
+    m_fileName = filename;
+    return true;
+}
+
+void PacketStream::close()
+{
+    if (m_map != 0)
+    {
+        m_file.unmap((uchar*)m_map);
+        m_map = 0;
+    }
+    m_file.close();
+    m_fileName.clear();
+    m_packets.clear();
+    m_packetEnd.clear();
+    m_units.clear();
+    m_checks.clear();
+}
+
+bool PacketStream::matches(const InterfaceInfo &info, uint32_t key) const
+{
+    return (m_map != 0) && (m_key == key) && (m_info.version == info.version) &&
+           (m_info.rxBufCount == info.rxBufCount) && (m_info.rxBufSize == info.rxBufSize) &&
+           (m_info.txBufSize == info.txBufSize);
+}
+
+bool PacketStream::replay(HardwareInterface *hw, ProgressReporter *progress, std::string &error) const
+{
+    // stop sending at the first result that fails
+    ReplaySource source(m_packets, m_packetEnd, m_units, m_checks, m_errorMask, progress, error);
+    bool ok = hw->executeStream(source);
+    if (source.failed())
+    {
+        return false;
+    }
+
+    if (!ok)
+    {
+        error = hw->getLastError();
+        return false;
+    }
+    if ((progress != 0) && (source.reported() < m_imageBytes))
+    {
+        progress->advance(m_imageBytes - source.reported());
+    }
+    return true;
+}
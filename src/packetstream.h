@@ -0,0 +1,125 @@
+/*
+
+  Swagger - A tool for programming ARM processors using the SWD protocol
+
+  Niels A. Moseley (c) Moseley Instruments 2016
+
+  Precompiled packet stream
+
+  When the same image is programmed onto many boards, building
+  the program packets and COBS encoding them is the same work
+  for every board. A packet stream file holds the encoded
+  packets of the flash engine for one image, flash algorithm
+  and programming interface, together with what is needed to
+  check the replies: the error mask of the status register and
+  the flash address of every programming unit and the
+  checksums of the sectors that are verified while programming.
+
+  The file is memory mapped and the packets are sent straight
+  from the mapping, pipelined like executePackets does. The key
+  in the header is a CRC32 of the image and the algorithm, so
+  a stream is only replayed for the image it was compiled from.
+
+  File layout, all numbers little-endian:
+    "SWPS"          magic
+    u32             file format version
+    u32             key
+    u8, u8, u16     interface version, rxBufCount, rxBufSize
+    u16, u16        interface txBufSize, 0
+    u32             error mask of the status register
+    u32             image bytes
+    u32             number of packets
+    packets         u32 image bytes done after the packet
+                    u32 number of units, flash address per unit
+                    u32 number of sector checks, per check
+                        u32 address, bytes, CRC32, status words before it
+                    u32 encoded bytes, COBS encoded packet
+    u32             CRC32 of all the bytes before it
+
+*/
+
+#ifndef packetstream_h
+#define packetstream_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <QFile>
+
+#include "hardwareinterface.h"
+#include "flashengine.h"
+#include "progress.h"
+
+class PacketStream
+{
+public:
+    /** a block of image data that is programmed with one algorithm */
+    struct Part
+    {
+        FlashAlgorithm  algo;
+        const uint8_t   *data;
+        size_t          bytes;
+        size_t          imageBytes;     // image bytes reported as progress
+    };
+
+    PacketStream();
+    ~PacketStream();
+
+    /** the key of the stream that programs the parts */
+    static uint32_t makeKey(const std::vector<Part> &parts);
+
+    /** the settings of an algorithm that go into the key */
+    static std::string algorithmTag(const FlashAlgorithm &algo);
+
+    /** Compile the packets that program the parts with an
+        interface and write them to a stream file. On failure,
+        error holds the reason. */
+    static bool compile(const std::string &filename, const InterfaceInfo &info, uint32_t key,
+        const std::vector<Part> &parts, std::string &error);
+
+    /** Map a stream file. Returns false if it does not exist,
+        or if it is not a valid stream file; then error says so. */
+    bool load(const std::string &filename, std::string &error);
+
+    /** unmap the stream file */
+    void close();
+
+    /** name of the mapped file, empty if none */
+    const std::string& fileName() const
+    {
+        return m_fileName;
+    }
+
+    /** returns true if the stream was compiled from the
+        image with the key for the interface */
+    bool matches(const InterfaceInfo &info, uint32_t key) const;
+
+    /** number of packets in the stream */
+    size_t packetCount() const
+    {
+        return m_packets.size();
+    }
+
+    /** Send the packets and check the replies. On failure,
+        error holds the reason, such as the failing flash
+        address. */
+    bool replay(HardwareInterface *hw, ProgressReporter *progress, std::string &error) const;
+
+protected:
+    QFile                       m_file;
+    const uint8_t               *m_map;
+    qint64                      m_fileSize;
+    std::string                 m_fileName;
+
+    uint32_t                    m_key;
+    InterfaceInfo               m_info;
+    uint32_t                    m_errorMask;
+    uint32_t                    m_imageBytes;
+    std::vector<EncodedPacket>  m_packets;      // point into the mapping
+    std::vector<size_t>         m_packetEnd;    // image bytes done after each packet
+    std::vector< std::vector<uint32_t> > m_units;   // flash address of the units of each packet
+    std::vector< std::vector<FlashEngine::SectorCheck> > m_checks;  // sector checksums of each packet
+};
+
+#endif
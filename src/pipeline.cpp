@@ -0,0 +1,49 @@
+/*
+
+  Swagger - A tool for programming ARM processors using the SWD protocol
+
+  Niels A. Moseley (c) Moseley Instruments 2016
+
+  Host pipeline
+
+*/
+
+#include <stdio.h>
+#include "pipeline.h"
+
+void PipelineStats::add(const std::vector<StageStats> &stages)
+{
+    if (m_stages.size() != stages.size())
+    {
+        m_stages.clear();
+        for(size_t i=0; i<stages.size(); i++)
+        {
+            m_stages.push_back(StageStats(stages[i].name));
+        }
+    }
+    for(size_t i=0; i<stages.size(); i++)
+    {
+        m_stages[i].items += stages[i].items;
+        m_stages[i].busyMicros += stages[i].busyMicros;
+        m_stages[i].waitMicros += stages[i].waitMicros;
+    }
+    m_runs++;
+}
+
+void PipelineStats::printStats() const
+{
+    if (m_runs == 0)
+    {
+        return;
+    }
+
+    printf("%s pipeline, %d runs:\n", m_name, m_runs);
+    for(size_t i=0; i<m_stages.size(); i++)
+    {
+        const StageStats &stage = m_stages[i];
+        uint64_t total = stage.busyMicros + stage.waitMicros;
+        printf("  %-12s %7d items, busy %8.1f ms, waiting %8.1f ms, %5.1f%% utilization\n",
+            stage.name, stage.items, stage.busyMicros / 1000.0, stage.waitMicros / 1000.0,
+            (total > 0) ? 100.0 * stage.busyMicros / total : 0.0);
+    }
+}
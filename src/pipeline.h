@@ -0,0 +1,225 @@
+/*
+
+  Swagger - A tool for programming ARM processors using the SWD protocol
+
+  Niels A. Moseley (c) Moseley Instruments 2016
+
+  Host pipeline
+
+  The stages of a pipeline run on their own threads and pass
+  their work items on through bounded single producer, single
+  consumer queues. A queue has no locks: the producer only
+  writes the tail and the consumer only writes the head.
+
+  A stage that waits for an item, or for room in a full queue,
+  spins for a while and then sleeps for longer and longer, up
+  to a millisecond, so a stage that waits for the serial port
+  does not use a whole core.
+
+  Every stage counts the items it handled and the time it
+  spent waiting, so the utilization of every stage can be
+  printed: a stage that is busy all the time limits the
+  throughput of the pipeline.
+
+*/
+
+#ifndef pipeline_h
+#define pipeline_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#define PIPELINE_SPINS          16      // tries before a waiting stage sleeps
+#define PIPELINE_MIN_SLEEP_US   50
+#define PIPELINE_MAX_SLEEP_US   1000
+
+/** utilization counters of a pipeline stage */
+struct StageStats
+{
+    const char  *name;
+    uint32_t    items;          // items handled
+    uint64_t    busyMicros;     // time spent working
+    uint64_t    waitMicros;     // time spent waiting for input or output room
+
+    StageStats(const char *stageName = "") : name(stageName), items(0), busyMicros(0), waitMicros(0)
+    {
+    }
+};
+
+/** the counters of the stages of all the runs of a pipeline */
+class PipelineStats
+{
+public:
+    explicit PipelineStats(const char *name) : m_name(name), m_runs(0)
+    {
+    }
+
+    /** add the counters of a run, the stages in pipeline order */
+    void add(const std::vector<StageStats> &stages);
+
+    /** print the utilization of every stage */
+    void printStats() const;
+
+protected:
+    const char              *m_name;
+    uint32_t                m_runs;
+    std::vector<StageStats> m_stages;
+};
+
+/** measures the time a stage runs and waits */
+class StageTimer
+{
+public:
+    explicit StageTimer(StageStats &stats) : m_stats(stats), m_start(now())
+    {
+    }
+
+    /** the stage is done: the time it did not wait it was busy */
+    ~StageTimer()
+    {
+        uint64_t total = now() - m_start;
+        m_stats.busyMicros = (total > m_stats.waitMicros) ? total - m_stats.waitMicros : 0;
+    }
+
+    static uint64_t now()
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+protected:
+    StageStats  &m_stats;
+    uint64_t    m_start;
+};
+
+template<class T> class SpscQueue
+{
+public:
+    explicit SpscQueue(size_t capacity) :
+        m_items(capacity+1),
+        m_head(0),
+        m_tail(0),
+        m_closed(false),
+        m_aborted(false)
+    {
+    }
+
+    /** Add an item, waiting while the queue is full. The wait
+        time is added to stats. Returns false once the queue
+        is aborted. */
+    bool push(const T &item, StageStats &stats)
+    {
+        if (m_aborted.load(std::memory_order_relaxed))
+        {
+            return false;
+        }
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        size_t next = (tail + 1) % m_items.size();
+        if (next == m_head.load(std::memory_order_acquire))
+        {
+            uint64_t start = StageTimer::now();
+            for(uint32_t spins=0; next == m_head.load(std::memory_order_acquire); spins++)
+            {
+                if (m_aborted.load(std::memory_order_relaxed))
+                {
+                    return false;
+                }
+                pause(spins);
+            }
+            stats.waitMicros += StageTimer::now() - start;
+        }
+        m_items[tail] = item;
+        m_tail.store(next, std::memory_order_release);
+        return true;
+    }
+
+    /** Take the oldest item, waiting while the queue is empty.
+        The wait time is added to stats. Returns false when the
+        queue is closed and empty, or once the queue is
+        aborted. */
+    bool pop(T &item, StageStats &stats)
+    {
+        if (m_aborted.load(std::memory_order_relaxed))
+        {
+            return false;
+        }
+        size_t head = m_head.load(std::memory_order_relaxed);
+        if (head == m_tail.load(std::memory_order_acquire))
+        {
+            uint64_t start = StageTimer::now();
+            for(uint32_t spins=0; head == m_tail.load(std::memory_order_acquire); spins++)
+            {
+                if (m_aborted.load(std::memory_order_relaxed))
+                {
+                    return false;
+                }
+                if (m_closed.load(std::memory_order_acquire) &&
+                    (head == m_tail.load(std::memory_order_acquire)))
+                {
+                    stats.waitMicros += StageTimer::now() - start;
+                    return false;
+                }
+                pause(spins);
+            }
+            stats.waitMicros += StageTimer::now() - start;
+        }
+        item = m_items[head];
+        m_head.store((head + 1) % m_items.size(), std::memory_order_release);
+        return true;
+    }
+
+    /** Take an item that is left in the queue, without waiting.
+        Only for cleaning up after the stages have stopped. */
+    bool take(T &item)
+    {
+        size_t head = m_head.load(std::memory_order_relaxed);
+        if (head == m_tail.load(std::memory_order_acquire))
+        {
+            return false;
+        }
+        item = m_items[head];
+        m_head.store((head + 1) % m_items.size(), std::memory_order_release);
+        return true;
+    }
+
+    /** the producer has no more items */
+    void close()
+    {
+        m_closed.store(true, std::memory_order_release);
+    }
+
+    /** stop the stages on both sides of the queue */
+    void abort()
+    {
+        m_aborted.store(true, std::memory_order_relaxed);
+    }
+
+protected:
+    /** wait a little, longer the longer the stage waits */
+    static void pause(uint32_t spins)
+    {
+        if (spins < PIPELINE_SPINS)
+        {
+            std::this_thread::yield();
+            return;
+        }
+        uint32_t us = PIPELINE_MIN_SLEEP_US;
+        for(uint32_t i=PIPELINE_SPINS; (i<spins) && (us < PIPELINE_MAX_SLEEP_US); i++)
+        {
+            us *= 2;
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds((us < PIPELINE_MAX_SLEEP_US) ? us : PIPELINE_MAX_SLEEP_US));
+    }
+
+    std::vector<T>      m_items;
+    std::atomic<size_t> m_head;     // next item to pop, written by the consumer
+    std::atomic<size_t> m_tail;     // next free slot, written by the producer
+    std::atomic<bool>   m_closed;
+    std::atomic<bool>   m_aborted;
+};
+
+#endif
@@ -0,0 +1,133 @@
+/*
+
+  Swagger - A tool for programming ARM processors using the SWD protocol
+
+  Niels A. Moseley (c) Moseley Instruments 2016
+
+  Progress reporter
+
+*/
+
+#ifdef _WIN32
+#include <windows.h>    // for GetTickCount
+#else
+#include <time.h>       // for clock_gettime
+#endif
+#include <stdio.h>
+#include "progress.h"
+#include "hardwareinterface.h"
+
+ProgressReporter::ProgressReporter() :
+    m_interface(0),
+    m_active(false),
+    m_totalBytes(0),
+    m_doneBytes(0),
+    m_refreshMs(100),
+    m_startPackets(0),
+    m_startTime(0),
+    m_lastRender(0)
+{
+}
+
+uint64_t ProgressReporter::getMillis()
+{
+#ifdef _WIN32
+    return GetTickCount();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+#endif
+}
+
+uint32_t ProgressReporter::roundTrips() const
+{
+    if (m_interface == 0)
+    {
+        return 0;
+    }
+    return m_interface->packetsReceived() - m_startPackets;
+}
+
+void ProgressReporter::begin(const char *label, uint32_t totalBytes)
+{
+    if (m_active)
+    {
+        end();
+    }
+    m_active = true;
+    m_label = label;
+    m_totalBytes = totalBytes;
+    m_doneBytes = 0;
+    m_startPackets = (m_interface != 0) ? m_interface->packetsReceived() : 0;
+    m_startTime = getMillis();
+    m_lastRender = m_startTime;
+    render(m_startTime);
+}
+
+void ProgressReporter::advance(uint32_t bytes)
+{
+    if (!m_active)
+    {
+        return;
+    }
+
+    m_doneBytes += bytes;
+    if (m_doneBytes > m_totalBytes)
+    {
+        m_doneBytes = m_totalBytes;
+    }
+
+    uint64_t now = getMillis();
+    if (now - m_lastRender >= m_refreshMs)
+    {
+        m_lastRender = now;
+        render(now);
+    }
+}
+
+void ProgressReporter::render(uint64_t now)
+{
+    if (!m_prefix.empty())
+    {
+        return;
+    }
+
+    double seconds = (now - m_startTime) / 1000.0;
+    uint32_t percent = (m_totalBytes != 0) ? (uint32_t)((100ULL * m_doneBytes) / m_totalBytes) : 100;
+
+    printf("\r%s: %3u%% %u/%u bytes", m_label.c_str(), percent, m_doneBytes, m_totalBytes);
+    if ((seconds > 0) && (m_doneBytes > 0))
+    {
+        double rate = m_doneBytes / seconds;
+        double eta = (m_totalBytes - m_doneBytes) / rate;
+        printf("  %.1f kB/s  %.0f rt/s  ETA %.1f s  ", rate / 1024.0, roundTrips() / seconds, eta);
+    }
+    fflush(stdout);
+}
+
+void ProgressReporter::end()
+{
+    if (!m_active)
+    {
+        return;
+    }
+    m_active = false;
+
+    uint64_t now = getMillis();
+    render(now);
+
+    // print the summary with one call, so it stays on one
+    // line when other threads are printing too
+    double seconds = (now - m_startTime) / 1000.0;
+    uint32_t trips = roundTrips();
+    char rate[128] = "";
+    if (seconds > 0)
+    {
+        snprintf(rate, sizeof(rate), ", %.1f kB/s, %u round trips (%.0f/s)",
+            m_doneBytes / seconds / 1024.0, trips, trips / seconds);
+    }
+    printf("%s%s%s: %u bytes in %.2f s%s\n", m_prefix.empty() ? "\n" : "", m_prefix.c_str(),
+        m_label.c_str(), m_doneBytes, seconds, rate);
+    fflush(stdout);
+}
@@ -0,0 +1,92 @@
+/*
+
+  Swagger - A tool for programming ARM processors using the SWD protocol
+
+  Niels A. Moseley (c) Moseley Instruments 2016
+
+  Progress reporter
+
+  Shows the progress of a long operation, such as programming
+  or verifying the flash, on a single console line. The line
+  is redrawn at most once per refresh interval, no matter how
+  often the progress is updated, and shows the throughput in
+  bytes and round trips per second and the estimated time
+  remaining. A summary is printed when the operation ends.
+
+  With a prefix, only the summary is printed, on one line that
+  starts with the prefix. This is used when several targets are
+  programmed at the same time.
+
+*/
+
+#ifndef progress_h
+#define progress_h
+
+#include <stdint.h>
+#include <string>
+
+class HardwareInterface;
+
+class ProgressReporter
+{
+public:
+    ProgressReporter();
+
+    /** start reporting an operation on totalBytes bytes */
+    void begin(const char *label, uint32_t totalBytes);
+
+    /** add bytes to the number of bytes done.
+        Ignored when no operation was started. */
+    void advance(uint32_t bytes);
+
+    /** end the operation and print the summary */
+    void end();
+
+    /** returns true while an operation is being reported */
+    bool isActive() const
+    {
+        return m_active;
+    }
+
+    /** set the minimum time between two redraws */
+    void setRefreshInterval(uint32_t ms)
+    {
+        m_refreshMs = ms;
+    }
+
+    /** set the interface whose round trips are counted */
+    void setInterface(HardwareInterface *hw)
+    {
+        m_interface = hw;
+    }
+
+    /** set the prefix of the summary line and stop drawing
+        the progress line, an empty prefix draws it again */
+    void setPrefix(const std::string &prefix)
+    {
+        m_prefix = prefix;
+    }
+
+protected:
+    /** draw the progress line */
+    void render(uint64_t now);
+
+    /** time in milliseconds */
+    static uint64_t getMillis();
+
+    /** number of round trips since begin() */
+    uint32_t roundTrips() const;
+
+    HardwareInterface *m_interface;
+    bool        m_active;
+    std::string m_label;
+    std::string m_prefix;
+    uint32_t    m_totalBytes;
+    uint32_t    m_doneBytes;
+    uint32_t    m_refreshMs;
+    uint32_t    m_startPackets;     // packet count of the interface at begin()
+    uint64_t    m_startTime;
+    uint64_t    m_lastRender;
+};
+
+#endif
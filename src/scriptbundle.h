@@ -0,0 +1,38 @@
+/*
+
+  Swagger - A tool for programming ARM processors using the SWD protocol
+
+  Niels A. Moseley (c) Moseley Instruments 2016
+
+  Embedded target script bundle
+
+  The build compiles the target scripts to bytecode with the
+  nutbundle tool and links them into the executable. The
+  bundled scripts are loaded from the virtual directory
+  SCRIPT_BUNDLE_DIR, so init.nut can load the other scripts
+  relative to scriptDir, whether they are bundled or not.
+
+  The entries have the layout of a script cache file, see
+  scriptcache.h.
+
+*/
+
+#ifndef scriptbundle_h
+#define scriptbundle_h
+
+#include <stdint.h>
+
+#define SCRIPT_BUNDLE_DIR ":/targets/"
+
+struct ScriptBundleEntry
+{
+    const char      *name;  // file name relative to the targets directory
+    const uint8_t   *data;
+    uint32_t        size;
+};
+
+/** the bundled scripts, terminated by an entry with a NULL name.
+    Generated by nutbundle. */
+extern const ScriptBundleEntry g_scriptBundle[];
+
+#endif
@@ -0,0 +1,699 @@
+/*
+
+  Swagger - A tool for programming ARM processors using the SWD protocol
+
+  Niels A. Moseley (c) Moseley Instruments 2016
+
+  Script bytecode cache
+
+*/
+
+#ifdef _WIN32
+#include <windows.h>    // for QueryPerformanceCounter
+#else
+#include <time.h>       // for clock_gettime
+#endif
+#include <stdio.h>
+#include <string.h>
+#include "scriptcache.h"
+#include <sqstdio.h>
+
+static uint64_t getMicros()
+{
+#ifdef _WIN32
+    LARGE_INTEGER count, freq;
+    QueryPerformanceCounter(&count);
+    QueryPerformanceFrequency(&freq);
+    return (uint64_t)(count.QuadPart * 1000000.0 / freq.QuadPart);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+/** 64-bit FNV-1a hash */
+static uint64_t fnv1a(const void *data, size_t bytes, uint64_t hash = 0xcbf29ce484222325ULL)
+{
+    const uint8_t *p = (const uint8_t*)data;
+    for(size_t i=0; i<bytes; i++)
+    {
+        hash ^= p[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+/** state of sq_readclosure reading from memory */
+struct MemoryReader
+{
+    const char  *data;
+    size_t      size;
+    size_t      pos;
+};
+
+static SQInteger memoryRead(SQUserPointer user, SQUserPointer buf, SQInteger size)
+{
+    MemoryReader *reader = (MemoryReader*)user;
+    size_t n = reader->size - reader->pos;
+    if (n == 0)
+    {
+        return -1;
+    }
+    if (n > (size_t)size)
+    {
+        n = size;
+    }
+    memcpy(buf, reader->data + reader->pos, n);
+    reader->pos += n;
+    return n;
+}
+
+static SQInteger memoryWrite(SQUserPointer user, SQUserPointer p, SQInteger size)
+{
+    ((std::string*)user)->append((const char*)p, size);
+    return size;
+}
+
+/** returns true if the source is plain or UTF-8 text,
+    which is what the cache handles */
+static bool isPlainText(const std::vector<char> &source)
+{
+    if (source.size() < 2)
+    {
+        return true;
+    }
+    uint16_t tag = (uint8_t)source[0] | ((uint8_t)source[1] << 8);
+    return (tag != SQ_BYTECODE_STREAM_TAG) && (tag != 0xFFFE) && (tag != 0xFEFF);
+}
+
+static void appendUInt32(std::string &out, uint32_t x)
+{
+    out.append((const char*)&x, 4);
+}
+
+static void appendString(std::string &out, const char *str, size_t len)
+{
+    appendUInt32(out, len);
+    out.append(str, len);
+}
+
+static bool readBytes(const char *&p, const char *end, void *dst, size_t n)
+{
+    if ((size_t)(end - p) < n)
+    {
+        return false;
+    }
+    memcpy(dst, p, n);
+    p += n;
+    return true;
+}
+
+static bool readUInt32(const char *&p, const char *end, uint32_t &x)
+{
+    return readBytes(p, end, &x, 4);
+}
+
+static bool readString(const char *&p, const char *end, std::string &str)
+{
+    uint32_t len;
+    if (!readUInt32(p, end, len) || ((size_t)(end - p) < len))
+    {
+        return false;
+    }
+    str.assign(p, len);
+    p += len;
+    return true;
+}
+
+static bool serializeTable(HSQUIRRELVM v, SQInteger idx, std::map<std::string, std::string> &entries);
+
+/** serialize a constant value */
+static bool serializeValue(HSQUIRRELVM v, SQInteger idx, std::string &out)
+{
+    switch(sq_gettype(v, idx))
+    {
+    case OT_INTEGER:
+        {
+            SQInteger i;
+            sq_getinteger(v, idx, &i);
+            int64_t x = i;
+            out += 'i';
+            out.append((const char*)&x, 8);
+        }
+        return true;
+    case OT_FLOAT:
+        {
+            SQFloat f;
+            sq_getfloat(v, idx, &f);
+            double x = f;
+            out += 'f';
+            out.append((const char*)&x, 8);
+        }
+        return true;
+    case OT_BOOL:
+        {
+            SQBool b;
+            sq_getbool(v, idx, &b);
+            out += 'b';
+            out += (char)(b ? 1 : 0);
+        }
+        return true;
+    case OT_STRING:
+        {
+            const SQChar *str;
+            sq_getstring(v, idx, &str);
+            out += 's';
+            appendString(out, (const char*)str, sq_getsize(v, idx) * sizeof(SQChar));
+        }
+        return true;
+    case OT_TABLE:
+        {
+            std::map<std::string, std::string> entries;
+            if (!serializeTable(v, idx, entries))
+            {
+                return false;
+            }
+            out += 't';
+            appendUInt32(out, entries.size());
+            std::map<std::string, std::string>::const_iterator iter;
+            for(iter = entries.begin(); iter != entries.end(); ++iter)
+            {
+                appendString(out, iter->first.c_str(), iter->first.size());
+                out += iter->second;
+            }
+        }
+        return true;
+    default:
+        return false;
+    }
+}
+
+/** serialize the values of a table with string keys */
+static bool serializeTable(HSQUIRRELVM v, SQInteger idx, std::map<std::string, std::string> &entries)
+{
+    SQInteger top = sq_gettop(v);
+    bool ok = true;
+    sq_push(v, idx);
+    sq_pushnull(v);
+    while(ok && SQ_SUCCEEDED(sq_next(v, -2)))
+    {
+        const SQChar *key;
+        std::string value;
+        ok = SQ_SUCCEEDED(sq_getstring(v, -2, &key)) && serializeValue(v, -1, value);
+        if (ok)
+        {
+            entries[std::string((const char*)key, sq_getsize(v, -2) * sizeof(SQChar))] = value;
+        }
+        sq_pop(v, 2);
+    }
+    sq_settop(v, top);
+    return ok;
+}
+
+/** push a serialized constant value */
+static bool pushValue(HSQUIRRELVM v, const char *&p, const char *end)
+{
+    char type;
+    if (!readBytes(p, end, &type, 1))
+    {
+        return false;
+    }
+    switch(type)
+    {
+    case 'i':
+        {
+            int64_t x;
+            if (!readBytes(p, end, &x, 8)) return false;
+            sq_pushinteger(v, (SQInteger)x);
+        }
+        return true;
+    case 'f':
+        {
+            double x;
+            if (!readBytes(p, end, &x, 8)) return false;
+            sq_pushfloat(v, (SQFloat)x);
+        }
+        return true;
+    case 'b':
+        {
+            uint8_t x;
+            if (!readBytes(p, end, &x, 1)) return false;
+            sq_pushbool(v, x ? SQTrue : SQFalse);
+        }
+        return true;
+    case 's':
+        {
+            std::string str;
+            if (!readString(p, end, str)) return false;
+            sq_pushstring(v, (const SQChar*)str.data(), str.size() / sizeof(SQChar));
+        }
+        return true;
+    case 't':
+        {
+            uint32_t count;
+            if (!readUInt32(p, end, count)) return false;
+            sq_newtable(v);
+            for(uint32_t i=0; i<count; i++)
+            {
+                std::string name;
+                if (!readString(p, end, name)) return false;
+                sq_pushstring(v, (const SQChar*)name.data(), name.size() / sizeof(SQChar));
+                if (!pushValue(v, p, end)) return false;
+                sq_newslot(v, -3, SQFalse);
+            }
+        }
+        return true;
+    default:
+        return false;
+    }
+}
+
+ScriptCache::ScriptCache() :
+    m_bundle(0),
+    m_bundled(0),
+    m_hits(0),
+    m_misses(0),
+    m_loadMicros(0)
+{
+}
+
+bool ScriptCache::readFile(const std::string &filename, std::vector<char> &data)
+{
+    FILE *f = fopen(filename.c_str(), "rb");
+    if (f == 0)
+    {
+        return false;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    data.resize(size > 0 ? size : 0);
+    bool ok = (size >= 0) && (fread(data.data(), 1, data.size(), f) == data.size());
+    fclose(f);
+    return ok;
+}
+
+std::string ScriptCache::cacheFileName(const char *filename, const std::vector<char> &source,
+    const ConstMap &consts) const
+{
+    // the bytecode depends on the Squirrel version and
+    // type sizes, the constants and the file name,
+    // which is kept as debug info.
+    uint32_t build[] = {SQUIRREL_VERSION_NUMBER, (uint32_t)sizeof(SQInteger),
+                        (uint32_t)sizeof(SQChar), (uint32_t)sizeof(SQFloat)};
+    uint64_t hash = fnv1a(build, sizeof(build));
+    hash = fnv1a(filename, strlen(filename) + 1, hash);
+    ConstMap::const_iterator iter;
+    for(iter = consts.begin(); iter != consts.end(); ++iter)
+    {
+        hash = fnv1a(iter->first.c_str(), iter->first.size() + 1, hash);
+        hash = fnv1a(iter->second.data(), iter->second.size(), hash);
+    }
+    hash = fnv1a(source.data(), source.size(), hash);
+
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.cnut", (unsigned long long)hash);
+    std::string path = m_dir;
+    if (!path.empty() && (path[path.size()-1] != '/') && (path[path.size()-1] != '\\'))
+    {
+        path += '/';
+    }
+    return path + name;
+}
+
+bool ScriptCache::getConsts(HSQUIRRELVM v, ConstMap &consts)
+{
+    SQInteger top = sq_gettop(v);
+    sq_pushconsttable(v);
+    bool ok = serializeTable(v, -1, consts);
+    sq_settop(v, top);
+    return ok;
+}
+
+bool ScriptCache::applyConsts(HSQUIRRELVM v, const char *&p, const char *end)
+{
+    SQInteger top = sq_gettop(v);
+    uint32_t count;
+    bool ok = readUInt32(p, end, count);
+    sq_pushconsttable(v);
+    for(uint32_t i=0; ok && (i<count); i++)
+    {
+        std::string name;
+        ok = readString(p, end, name);
+        if (ok)
+        {
+            sq_pushstring(v, (const SQChar*)name.data(), name.size() / sizeof(SQChar));
+            ok = pushValue(v, p, end) && SQ_SUCCEEDED(sq_newslot(v, -3, SQFalse));
+        }
+    }
+    sq_settop(v, top);
+    return ok;
+}
+
+SQRESULT ScriptCache::compile(HSQUIRRELVM v, const char *filename, const std::vector<char> &source, bool printError)
+{
+    // skip the UTF-8 byte order mark
+    size_t start = 0;
+    if ((source.size() >= 3) && ((uint8_t)source[0] == 0xEF) &&
+        ((uint8_t)source[1] == 0xBB) && ((uint8_t)source[2] == 0xBF))
+    {
+        start = 3;
+    }
+    return sq_compilebuffer(v, source.data() + start, source.size() - start, filename,
+        printError ? SQTrue : SQFalse);
+}
+
+SQRESULT ScriptCache::readEntry(HSQUIRRELVM v, const char *data, size_t size)
+{
+    const char *p = data;
+    const char *end = data + size;
+    if (!applyConsts(v, p, end))
+    {
+        return SQ_ERROR;
+    }
+
+    MemoryReader reader;
+    reader.data = p;
+    reader.size = end - p;
+    reader.pos = 0;
+    return sq_readclosure(v, memoryRead, &reader);
+}
+
+bool ScriptCache::makeEntry(HSQUIRRELVM v, const ConstMap &before, std::string &entry)
+{
+    ConstMap after;
+    if (!getConsts(v, after))
+    {
+        return false;
+    }
+
+    // the constants defined or changed by the script
+    std::string consts;
+    uint32_t count = 0;
+    ConstMap::const_iterator iter;
+    for(iter = after.begin(); iter != after.end(); ++iter)
+    {
+        ConstMap::const_iterator old = before.find(iter->first);
+        if ((old == before.end()) || (old->second != iter->second))
+        {
+            appendString(consts, iter->first.c_str(), iter->first.size());
+            consts += iter->second;
+            count++;
+        }
+    }
+
+    entry.clear();
+    appendUInt32(entry, count);
+    entry += consts;
+    return SQ_SUCCEEDED(sq_writeclosure(v, memoryWrite, &entry));
+}
+
+bool ScriptCache::writeFile(const std::string &cacheName, const std::string &entry) const
+{
+    // write to a temporary file first, so a half
+    // written cache file is never read. The sessions
+    // of gang mode each have their own cache instance
+    // and may write the same file at the same time.
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), ".%p.tmp", (const void*)this);
+    std::string tmpName = cacheName + suffix;
+    FILE *f = fopen(tmpName.c_str(), "wb");
+    if (f == 0)
+    {
+        return false;
+    }
+    bool ok = (fwrite(entry.data(), 1, entry.size(), f) == entry.size());
+    ok = (fclose(f) == 0) && ok;
+    remove(cacheName.c_str());
+    if (!ok || (rename(tmpName.c_str(), cacheName.c_str()) != 0))
+    {
+        remove(tmpName.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool ScriptCache::compileEntry(HSQUIRRELVM v, const char *filename, const char *name, std::string &entry)
+{
+    std::vector<char> source;
+    if (!readFile(filename, source))
+    {
+        printf("Error: cannot read %s\n", filename);
+        return false;
+    }
+    if (!isPlainText(source))
+    {
+        printf("Error: %s is not a text file\n", filename);
+        return false;
+    }
+
+    ConstMap consts;
+    if (!getConsts(v, consts))
+    {
+        printf("Error: the constants of %s cannot be stored\n", filename);
+        return false;
+    }
+    if (SQ_FAILED(compile(v, name, source, true)))
+    {
+        return false;
+    }
+    bool ok = makeEntry(v, consts, entry);
+    sq_poptop(v);
+    return ok;
+}
+
+SQRESULT ScriptCache::loadFile(HSQUIRRELVM v, const char *filename, bool printError)
+{
+    uint64_t t0 = getMicros();
+
+    size_t dirLen = strlen(SCRIPT_BUNDLE_DIR);
+    if ((m_bundle != 0) && (strncmp(filename, SCRIPT_BUNDLE_DIR, dirLen) == 0))
+    {
+        std::string name = filename + dirLen;
+        for(size_t i=0; i<name.size(); i++)
+        {
+            if (name[i] == '\\')
+            {
+                name[i] = '/';
+            }
+        }
+        for(const ScriptBundleEntry *e = m_bundle; e->name != 0; e++)
+        {
+            if (name == e->name)
+            {
+                if (SQ_FAILED(readEntry(v, (const char*)e->data, e->size)))
+                {
+                    return sq_throwerror(v, _SC("cannot read the bundled script"));
+                }
+                m_bundled++;
+                m_loadMicros += getMicros() - t0;
+                return SQ_OK;
+            }
+        }
+        return sq_throwerror(v, _SC("the script is not in the bundle"));
+    }
+
+    std::vector<char> source;
+    if (!readFile(filename, source))
+    {
+        return sq_throwerror(v, _SC("cannot open the file"));
+    }
+
+    if (!isPlainText(source))
+    {
+        return sqstd_loadfile(v, filename, printError ? SQTrue : SQFalse);
+    }
+
+    // scripts with enums of non-scalar values are not cached
+    ConstMap consts;
+    LoadedScript script;
+    script.filename = filename;
+    if (!m_dir.empty() && getConsts(v, consts))
+    {
+        script.cacheName = cacheFileName(filename, source, consts);
+    }
+
+    size_t i = 0;
+    while((i < m_loaded.size()) && (m_loaded[i].filename != script.filename)) i++;
+    if (i == m_loaded.size())
+    {
+        m_loaded.push_back(script);
+    }
+    else
+    {
+        m_loaded[i] = script;
+    }
+
+    std::vector<char> entry;
+    if (!script.cacheName.empty() && readFile(script.cacheName, entry) &&
+        SQ_SUCCEEDED(readEntry(v, entry.data(), entry.size())))
+    {
+        m_hits++;
+        m_loadMicros += getMicros() - t0;
+        return SQ_OK;
+    }
+
+    if (SQ_FAILED(compile(v, filename, source, printError)))
+    {
+        return SQ_ERROR;
+    }
+    m_misses++;
+
+    if (!script.cacheName.empty())
+    {
+        std::string newEntry;
+        if (!makeEntry(v, consts, newEntry) || !writeFile(script.cacheName, newEntry))
+        {
+            printf("Warning: cannot write script cache file %s\n", script.cacheName.c_str());
+        }
+    }
+    m_loadMicros += getMicros() - t0;
+    return SQ_OK;
+}
+
+SQRESULT ScriptCache::doFile(HSQUIRRELVM v, const char *filename, bool retval, bool printError)
+{
+    if (SQ_SUCCEEDED(loadFile(v, filename, printError)))
+    {
+        sq_push(v, -2);
+        if (SQ_SUCCEEDED(sq_call(v, 1, retval ? SQTrue : SQFalse, SQTrue)))
+        {
+            sq_remove(v, retval ? -2 : -1); //removes the closure
+            return 1;
+        }
+        sq_pop(v, 1); //removes the closure
+    }
+    return SQ_ERROR;
+}
+
+/** Squirrel command: dofile(filename [, printerror]) */
+static SQInteger cachedDofile(HSQUIRRELVM v)
+{
+    SQUserPointer cache;
+    const SQChar *filename;
+    SQBool printError = SQFalse;
+    sq_getuserpointer(v, -1, &cache);
+    sq_poptop(v);
+    sq_getstring(v, 2, &filename);
+    if (sq_gettop(v) >= 3)
+    {
+        sq_getbool(v, 3, &printError);
+    }
+    sq_push(v, 1); //repush the this
+    if (SQ_SUCCEEDED(((ScriptCache*)cache)->doFile(v, filename, true, printError == SQTrue)))
+    {
+        return 1;
+    }
+    return SQ_ERROR; //propagates the error
+}
+
+/** Squirrel command: loadfile(filename [, printerror]) */
+static SQInteger cachedLoadfile(HSQUIRRELVM v)
+{
+    SQUserPointer cache;
+    const SQChar *filename;
+    SQBool printError = SQFalse;
+    sq_getuserpointer(v, -1, &cache);
+    sq_poptop(v);
+    sq_getstring(v, 2, &filename);
+    if (sq_gettop(v) >= 3)
+    {
+        sq_getbool(v, 3, &printError);
+    }
+    if (SQ_SUCCEEDED(((ScriptCache*)cache)->loadFile(v, filename, printError == SQTrue)))
+    {
+        return 1;
+    }
+    return SQ_ERROR; //propagates the error
+}
+
+void ScriptCache::registerFunctions(HSQUIRRELVM v)
+{
+    SQFUNCTION funcs[] = {cachedDofile, cachedLoadfile};
+    const SQChar *names[] = {_SC("dofile"), _SC("loadfile")};
+    for(size_t i=0; i<2; i++)
+    {
+        sq_pushroottable(v);
+        sq_pushstring(v, names[i], -1);
+        sq_pushuserpointer(v, this);
+        sq_newclosure(v, funcs[i], 1);
+        sq_setparamscheck(v, -2, _SC(".sb"));
+        sq_newslot(v, -3, SQFalse);
+        sq_pop(v, 1); //pops the root table
+    }
+}
+
+void ScriptCache::benchmark(HSQUIRRELVM v, uint32_t rounds)
+{
+    if (m_dir.empty())
+    {
+        printf("Error: the script cache is disabled\n");
+        return;
+    }
+    if (rounds == 0)
+    {
+        rounds = 1;
+    }
+
+    // The warm time includes reading the source and the
+    // cache file and hashing, as it would at startup.
+    uint64_t coldMicros = 0;
+    uint64_t warmMicros = 0;
+    uint32_t scripts = 0;
+    SQInteger top = sq_gettop(v);
+    for(uint32_t r=0; r<rounds; r++)
+    {
+        for(size_t i=0; i<m_loaded.size(); i++)
+        {
+            const LoadedScript &script = m_loaded[i];
+            if (script.cacheName.empty())
+            {
+                continue;
+            }
+            if (r == 0)
+            {
+                scripts++;
+            }
+
+            std::vector<char> source, entry;
+            const char *filename = script.filename.c_str();
+
+            uint64_t t0 = getMicros();
+            if (!readFile(filename, source) || SQ_FAILED(compile(v, filename, source, true)))
+            {
+                printf("Error: cannot compile %s\n", filename);
+                sq_settop(v, top);
+                return;
+            }
+            uint64_t t1 = getMicros();
+            sq_settop(v, top);
+
+            ConstMap consts;
+            uint64_t t2 = getMicros();
+            if (!readFile(filename, source) || !getConsts(v, consts) ||
+                cacheFileName(filename, source, consts).empty() ||
+                !readFile(script.cacheName, entry) || SQ_FAILED(readEntry(v, entry.data(), entry.size())))
+            {
+                printf("Error: cannot read the cache file of %s\n", filename);
+                sq_settop(v, top);
+                return;
+            }
+            uint64_t t3 = getMicros();
+            sq_settop(v, top);
+
+            coldMicros += t1 - t0;
+            warmMicros += t3 - t2;
+        }
+    }
+
+    printf("Script loading, %d scripts, average of %d rounds:\n", scripts, rounds);
+    printf("  cold (compile) : %8.2f ms\n", coldMicros / 1000.0 / rounds);
+    printf("  warm (cache)   : %8.2f ms\n", warmMicros / 1000.0 / rounds);
+}
+
+void ScriptCache::printStats() const
+{
+    printf("Scripts: %d from the bundle, %d from the cache, %d compiled, %.2f ms\n",
+        m_bundled, m_hits, m_misses, m_loadMicros / 1000.0);
+}
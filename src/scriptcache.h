@@ -0,0 +1,134 @@
+/*
+
+  Swagger - A tool for programming ARM processors using the SWD protocol
+
+  Niels A. Moseley (c) Moseley Instruments 2016
+
+  Script bytecode cache
+
+  Compiling the target scripts takes a noticeable part of the
+  startup time. The cache stores the compiled closure of every
+  script that is loaded with dofile or loadfile in a cache
+  directory. The cache file name is a hash of the script source,
+  its file name, the Squirrel version and the constant table,
+  so a cache file is only used when it was compiled from exactly
+  the same source. Stale files are never read; they are simply
+  left unused.
+
+  Squirrel resolves constants when a script is compiled, so the
+  constants a script defines are stored in the cache file too and
+  are added to the constant table when it is loaded.
+
+  Cache file layout:
+    u32 number of constants
+    constants: name, value
+    closure written by sq_writeclosure
+
+  name   : u32 length, characters
+  value  : 'i' int64 | 'f' double | 'b' u8 | 's' u32 length, characters
+           | 't' u32 count, count x (name, value)   (enum)
+
+*/
+
+#ifndef scriptcache_h
+#define scriptcache_h
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <squirrel.h>
+#include "scriptbundle.h"
+
+class ScriptCache
+{
+public:
+    ScriptCache();
+
+    /** set the cache directory, an empty string disables the cache */
+    void setDirectory(const std::string &dir)
+    {
+        m_dir = dir;
+    }
+
+    /** set the embedded script bundle, or NULL for none */
+    void setBundle(const ScriptBundleEntry *bundle)
+    {
+        m_bundle = bundle;
+    }
+
+    /** Load a script and push its closure, like sqstd_loadfile.
+        Scripts in SCRIPT_BUNDLE_DIR are read from the bundle.
+        Other closures are read from the cache when possible,
+        else the script is compiled and the closure is cached.
+    */
+    SQRESULT loadFile(HSQUIRRELVM v, const char *filename, bool printError);
+
+    /** Load and run a script, like sqstd_dofile */
+    SQRESULT doFile(HSQUIRRELVM v, const char *filename, bool retval, bool printError);
+
+    /** replace the dofile and loadfile functions of the
+        standard library with cached versions */
+    void registerFunctions(HSQUIRRELVM v);
+
+    /** Time compiling all the scripts loaded so far against
+        loading them from the cache, and print the result.
+    */
+    void benchmark(HSQUIRRELVM v, uint32_t rounds);
+
+    /** print the number of cache hits and the load time */
+    void printStats() const;
+
+    /** Compile a script file to the contents of a cache file.
+        name is the file name kept as debug info.
+    */
+    static bool compileEntry(HSQUIRRELVM v, const char *filename, const char *name, std::string &entry);
+
+protected:
+    /** serialized values of the constants, by name */
+    typedef std::map<std::string, std::string> ConstMap;
+
+    struct LoadedScript
+    {
+        std::string filename;
+        std::string cacheName;  // empty when not cached
+    };
+
+    /** read a file into memory, returns false if it cannot be read */
+    static bool readFile(const std::string &filename, std::vector<char> &data);
+
+    /** the cache file name for a script source */
+    std::string cacheFileName(const char *filename, const std::vector<char> &source,
+        const ConstMap &consts) const;
+
+    /** read the constant table, returns false if it holds
+        a value that cannot be stored in a cache file */
+    static bool getConsts(HSQUIRRELVM v, ConstMap &consts);
+
+    /** add the constants of a cache file to the constant table */
+    static bool applyConsts(HSQUIRRELVM v, const char *&p, const char *end);
+
+    /** compile a script source and push the closure */
+    static SQRESULT compile(HSQUIRRELVM v, const char *filename, const std::vector<char> &source, bool printError);
+
+    /** apply the constants of a cache file and push its closure */
+    static SQRESULT readEntry(HSQUIRRELVM v, const char *data, size_t size);
+
+    /** Make the cache file contents for the closure on top of the
+        stack, given the constant table before it was compiled.
+    */
+    static bool makeEntry(HSQUIRRELVM v, const ConstMap &before, std::string &entry);
+
+    /** write a cache file */
+    bool writeFile(const std::string &cacheName, const std::string &entry) const;
+
+    std::string                 m_dir;
+    const ScriptBundleEntry     *m_bundle;
+    std::vector<LoadedScript>   m_loaded;   // scripts loaded so far
+    uint32_t                    m_bundled;
+    uint32_t                    m_hits;
+    uint32_t                    m_misses;
+    uint64_t                    m_loadMicros;
+};
+
+#endif
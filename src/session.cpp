@@ -0,0 +1,92 @@
+/*
+
+  Swagger - A tool for programming ARM processors using the SWD protocol
+
+  Niels A. Moseley (c) Moseley Instruments 2016
+
+  Programming session
+
+*/
+
+#include "session.h"
+
+QMutex Session::m_outputLock;
+
+Session::Session() :
+    hw(0),
+    resultIdx(0),
+    pluginHost(),
+    flashStats("Flash")
+{
+}
+
+void Session::attach(HSQUIRRELVM v)
+{
+    sq_setsharedforeignptr(v, this);
+}
+
+void Session::setName(const std::string &name)
+{
+    m_name = name;
+    progress.setPrefix(name.empty() ? name : "[" + name + "] ");
+}
+
+void Session::print(FILE *stream, const char *fmt, va_list args)
+{
+    if (m_name.empty())
+    {
+        vfprintf(stream, fmt, args);
+        return;
+    }
+
+    char buffer[256];
+    va_list args2;
+    va_copy(args2, args);
+    int len = vsnprintf(buffer, sizeof(buffer), fmt, args);
+    if (len < 0)
+    {
+        va_end(args2);
+        return;
+    }
+
+    std::string &pending = (stream == stderr) ? m_stderr : m_stdout;
+    if ((size_t)len < sizeof(buffer))
+    {
+        pending.append(buffer, len);
+    }
+    else
+    {
+        std::vector<char> text(len+1);
+        vsnprintf(&text[0], text.size(), fmt, args2);
+        pending.append(&text[0], len);
+    }
+    va_end(args2);
+
+    size_t eol;
+    while((eol = pending.find('\n')) != std::string::npos)
+    {
+        printLine(stream, pending.substr(0, eol));
+        pending.erase(0, eol+1);
+    }
+}
+
+void Session::flush()
+{
+    if (!m_stdout.empty())
+    {
+        printLine(stdout, m_stdout);
+        m_stdout.clear();
+    }
+    if (!m_stderr.empty())
+    {
+        printLine(stderr, m_stderr);
+        m_stderr.clear();
+    }
+}
+
+void Session::printLine(FILE *stream, const std::string &line)
+{
+    QMutexLocker lock(&m_outputLock);
+    fprintf(stream, "[%s] %s\n", m_name.c_str(), line.c_str());
+    fflush(stream);
+}
@@ -0,0 +1,93 @@
+/*
+
+  Swagger - A tool for programming ARM processors using the SWD protocol
+
+  Niels A. Moseley (c) Moseley Instruments 2016
+
+  Programming session
+
+  The state behind one Squirrel VM: the programmer it talks to,
+  the command and result queues, the command optimizer, the
+  progress reporter and the script cache. Every VM has its own
+  session, so several VMs can each program a target on their
+  own thread, see the gang mode in main.cpp.
+
+  The natives find the session of the VM that calls them with
+  Session::get(). It is stored as the shared foreign pointer of
+  the VM, so the threads (coroutines) of a VM see it too.
+
+*/
+
+#ifndef session_h
+#define session_h
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string>
+#include <vector>
+#include <QMutex>
+#include <squirrel.h>
+#include "cmdoptimizer.h"
+#include "progress.h"
+#include "packetstream.h"
+#include "pipeline.h"
+#include "scriptcache.h"
+#include "swagger_plugin.h"
+
+class HardwareInterface;
+
+class Session
+{
+public:
+    Session();
+
+    /** make this the session of a VM */
+    void attach(HSQUIRRELVM v);
+
+    /** get the session of a VM, or NULL if it has none */
+    static Session* get(HSQUIRRELVM v)
+    {
+        return (Session*)sq_getsharedforeignptr(v);
+    }
+
+    /** Set the name of the session. When it has a name, the
+        output of the session is printed one line at a time
+        with the name in front, so the output of sessions that
+        run at the same time does not get mixed up.
+    */
+    void setName(const std::string &name);
+
+    const std::string& name() const
+    {
+        return m_name;
+    }
+
+    /** print to stdout or stderr, see setName() */
+    void print(FILE *stream, const char *fmt, va_list args);
+
+    /** print the rest of an unterminated output line */
+    void flush();
+
+    HardwareInterface       *hw;            // the programmer, owned by the caller
+    std::vector<uint8_t>    cmdQueue;       // command queue to the programmer
+    std::vector<uint8_t>    resultQueue;    // result queue from the programmer
+    size_t                  resultIdx;      // read cursor into the result queue
+    CmdQueueOptimizer       optimizer;      // optimizes the command queue before sending
+    ProgressReporter        progress;       // progress of long operations
+    ScriptCache             scriptCache;    // compiled target scripts
+    SwaggerHost             pluginHost;     // host services for plugin drivers
+    PacketStream            packetStream;   // precompiled program packets, see flashStream
+    PipelineStats           flashStats;     // stage counters of the flash engine
+
+protected:
+    void printLine(FILE *stream, const std::string &line);
+
+    std::string     m_name;
+    std::string     m_stdout;       // unterminated output lines
+    std::string     m_stderr;
+
+    static QMutex   m_outputLock;
+};
+
+#endif
@@ -11,273 +11,2093 @@
 #else
 #include <time.h>       // for nanosleep
 #endif
+#include <string.h>     // for memcpy
+#include <signal.h>     // for Ctrl-C
 
 #include "squirrel_funcs.h"
 #include "hardwareinterface.h"
+#include "crc32.h"
+#include "cmdoptimizer.h"
+#include "flashengine.h"
+#include "cmdbatch.h"
+#include "firmwareimage.h"
+#include "packetstream.h"
+#include "imagescan.h"
+#include "progress.h"
+#include "scriptcache.h"
+#include "targetplugin.h"
+#include "session.h"
+
+void printfunc(HSQUIRRELVM v,const SQChar *s,...)
+{
+    va_list vl;
+    va_start(vl, s);
+    Session *session = Session::get(v);
+    if (session != 0)
+    {
+        session->print(stdout, s, vl);
+    }
+    else
+    {
+        scvprintf(stdout, s, vl);
+    }
+    va_end(vl);
+}
+
+void errorfunc(HSQUIRRELVM v,const SQChar *s,...)
+{
+    va_list vl;
+    va_start(vl, s);
+    Session *session = Session::get(v);
+    if (session != 0)
+    {
+        session->print(stderr, s, vl);
+    }
+    else
+    {
+        scvprintf(stderr, s, vl);
+    }
+    va_end(vl);
+}
+
+void register_global_func(HSQUIRRELVM v, SQFUNCTION f, const char *fname)
+{
+    sq_pushroottable(v);
+    sq_pushstring(v,fname,-1);
+    sq_newclosure(v,f,0);
+    sq_newslot(v,-3,SQFalse);
+    sq_pop(v,1); //pops the root table
+}
+
+void register_global_func(HSQUIRRELVM v, SQFUNCTION f, const char *fname, SQUserPointer *userPtr)
+{
+    sq_pushroottable(v);
+    sq_pushstring(v,fname,-1);
+    sq_pushuserpointer(v, userPtr);
+    sq_newclosure(v,f,1);
+    sq_setparamscheck(v,1,NULL);
+    sq_newslot(v,-3,SQFalse);
+    sq_pop(v,1); //pops the root table
+}
+
+void compile_error_handler(HSQUIRRELVM v, const SQChar* desc, const SQChar* source, SQInteger line, SQInteger column)
+{
+    printfunc(v, "Error in %s:%d:%d %s\n", source, (int)line, (int)column, desc);
+}
+
+void createStringVariable(HSQUIRRELVM v, const char *varname, const char *value)
+{
+    sq_pushroottable(v);
+    sq_pushstring(v,varname,-1);
+    sq_pushstring(v,value,-1);
+    sq_createslot(v,-3);
+}
+
+void createIntegerVariable(HSQUIRRELVM v,const char *varname, uint32_t value)
+{
+    sq_pushroottable(v);
+    sq_pushstring(v,varname,-1);
+    sq_pushinteger(v,value);
+    sq_createslot(v,-3);
+}
+
+void createBooleanVariable(HSQUIRRELVM v, const char *varname, bool value)
+{
+    sq_pushroottable(v);
+    sq_pushstring(v,varname,-1);
+    sq_pushbool(v, value ? SQTrue : SQFalse);
+    sq_createslot(v,-3);
+}
+
+// *****************************************
+// ** CUSTOM SQUIRREL FUNCTIONS
+// *****************************************
+
+SQInteger quit(HSQUIRRELVM v)
+{
+    int *done;
+    sq_getuserpointer(v,-1,(SQUserPointer*)&done);
+    *done=1;
+    return 0;
+}
+
+
+/** Squirrel command: queue uint8_t in the command queue*/
+SQInteger queueUInt8(HSQUIRRELVM v)
+{
+    Session *session = Session::get(v);
+    SQInteger nargs = sq_gettop(v);  // get number of arguments
+
+    if (nargs != 2)
+    {
+        printfunc(v, "Error: queueUint8 does not have enough parameters\n");
+        return 0;   // error, not enough
+    }
+
+    SQInteger byte;
+    if (SQ_SUCCEEDED(sq_getinteger(v, -1, &byte)))
+    {
+        session->cmdQueue.push_back(byte);
+    }
+    else
+    {
+        printfunc(v, "Error: queueUint8 parameter is not an integer\n");
+    }
+    return 0;   // no parameters returned
+}
+
+
+/** Squirrel command: queue uint32_t int the command queue*/
+SQInteger queueUInt32(HSQUIRRELVM v)
+{
+    Session *session = Session::get(v);
+    SQInteger nargs = sq_gettop(v);  // get number of arguments
+
+    if (nargs != 2)
+    {
+        printfunc(v, "Error: queueUint32 does not have enough parameters\n");
+        return 0;   // error, not enough
+    }
+
+    SQInteger word;
+    if (SQ_SUCCEEDED(sq_getinteger(v, -1, &word)))
+    {
+        session->cmdQueue.push_back(word & 0xFF); // LSB first
+        session->cmdQueue.push_back((word>>8) & 0xFF);
+        session->cmdQueue.push_back((word>>16) & 0xFF);
+        session->cmdQueue.push_back((word>>24) & 0xFF);
+    }
+    else
+    {
+        printfunc(v, "Error: queueUint32 parameter is not an integer\n");
+    }
+    return 0;   // no parameters returned
+}
+
+
+/** set up the optimizer for the connected interface */
+static void setupOptimizer(Session *session)
+{
+    if (session->optimizer.isEnabled())
+    {
+        // block commands need protocol version 4
+        InterfaceInfo info;
+        session->optimizer.setBlockCommands(session->hw->getInterfaceInfo(info) && (info.version >= 4));
+    }
+}
+
+/** run the command queue through the optimizer */
+static void optimizeCmdQueue(Session *session, std::vector<uint8_t> &packet)
+{
+    setupOptimizer(session);
+    session->optimizer.optimize(session->cmdQueue, packet);
+}
+
+/** Squirrel command: execute command queue */
+SQInteger executeCmdQueue(HSQUIRRELVM v)
+{
+    Session *session = Session::get(v);
+    // no arguments required
+    std::vector<uint8_t> packet;
+    optimizeCmdQueue(session, packet);
+
+    // the results of asynchronous packets arrive first
+    if (!session->hw->flushAsync())
+    {
+        printfunc(v, "Error: readPacket %s\n", session->hw->getLastError().c_str());
+    }
+
+    if (session->hw->writePacket(packet)==false)
+    {
+        printfunc(v, "Error: writePacket %s\n", session->hw->getLastError().c_str());
+        sq_pushinteger(v, 1);
+        // error transmitting
+    }
+    session->resultQueue.clear();
+    session->resultIdx = 0;
+    if (session->hw->readPacket(session->resultQueue)==false)
+    {
+        printfunc(v, "Error: readPacket %s\n", session->hw->getLastError().c_str());
+        sq_pushinteger(v, 2);
+        // error receiving
+    }
+    sq_pushinteger(v, 0);
+    return 1;   // result code
+}
+
+
+SQInteger executeAsync(HSQUIRRELVM v)
+{
+    Session *session = Session::get(v);
+    std::vector<uint8_t> packet;
+    optimizeCmdQueue(session, packet);
+
+    uint32_t handle = session->hw->sendPacketAsync(packet);
+    if (handle == 0)
+    {
+        printfunc(v, "Error: executeAsync %s\n", session->hw->getLastError().c_str());
+    }
+    sq_pushinteger(v, handle);
+    return 1;
+}
+
+SQInteger asyncReady(HSQUIRRELVM v)
+{
+    Session *session = Session::get(v);
+    SQInteger handle;
+    if ((sq_gettop(v) != 2) || SQ_FAILED(sq_getinteger(v, 2, &handle)))
+    {
+        printfunc(v, "Error: asyncReady parameter is not a handle\n");
+        return 0;
+    }
+    sq_pushbool(v, session->hw->isResultReady(handle) ? SQTrue : SQFalse);
+    return 1;
+}
+
+SQInteger asyncReceiveNext(HSQUIRRELVM v)
+{
+    Session *session = Session::get(v);
+    uint32_t handle = 0;
+    if (session->hw->packetsInFlight() > 0)
+    {
+        handle = session->hw->receiveNextResult();
+        if (handle == 0)
+        {
+            printfunc(v, "Error: readPacket %s\n", session->hw->getLastError().c_str());
+        }
+    }
+    sq_pushinteger(v, handle);
+    return 1;
+}
+
+SQInteger asyncDiscard(HSQUIRRELVM v)
+{
+    Session *session = Session::get(v);
+    if (!session->hw->discardAsync())
+    {
+        printfunc(v, "Error: readPacket %s\n", session->hw->getLastError().c_str());
+    }
+    return 0;
+}
+
+SQInteger awaitResult(HSQUIRRELVM v)
+{
+    Session *session = Session::get(v);
+    SQInteger handle;
+    if ((sq_gettop(v) != 2) || SQ_FAILED(sq_getinteger(v, 2, &handle)))
+    {
+        printfunc(v, "Error: awaitResult parameter is not a handle\n");
+        return 0;
+    }
+
+    session->resultQueue.clear();
+    session->resultIdx = 0;
+    if (!session->hw->waitForResult(handle, session->resultQueue))
+    {
+        printfunc(v, "Error: awaitResult %s\n", session->hw->getLastError().c_str());
+        sq_pushinteger(v, 2);   // error receiving
+        return 1;
+    }
+    sq_pushinteger(v, 0);
+    return 1;
+}
+
+
+/** get a uint32_t from a result queue at the read cursor */
+static uint32_t getResultUInt32(const std::vector<uint8_t> &queue, size_t &idx)
+{
+    const uint8_t *ptr = &queue[idx];
+    uint32_t word = (uint32_t)ptr[0];   // LSB first
+    word |= ((uint32_t)ptr[1]) << 8;
+    word |= ((uint32_t)ptr[2]) << 16;
+    word |= ((uint32_t)ptr[3]) << 24;
+    idx += 4;
+    return word;
+}
+
+// The pop functions below work on any result queue,
+// so they can be shared by the global result queue
+// and the command batches.
+
+static SQInteger doPopUInt8(HSQUIRRELVM v, const std::vector<uint8_t> &queue, size_t &idx)
+{
+    if (idx < queue.size())
+    {
+        sq_pushinteger(v, queue[idx++]);
+    }
+    else
+    {
+        sq_pushinteger(v, 0);
+    }
+    return 1;
+}
+
+static SQInteger doPopUInt32(HSQUIRRELVM v, const std::vector<uint8_t> &queue, size_t &idx)
+{
+    if (idx + 4 <= queue.size())
+    {
+        sq_pushinteger(v, getResultUInt32(queue, idx));
+    }
+    else
+    {
+        sq_pushinteger(v, 0);
+    }
+    return 1;
+}
+
+static SQInteger doPopUInt32Array(HSQUIRRELVM v, const std::vector<uint8_t> &queue, size_t &idx)
+{
+    SQInteger nargs = sq_gettop(v);  // get number of arguments
+
+    if (nargs != 2)
+    {
+        printfunc(v, "Error: popUInt32Array does not have enough parameters\n");
+        return 0;
+    }
+
+    SQInteger words;
+    if (SQ_FAILED(sq_getinteger(v, -1, &words)) || (words < 0))
+    {
+        printfunc(v, "Error: popUInt32Array parameter is not a positive integer\n");
+        return 0;
+    }
+
+    if (idx + 4*words > queue.size())
+    {
+        printfunc(v, "Error: popUInt32Array result queue holds less than %d words\n", (int)words);
+        return 0;
+    }
+
+    sq_newarray(v, words);
+    for(SQInteger i=0; i<words; i++)
+    {
+        sq_pushinteger(v, i);
+        sq_pushinteger(v, getResultUInt32(queue, idx));
+        sq_set(v, -3);
+    }
+    return 1;
+}
+
+static SQInteger doPopBlob(HSQUIRRELVM v, const std::vector<uint8_t> &queue, size_t &idx)
+{
+    SQInteger nargs = sq_gettop(v);  // get number of arguments
+
+    if (nargs != 2)
+    {
+        printfunc(v, "Error: popBlob does not have enough parameters\n");
+        return 0;
+    }
+
+    SQInteger bytes;
+    if (SQ_FAILED(sq_getinteger(v, -1, &bytes)) || (bytes < 0))
+    {
+        printfunc(v, "Error: popBlob parameter is not a positive integer\n");
+        return 0;
+    }
+
+    if (idx + bytes > queue.size())
+    {
+        printfunc(v, "Error: popBlob result queue holds less than %d bytes\n", (int)bytes);
+        return 0;
+    }
+
+    SQUserPointer data = sqstd_createblob(v, bytes);
+    if (bytes > 0)
+    {
+        memcpy(data, &queue[idx], bytes);
+    }
+    idx += bytes;
+    return 1;
+}
+
+/** Squirrel command: pop uint8_t from result queue */
+SQInteger popUInt8(HSQUIRRELVM v)
+{
+    Session *session = Session::get(v);
+    return doPopUInt8(v, session->resultQueue, session->resultIdx);
+}
+
+
+/** Squirrel command: pop uint32_t from result queue */
+SQInteger popUInt32(HSQUIRRELVM v)
+{
+    Session *session = Session::get(v);
+    return doPopUInt32(v, session->resultQueue, session->resultIdx);
+}
+
+SQInteger popUInt32Array(HSQUIRRELVM v)
+{
+    Session *session = Session::get(v);
+    return doPopUInt32Array(v, session->resultQueue, session->resultIdx);
+}
+
+SQInteger popBlob(HSQUIRRELVM v)
+{
+    Session *session = Session::get(v);
+    return doPopBlob(v, session->resultQueue, session->resultIdx);
+}
+
+SQInteger dumpCmdQueue(HSQUIRRELVM v)
+{
+    Session *session = Session::get(v);
+    uint32_t N=session->cmdQueue.size();
+    printfunc(v, "Command queue size = %d bytes\n", N);
+    for(uint32_t i=0; i<N; i++)
+    {
+        printfunc(v, " %02X", session->cmdQueue[i]);
+    }
+    printfunc(v, "\n");
+    return 0;
+}
+
+SQInteger printLastPacketError(HSQUIRRELVM v)
+{
+    Session *session = Session::get(v);
+    if (session->hw != 0)
+        printfunc(v, "%s\n", session->hw->getLastError().c_str());
+    return 0;
+}
+
+
+SQInteger dumpResultQueue(HSQUIRRELVM v)
+{
+    Session *session = Session::get(v);
+    uint32_t N=session->resultQueue.size();
+    printfunc(v, "Result queue size = %d bytes\n", N - (uint32_t)session->resultIdx);
+    for(uint32_t i=session->resultIdx; i<N; i++)
+    {
+        printfunc(v, " %02X", session->resultQueue[i]);
+    }
+    printfunc(v, "\n");
+    return 0;
+}
+
+SQInteger clearCmdQueue(HSQUIRRELVM v)
+{
+    Session *session = Session::get(v);
+    session->cmdQueue.clear();
+    return 0;
+}
+
+SQInteger sleep(HSQUIRRELVM v)
+{
+    SQInteger nargs = sq_gettop(v);  // get number of arguments
+
+    if (nargs != 2)
+    {
+        printfunc(v, "Error: sleep does not have enough parameters\n");
+        return 0;   // error, not enough
+    }
+
+    SQInteger word;
+    if (SQ_SUCCEEDED(sq_getinteger(v, -1, &word)))
+    {
+#ifdef _WIN32
+        Sleep(word);
+#else
+        struct timespec ts;
+        ts.tv_sec = word / 1000;
+        ts.tv_nsec = (word % 1000) * 1000000;
+        nanosleep(&ts, NULL);
+#endif
+    }
+    else
+    {
+        printfunc(v, "Error: sleep parameter is not an integer\n");
+    }
+    return 0;   // no parameters returned
+}
+
+SQInteger getMillis(HSQUIRRELVM v)
+{
+#ifdef _WIN32
+    sq_pushinteger(v, GetTickCount());
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    sq_pushinteger(v, (SQInteger)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000));
+#endif
+    return 1;
+}
+
+/** push a table with the interface information */
+static void pushInterfaceInfo(HSQUIRRELVM v, const InterfaceInfo &info)
+{
+    sq_newtable(v);
+    sq_pushstring(v, _SC("version"), -1);
+    sq_pushinteger(v, info.version);
+    sq_newslot(v, -3, SQFalse);
+    sq_pushstring(v, _SC("rxBufSize"), -1);
+    sq_pushinteger(v, info.rxBufSize);
+    sq_newslot(v, -3, SQFalse);
+    sq_pushstring(v, _SC("rxBufCount"), -1);
+    sq_pushinteger(v, info.rxBufCount);
+    sq_newslot(v, -3, SQFalse);
+    sq_pushstring(v, _SC("txBufSize"), -1);
+    sq_pushinteger(v, info.txBufSize);
+    sq_newslot(v, -3, SQFalse);
+}
+
+SQInteger waitForInterface(HSQUIRRELVM v)
+{
+    Session *session = Session::get(v);
+    SQInteger nargs = sq_gettop(v);  // get number of arguments
+
+    if (nargs != 2)
+    {
+        printfunc(v, "Error: waitForInterface does not have enough parameters\n");
+        return 0;
+    }
+
+    SQInteger maxWaitMs;
+    if (SQ_FAILED(sq_getinteger(v, 2, &maxWaitMs)) || (maxWaitMs < 0))
+    {
+        printfunc(v, "Error: waitForInterface needs a time in milliseconds\n");
+        return 0;
+    }
+
+    InterfaceInfo info;
+    if (!session->hw->waitUntilReady(maxWaitMs) || !session->hw->getInterfaceInfo(info))
+    {
+        printfunc(v, "Error: %s\n", session->hw->getLastError().c_str());
+        sq_pushnull(v);
+        return 1;
+    }
+    pushInterfaceInfo(v, info);
+    return 1;
+}
+
+SQInteger getInterfaceInfo(HSQUIRRELVM v)
+{
+    Session *session = Session::get(v);
+
+    InterfaceInfo info;
+    if (!session->hw->getInterfaceInfo(info))
+    {
+        sq_pushnull(v);
+        return 1;
+    }
+    pushInterfaceInfo(v, info);
+    return 1;
+}
+
+// set by Ctrl-C when stop requests are enabled
+static volatile sig_atomic_t g_stopRequested = 0;
+
+static void stopHandler(int)
+{
+    g_stopRequested = 1;
+}
+
+void enableStopRequests()
+{
+    signal(SIGINT, stopHandler);
+}
+
+SQInteger stopRequested(HSQUIRRELVM v)
+{
+    sq_pushbool(v, g_stopRequested ? SQTrue : SQFalse);
+    return 1;
+}
+
+static void pushUInt32(std::vector<uint8_t> &queue, uint32_t word)
+{
+    queue.push_back(word & 0xFF); // LSB first
+    queue.push_back((word>>8) & 0xFF);
+    queue.push_back((word>>16) & 0xFF);
+    queue.push_back((word>>24) & 0xFF);
+}
+
+/** print the reason why executePackets failed */
+static void printPacketsError(HSQUIRRELVM v, const char *funcName, const std::vector< std::vector<uint8_t> > &results)
+{
+    Session *session = Session::get(v);
+    if (!results.empty() && !results.back().empty() && (results.back()[0] != RXCMD_STATUS_OK))
+    {
+        printfunc(v, "Error: %s failed with status %d\n", funcName, results.back()[0]);
+    }
+    else
+    {
+        printfunc(v, "Error: %s %s\n", funcName, session->hw->getLastError().c_str());
+    }
+}
+
+SQInteger readMemoryBlock(HSQUIRRELVM v)
+{
+    Session *session = Session::get(v);
+    SQInteger nargs = sq_gettop(v);  // get number of arguments
+
+    if (nargs != 3)
+    {
+        printfunc(v, "Error: readMemoryBlock does not have enough parameters\n");
+        return 0;
+    }
+
+    SQInteger address, bytes;
+    if (SQ_FAILED(sq_getinteger(v, 2, &address)) || SQ_FAILED(sq_getinteger(v, 3, &bytes)))
+    {
+        printfunc(v, "Error: readMemoryBlock parameters must be integers\n");
+        return 0;
+    }
+    if ((bytes < 0) || ((bytes & 3) != 0) || ((address & 3) != 0))
+    {
+        printfunc(v, "Error: readMemoryBlock address and size must be a multiple of 4\n");
+        return 0;
+    }
+
+    InterfaceInfo info;
+    if (!session->hw->getInterfaceInfo(info))
+    {
+        printfunc(v, "Error: readMemoryBlock %s\n", session->hw->getLastError().c_str());
+        return 0;
+    }
+
+    // the words read by one packet must fit in the result packet,
+    // for older hardware the READ MEMORY commands must also fit
+    // in the receive buffer.
+    bool useBlock = (info.version >= 4);
+    uint32_t maxWords = info.txBufSize / 4;
+    if (useBlock && (maxWords > 255))
+        maxWords = 255;
+    if (!useBlock && (maxWords > info.rxBufSize / 5U))
+        maxWords = info.rxBufSize / 5U;
+
+    std::vector< std::vector<uint8_t> > packets;
+    uint32_t addr = address;
+    uint32_t wordsLeft = bytes / 4;
+    while(wordsLeft > 0)
+    {
+        uint32_t words = (wordsLeft > maxWords) ? maxWords : wordsLeft;
+        packets.push_back(std::vector<uint8_t>());
+        std::vector<uint8_t> &packet = packets.back();
+        if (useBlock)
+        {
+            packet.push_back(TXCMD_TYPE_READMEMBLOCK);
+            pushUInt32(packet, addr);
+            packet.push_back(words);
+        }
+        else
+        {
+            for(uint32_t i=0; i<words; i++)
+            {
+                packet.push_back(TXCMD_TYPE_READMEM);
+                pushUInt32(packet, addr + 4*i);
+            }
+        }
+        addr += 4*words;
+        wordsLeft -= words;
+    }
+
+    std::vector< std::vector<uint8_t> > results;
+    if (!session->hw->executePackets(packets, results))
+    {
+        printPacketsError(v, "readMemoryBlock", results);
+        return 0;
+    }
+
+    uint8_t *data = (uint8_t*)sqstd_createblob(v, bytes);
+    for(size_t i=0; i<results.size(); i++)
+    {
+        size_t N = results[i].size() - 1;   // skip status byte
+        if (N > (size_t)bytes)
+        {
+            N = bytes;
+        }
+        memcpy(data, &results[i][1], N);
+        data += N;
+        bytes -= N;
+    }
+    if (bytes != 0)
+    {
+        printfunc(v, "Error: readMemoryBlock received too little data\n");
+        sq_pop(v, 1);
+        return 0;
+    }
+    return 1;
+}
+
+SQInteger writeMemoryBlock(HSQUIRRELVM v)
+{
+    Session *session = Session::get(v);
+    SQInteger nargs = sq_gettop(v);  // get number of arguments
+
+    if (nargs != 3)
+    {
+        printfunc(v, "Error: writeMemoryBlock does not have enough parameters\n");
+        return 0;
+    }
+
+    SQInteger address;
+    SQUserPointer blobData;
+    if (SQ_FAILED(sq_getinteger(v, 2, &address)) || SQ_FAILED(sqstd_getblob(v, 3, &blobData)))
+    {
+        printfunc(v, "Error: writeMemoryBlock expects an address and a blob\n");
+        return 0;
+    }
+    SQInteger bytes = sqstd_getblobsize(v, 3);
+    if (((bytes & 3) != 0) || ((address & 3) != 0))
+    {
+        printfunc(v, "Error: writeMemoryBlock address and size must be a multiple of 4\n");
+        return 0;
+    }
+
+    InterfaceInfo info;
+    if (!session->hw->getInterfaceInfo(info))
+    {
+        printfunc(v, "Error: writeMemoryBlock %s\n", session->hw->getLastError().c_str());
+        sq_pushinteger(v, RXCMD_STATUS_PROTOERR);
+        return 1;
+    }
+
+    // the commands must fit in the receive buffer
+    bool useBlock = (info.version >= 4);
+    uint32_t maxWords = useBlock ? (info.rxBufSize - 6) / 4 : info.rxBufSize / 9;
+    if (maxWords > 255)
+        maxWords = 255;
+
+    const uint8_t *data = (const uint8_t*)blobData;
+    std::vector< std::vector<uint8_t> > packets;
+    uint32_t addr = address;
+    uint32_t wordsLeft = bytes / 4;
+    while(wordsLeft > 0)
+    {
+        uint32_t words = (wordsLeft > maxWords) ? maxWords : wordsLeft;
+        packets.push_back(std::vector<uint8_t>());
+        std::vector<uint8_t> &packet = packets.back();
+        if (useBlock)
+        {
+            packet.push_back(TXCMD_TYPE_WRITEMEMBLOCK);
+            pushUInt32(packet, addr);
+            packet.push_back(words);
+            packet.insert(packet.end(), data, data + 4*words);
+        }
+        else
+        {
+            for(uint32_t i=0; i<words; i++)
+            {
+                packet.push_back(TXCMD_TYPE_WRITEMEM);
+                pushUInt32(packet, addr + 4*i);
+                packet.insert(packet.end(), data + 4*i, data + 4*i + 4);
+            }
+        }
+        data += 4*words;
+        addr += 4*words;
+        wordsLeft -= words;
+    }
+
+    std::vector< std::vector<uint8_t> > results;
+    if (!session->hw->executePackets(packets, results))
+    {
+        printPacketsError(v, "writeMemoryBlock", results);
+        if (!results.empty() && !results.back().empty())
+        {
+            sq_pushinteger(v, results.back()[0]);
+        }
+        else
+        {
+            sq_pushinteger(v, RXCMD_STATUS_PROTOERR);
+        }
+        return 1;
+    }
+
+    sq_pushinteger(v, RXCMD_STATUS_OK);
+    return 1;
+}
+
+// core register access through the debug registers
+#define SCS_DHCSR       0xE000EDF0  // debug halting control and status
+#define SCS_DCRSR       0xE000EDF4  // debug core register selector
+#define SCS_DCRDR       0xE000EDF8  // debug core data register
+#define S_REGRDY        0x00010000  // DHCSR register transfer done
+#define DCRSR_WRITE     0x00010000  // DCRSR core register write
+#define DCRSR_REGSEL    0x0000007F  // DCRSR register number field
+
+/** the number of core register transfers that fit in a packet */
+static uint32_t coreRegsPerPacket(const InterfaceInfo &info, uint32_t cmdBytes, uint32_t resultBytes)
+{
+    uint32_t perPacket = info.rxBufSize / cmdBytes;
+    if ((resultBytes != 0) && (perPacket > info.txBufSize / resultBytes))
+    {
+        perPacket = info.txBufSize / resultBytes;
+    }
+    return (perPacket > 0) ? perPacket : 1;
+}
+
+SQInteger readCoreRegisters(HSQUIRRELVM v)
+{
+    Session *session = Session::get(v);
+    SQInteger nargs = sq_gettop(v);  // get number of arguments
+
+    if ((nargs != 2) || (sq_gettype(v, 2) != OT_ARRAY))
+    {
+        printfunc(v, "Error: readCoreRegisters expects an array of register numbers\n");
+        return 0;
+    }
+
+    std::vector<uint32_t> regs;
+    SQInteger count = sq_getsize(v, 2);
+    for(SQInteger i=0; i<count; i++)
+    {
+        SQInteger reg;
+        sq_pushinteger(v, i);
+        sq_get(v, 2);
+        bool ok = SQ_SUCCEEDED(sq_getinteger(v, -1, &reg));
+        sq_pop(v, 1);
+        if (!ok)
+        {
+            printfunc(v, "Error: readCoreRegisters register numbers must be integers\n");
+            return 0;
+        }
+        if ((reg < 0) || (reg > DCRSR_REGSEL))
+        {
+            return sq_throwerror(v, _SC("readCoreRegisters register number out of range 0x00..0x7F"));
+        }
+        regs.push_back(reg);
+    }
+
+    InterfaceInfo info;
+    if (!session->hw->getInterfaceInfo(info))
+    {
+        printfunc(v, "Error: readCoreRegisters %s\n", session->hw->getLastError().c_str());
+        return 0;
+    }
+
+    // for every register: select it, wait until the
+    // transfer is done and read the value.
+    uint32_t perPacket = coreRegsPerPacket(info, 9 + 9 + 5, 4);
+    std::vector< std::vector<uint8_t> > packets;
+    for(size_t i=0; i<regs.size(); i++)
+    {
+        if ((i % perPacket) == 0)
+        {
+            packets.push_back(std::vector<uint8_t>());
+        }
+        std::vector<uint8_t> &packet = packets.back();
+        packet.push_back(TXCMD_TYPE_WRITEMEM);
+        pushUInt32(packet, SCS_DCRSR);
+        pushUInt32(packet, regs[i]);
+        packet.push_back(TXCMD_TYPE_WAITMEMTRUE);
+        pushUInt32(packet, SCS_DHCSR);
+        pushUInt32(packet, S_REGRDY);
+        packet.push_back(TXCMD_TYPE_READMEM);
+        pushUInt32(packet, SCS_DCRDR);
+    }
+
+    std::vector< std::vector<uint8_t> > results;
+    if (!session->hw->executePackets(packets, results))
+    {
+        printPacketsError(v, "readCoreRegisters", results);
+        return 0;
+    }
+
+    sq_newarray(v, 0);
+    for(size_t p=0; p<results.size(); p++)
+    {
+        for(size_t i=1; i+4<=results[p].size(); i+=4)
+        {
+            const uint8_t *w = &results[p][i];
+            sq_pushinteger(v, w[0] | (w[1] << 8) | (w[2] << 16) | ((uint32_t)w[3] << 24));
+            sq_arrayappend(v, -2);
+        }
+    }
+    if (sq_getsize(v, -1) != (SQInteger)regs.size())
+    {
+        printfunc(v, "Error: readCoreRegisters received too little data\n");
+        sq_pop(v, 1);
+        return 0;
+    }
+    return 1;
+}
+
+SQInteger writeCoreRegisters(HSQUIRRELVM v)
+{
+    Session *session = Session::get(v);
+    SQInteger nargs = sq_gettop(v);  // get number of arguments
+
+    if ((nargs != 2) || (sq_gettype(v, 2) != OT_TABLE))
+    {
+        printfunc(v, "Error: writeCoreRegisters expects a table of register values\n");
+        return 0;
+    }
+
+    InterfaceInfo info;
+    if (!session->hw->getInterfaceInfo(info))
+    {
+        printfunc(v, "Error: writeCoreRegisters %s\n", session->hw->getLastError().c_str());
+        sq_pushinteger(v, RXCMD_STATUS_PROTOERR);
+        return 1;
+    }
+
+    // for every register: write the value, select the
+    // register for writing and wait until it is written.
+    uint32_t perPacket = coreRegsPerPacket(info, 9 + 9 + 9, 0);
+    std::vector< std::vector<uint8_t> > packets;
+    uint32_t regCount = 0;
+    sq_pushnull(v);
+    while(SQ_SUCCEEDED(sq_next(v, 2)))
+    {
+        SQInteger reg, value;
+        bool ok = SQ_SUCCEEDED(sq_getinteger(v, -2, &reg)) && SQ_SUCCEEDED(sq_getinteger(v, -1, &value));
+        sq_pop(v, 2);
+        if (!ok)
+        {
+            sq_pop(v, 1);   // the iterator
+            printfunc(v, "Error: writeCoreRegisters register numbers and values must be integers\n");
+            return 0;
+        }
+        if ((reg < 0) || (reg > DCRSR_REGSEL))
+        {
+            sq_pop(v, 1);   // the iterator
+            return sq_throwerror(v, _SC("writeCoreRegisters register number out of range 0x00..0x7F"));
+        }
+
+        if ((regCount % perPacket) == 0)
+        {
+            packets.push_back(std::vector<uint8_t>());
+        }
+        std::vector<uint8_t> &packet = packets.back();
+        packet.push_back(TXCMD_TYPE_WRITEMEM);
+        pushUInt32(packet, SCS_DCRDR);
+        pushUInt32(packet, value);
+        packet.push_back(TXCMD_TYPE_WRITEMEM);
+        pushUInt32(packet, SCS_DCRSR);
+        pushUInt32(packet, reg | DCRSR_WRITE);
+        packet.push_back(TXCMD_TYPE_WAITMEMTRUE);
+        pushUInt32(packet, SCS_DHCSR);
+        pushUInt32(packet, S_REGRDY);
+        regCount++;
+    }
+    sq_pop(v, 1);   // the iterator
+
+    std::vector< std::vector<uint8_t> > results;
+    if (!session->hw->executePackets(packets, results))
+    {
+        printPacketsError(v, "writeCoreRegisters", results);
+        if (!results.empty() && !results.back().empty())
+        {
+            sq_pushinteger(v, results.back()[0]);
+        }
+        else
+        {
+            sq_pushinteger(v, RXCMD_STATUS_PROTOERR);
+        }
+        return 1;
+    }
+
+    sq_pushinteger(v, RXCMD_STATUS_OK);
+    return 1;
+}
+
+/** get an integer slot from the table at stack position idx.
+    returns false if the slot does not exist or is not an integer. */
+static bool getTableInteger(HSQUIRRELVM v, SQInteger idx, const char *key, uint32_t &value)
+{
+    sq_pushstring(v, key, -1);
+    if (SQ_FAILED(sq_get(v, idx)))
+    {
+        return false;
+    }
+    SQInteger i;
+    bool ok = SQ_SUCCEEDED(sq_getinteger(v, -1, &i));
+    sq_pop(v, 1);
+    if (ok)
+    {
+        value = i;
+    }
+    return ok;
+}
+
+#define FIRMWAREIMAGE_TYPETAG ((SQUserPointer)0xBA7C0002)
+
+/** get the FirmwareImage of the instance at stack position idx */
+static FirmwareImage* getFirmwareImage(HSQUIRRELVM v, SQInteger idx)
+{
+    SQUserPointer p = 0;
+    if ((sq_gettype(v, idx) != OT_INSTANCE) ||
+        SQ_FAILED(sq_getinstanceup(v, idx, &p, FIRMWAREIMAGE_TYPETAG)))
+    {
+        return 0;
+    }
+    return (FirmwareImage*)p;
+}
+
+/** read the flash algorithm table at stack position idx */
+static bool getFlashAlgorithm(HSQUIRRELVM v, SQInteger idx, FlashAlgorithm &algo)
+{
+    const char *required[] = {"statusReg", "clearValue", "launchValue", "readyMask",
+                              "errorMask", "paramReg", "command", "addressMask"};
+    uint32_t *fields[] = {&algo.statusReg, &algo.clearValue, &algo.launchValue, &algo.readyMask,
+                          &algo.errorMask, &algo.paramReg, &algo.command, &algo.addressMask};
+    for(size_t i=0; i<sizeof(fields)/sizeof(fields[0]); i++)
+    {
+        if (!getTableInteger(v, idx, required[i], *fields[i]))
+        {
+            printfunc(v, "Error: flashImage algorithm has no integer '%s'\n", required[i]);
+            return false;
+        }
+    }
+
+    // optional fields
+    algo.programSize = 4;
+    algo.baseAddress = 0;
+    algo.skipErased = true;
+    algo.verifySize = 0;
+    getTableInteger(v, idx, "programSize", algo.programSize);
+    getTableInteger(v, idx, "baseAddress", algo.baseAddress);
+    getTableInteger(v, idx, "verifySize", algo.verifySize);
+    sq_pushstring(v, "skipErased", -1);
+    if (SQ_SUCCEEDED(sq_get(v, idx)))
+    {
+        SQBool b;
+        sq_tobool(v, -1, &b);
+        algo.skipErased = (b == SQTrue);
+        sq_pop(v, 1);
+    }
+    return true;
+}
+
+/** Split a firmware image into the parts that are programmed
+    with one call of the flash engine. Segments that share a
+    programming unit are combined into one part, with erased
+    bytes in between; the combined data is kept in buffers.
+*/
+static void getImageParts(const FirmwareImage *image, const FlashAlgorithm &algo,
+    std::vector<PacketStream::Part> &parts, std::vector< std::vector<uint8_t> > &buffers)
+{
+    const std::vector<FirmwareImage::Segment> &segs = image->segments();
+    uint32_t unitBytes = (algo.programSize != 0) ? algo.programSize : 4;
+    size_t combined = 0;
+    for(size_t i=0; i<segs.size(); i++)
+    {
+        for(size_t k=i+1; (k < segs.size()) &&
+              ((segs[k-1].address + segs[k-1].size - 1) / unitBytes >= segs[k].address / unitBytes); k++)
+        {
+            combined++;
+        }
+    }
+    buffers.reserve(combined);   // the parts point into the buffers
+
+    size_t i = 0;
+    while(i < segs.size())
+    {
+        // find the segments that end in the unit where the next one starts
+        size_t last = i;
+        while((last+1 < segs.size()) &&
+              ((segs[last].address + segs[last].size - 1) / unitBytes >= segs[last+1].address / unitBytes))
+        {
+            last++;
+        }
+
+        PacketStream::Part part;
+        part.algo = algo;
+        part.algo.baseAddress = algo.baseAddress + segs[i].address;
+        if (last == i)
+        {
+            part.data = segs[i].data;
+            part.bytes = segs[i].size;
+            part.imageBytes = segs[i].size;
+        }
+        else
+        {
+            // combine the segments with erased bytes in between
+            uint32_t start = segs[i].address;
+            buffers.push_back(std::vector<uint8_t>(segs[last].address + segs[last].size - start, 0xFF));
+            std::vector<uint8_t> &buffer = buffers.back();
+            part.imageBytes = 0;
+            for(size_t k=i; k<=last; k++)
+            {
+                memcpy(&buffer[segs[k].address - start], segs[k].data, segs[k].size);
+                part.imageBytes += segs[k].size;
+            }
+            part.data = &buffer[0];
+            part.bytes = buffer.size();
+        }
+        parts.push_back(part);
+        i = last + 1;
+    }
+}
+
+/** program the segments of a firmware image */
+static bool flashSegments(Session *session, const FirmwareImage *image, const FlashAlgorithm &algo,
+    std::string &error)
+{
+    std::vector<PacketStream::Part> parts;
+    std::vector< std::vector<uint8_t> > buffers;
+    getImageParts(image, algo, parts, buffers);
+    for(size_t i=0; i<parts.size(); i++)
+    {
+        const PacketStream::Part &part = parts[i];
+        if (part.imageBytes == part.bytes)
+        {
+            if (!FlashEngine::program(session->hw, part.algo, part.data, part.bytes, error, &session->progress,
+                &session->flashStats))
+            {
+                return false;
+            }
+        }
+        else
+        {
+            // the gaps are not part of the image
+            if (!FlashEngine::program(session->hw, part.algo, part.data, part.bytes, error, 0, &session->flashStats))
+            {
+                return false;
+            }
+            session->progress.advance(part.imageBytes);
+        }
+    }
+    return true;
+}
+
+SQInteger flashImage(HSQUIRRELVM v)
+{
+    Session *session = Session::get(v);
+    SQInteger nargs = sq_gettop(v);  // get number of arguments
+
+    if (nargs != 3)
+    {
+        printfunc(v, "Error: flashImage does not have enough parameters\n");
+        return 0;
+    }
+
+    SQUserPointer data = 0;
+    FirmwareImage *image = getFirmwareImage(v, 2);
+    if (((image == 0) && SQ_FAILED(sqstd_getblob(v, 2, &data))) || (sq_gettype(v, 3) != OT_TABLE))
+    {
+        printfunc(v, "Error: flashImage expects a blob or FirmwareImage and an algorithm table\n");
+        return 0;
+    }
+
+    FlashAlgorithm algo;
+    if (!getFlashAlgorithm(v, 3, algo))
+    {
+        return 0;
+    }
+
+    bool ok;
+    std::string error;
+    if (image != 0)
+    {
+        ok = flashSegments(session, image, algo, error);
+    }
+    else
+    {
+        ok = FlashEngine::program(session->hw, algo, (const uint8_t*)data, sqstd_getblobsize(v, 2), error,
+            &session->progress, &session->flashStats);
+    }
+    if (!ok)
+    {
+        printfunc(v, "%sError: %s\n", session->progress.isActive() ? "\n" : "", error.c_str());
+    }
+    sq_pushinteger(v, ok ? 0 : -1);
+    return 1;
+}
+
+SQInteger flashStream(HSQUIRRELVM v)
+{
+    Session *session = Session::get(v);
+    SQInteger nargs = sq_gettop(v);  // get number of arguments
+
+    if (nargs != 4)
+    {
+        printfunc(v, "Error: flashStream does not have enough parameters\n");
+        return 0;
+    }
+
+    SQUserPointer data = 0;
+    const SQChar *filename;
+    FirmwareImage *image = getFirmwareImage(v, 2);
+    if (((image == 0) && SQ_FAILED(sqstd_getblob(v, 2, &data))) || (sq_gettype(v, 3) != OT_TABLE) ||
+        SQ_FAILED(sq_getstring(v, 4, &filename)))
+    {
+        printfunc(v, "Error: flashStream expects a blob or FirmwareImage, an algorithm table and a file name\n");
+        return 0;
+    }
+
+    FlashAlgorithm algo;
+    if (!getFlashAlgorithm(v, 3, algo))
+    {
+        return 0;
+    }
+
+    InterfaceInfo info;
+    if (!session->hw->getInterfaceInfo(info))
+    {
+        printfunc(v, "Error: %s\n", session->hw->getLastError().c_str());
+        sq_pushinteger(v, -1);
+        return 1;
+    }
+
+    // the key of an image is computed once, not for every board
+    std::vector<PacketStream::Part> parts;
+    std::vector< std::vector<uint8_t> > buffers;
+    std::string algoTag = PacketStream::algorithmTag(algo);
+    uint32_t key;
+    if (image != 0)
+    {
+        if (!image->streamKey(algoTag, key))
+        {
+            getImageParts(image, algo, parts, buffers);
+            key = PacketStream::makeKey(parts);
+            image->setStreamKey(algoTag, key);
+        }
+    }
+    else
+    {
+        PacketStream::Part part;
+        part.algo = algo;
+        part.data = (const uint8_t*)data;
+        part.bytes = sqstd_getblobsize(v, 2);
+        part.imageBytes = part.bytes;
+        parts.push_back(part);
+        key = PacketStream::makeKey(parts);
+    }
+
+    // compile the stream when the file does not hold
+    // the packets of this image for this interface
+    PacketStream &stream = session->packetStream;
+    std::string error;
+    if ((stream.fileName() != filename) || !stream.matches(info, key))
+    {
+        if (!stream.load(filename, error) || !stream.matches(info, key))
+        {
+            if (!error.empty())
+            {
+                printfunc(v, "Warning: %s\n", error.c_str());
+            }
+            stream.close();
+            if (parts.empty())
+            {
+                getImageParts(image, algo, parts, buffers);
+            }
+            if (!PacketStream::compile(filename, info, key, parts, error) || !stream.load(filename, error))
+            {
+                printfunc(v, "Error: %s\n", error.empty() ? "cannot load the packet stream" : error.c_str());
+                sq_pushinteger(v, -1);
+                return 1;
+            }
+            printfunc(v, "%sCompiled %s, %d packets\n", session->progress.isActive() ? "\n" : "",
+                filename, (int)stream.packetCount());
+        }
+    }
+
+    if (!stream.replay(session->hw, &session->progress, error))
+    {
+        printfunc(v, "%sError: %s\n", session->progress.isActive() ? "\n" : "", error.c_str());
+        sq_pushinteger(v, -1);
+        return 1;
+    }
+    sq_pushinteger(v, 0);
+    return 1;
+}
+
+// *****************************************
+// ** CmdBatch class
+// *****************************************
+
+#define CMDBATCH_TYPETAG ((SQUserPointer)0xBA7C0001)
+
+static SQInteger cmdBatchRelease(SQUserPointer p, SQInteger size)
+{
+    delete (CmdBatch*)p;
+    return 1;
+}
+
+static SQInteger cmdBatchConstructor(HSQUIRRELVM v)
+{
+    CmdBatch *batch = new CmdBatch();
+    if (SQ_FAILED(sq_setinstanceup(v, 1, batch)))
+    {
+        delete batch;
+        return sq_throwerror(v, _SC("cannot create CmdBatch"));
+    }
+    sq_setreleasehook(v, 1, cmdBatchRelease);
+    return 0;
+}
+
+/** get the CmdBatch of the instance at the bottom of the stack */
+static CmdBatch* getCmdBatch(HSQUIRRELVM v)
+{
+    SQUserPointer p = 0;
+    if (SQ_FAILED(sq_getinstanceup(v, 1, &p, CMDBATCH_TYPETAG)))
+    {
+        return 0;
+    }
+    return (CmdBatch*)p;
+}
+
+#define GET_CMDBATCH(v, batch) \
+    CmdBatch *batch = getCmdBatch(v); \
+    if (batch == 0) return sq_throwerror(v, _SC("not a CmdBatch instance"));
+
+static SQInteger cmdBatchQueueUInt8(HSQUIRRELVM v)
+{
+    GET_CMDBATCH(v, batch);
+    SQInteger byte;
+    if ((sq_gettop(v) != 2) || SQ_FAILED(sq_getinteger(v, 2, &byte)))
+    {
+        printfunc(v, "Error: CmdBatch.queueUInt8 parameter is not an integer\n");
+        return 0;
+    }
+    batch->queueUInt8(byte);
+    return 0;
+}
+
+static SQInteger cmdBatchQueueUInt32(HSQUIRRELVM v)
+{
+    GET_CMDBATCH(v, batch);
+    SQInteger word;
+    if ((sq_gettop(v) != 2) || SQ_FAILED(sq_getinteger(v, 2, &word)))
+    {
+        printfunc(v, "Error: CmdBatch.queueUInt32 parameter is not an integer\n");
+        return 0;
+    }
+    batch->queueUInt32(word);
+    return 0;
+}
+
+static SQInteger cmdBatchQueueSlot(HSQUIRRELVM v)
+{
+    GET_CMDBATCH(v, batch);
+    SQInteger nargs = sq_gettop(v);
+    const SQChar *name;
+    SQInteger base = 0;
+    SQInteger mask = 0xFFFFFFFF;
+    if (((nargs != 2) && (nargs != 4)) || SQ_FAILED(sq_getstring(v, 2, &name)) ||
+        ((nargs == 4) && (SQ_FAILED(sq_getinteger(v, 3, &base)) || SQ_FAILED(sq_getinteger(v, 4, &mask)))))
+    {
+        printfunc(v, "Error: CmdBatch.queueSlot expects (name [, base, mask])\n");
+        return 0;
+    }
+    batch->queueSlot(name, base, mask);
+    return 0;
+}
+
+static SQInteger cmdBatchClear(HSQUIRRELVM v)
+{
+    GET_CMDBATCH(v, batch);
+    batch->clear();
+    return 0;
+}
+
+/** send packets built from a batch and store the
+    result packets in the result queue of the batch */
+static SQInteger cmdBatchSend(HSQUIRRELVM v, CmdBatch *batch, const std::vector< std::vector<uint8_t> > &packets)
+{
+    Session *session = Session::get(v);
+    setupOptimizer(session);
+    std::vector< std::vector<uint8_t> > optimized(packets.size());
+    for(size_t i=0; i<packets.size(); i++)
+    {
+        session->optimizer.optimize(packets[i], optimized[i]);
+    }
+
+    std::vector< std::vector<uint8_t> > results;
+    bool ok = session->hw->executePackets(optimized, results);
+
+    batch->results().clear();
+    batch->resultIndex() = 0;
+    for(size_t i=0; i<results.size(); i++)
+    {
+        batch->results().insert(batch->results().end(), results[i].begin(), results[i].end());
+    }
+
+    if (!ok)
+    {
+        // a command that failed is reported through the
+        // status byte, anything else is a communication error.
+        bool statusError = false;
+        for(size_t i=0; i<results.size(); i++)
+        {
+            if (!results[i].empty() && (results[i][0] != RXCMD_STATUS_OK))
+                statusError = true;
+        }
+        if (!statusError)
+        {
+            printfunc(v, "Error: CmdBatch %s\n", session->hw->getLastError().c_str());
+            sq_pushinteger(v, 2);   // error communicating
+            return 1;
+        }
+    }
+    sq_pushinteger(v, 0);
+    return 1;
+}
+
+static SQInteger cmdBatchExec(HSQUIRRELVM v)
+{
+    GET_CMDBATCH(v, batch);
+    const std::vector<std::string> &names = batch->slotNames();
+    SQInteger nargs = sq_gettop(v);
+    if ((nargs == 2) && (sq_gettype(v, 2) != OT_TABLE))
+    {
+        printfunc(v, "Error: CmdBatch.exec parameter is not a table\n");
+        return 0;
+    }
+    if ((nargs == 1) && !names.empty())
+    {
+        printfunc(v, "Error: CmdBatch.exec needs a table with the slot values\n");
+        return 0;
+    }
+
+    std::vector<uint32_t> values(names.size());
+    for(size_t i=0; i<names.size(); i++)
+    {
+        if (!getTableInteger(v, 2, names[i].c_str(), values[i]))
+        {
+            printfunc(v, "Error: CmdBatch.exec has no integer value for slot '%s'\n", names[i].c_str());
+            return 0;
+        }
+    }
+
+    std::vector< std::vector<uint8_t> > packets(1);
+    batch->patch(values, packets[0]);
+    return cmdBatchSend(v, batch, packets);
+}
+
+static SQInteger cmdBatchExecMany(HSQUIRRELVM v)
+{
+    GET_CMDBATCH(v, batch);
+    SQUserPointer data;
+    if ((sq_gettop(v) != 2) || SQ_FAILED(sqstd_getblob(v, 2, &data)))
+    {
+        printfunc(v, "Error: CmdBatch.execMany parameter is not a blob\n");
+        return 0;
+    }
+
+    // the blob holds one 32-bit value per slot name for
+    // every execution of the batch
+    size_t slotCount = batch->slotNames().size();
+    size_t recordBytes = 4*slotCount;
+    size_t bytes = sqstd_getblobsize(v, 2);
+    if ((recordBytes == 0) || ((bytes % recordBytes) != 0))
+    {
+        printfunc(v, "Error: CmdBatch.execMany blob size is not a multiple of %d bytes\n", (int)recordBytes);
+        return 0;
+    }
+
+    const uint8_t *ptr = (const uint8_t*)data;
+    std::vector< std::vector<uint8_t> > packets(bytes / recordBytes);
+    std::vector<uint32_t> values(slotCount);
+    for(size_t p=0; p<packets.size(); p++)
+    {
+        for(size_t i=0; i<slotCount; i++)
+        {
+            values[i] = ptr[0] | (ptr[1] << 8) | (ptr[2] << 16) | ((uint32_t)ptr[3] << 24);
+            ptr += 4;
+        }
+        batch->patch(values, packets[p]);
+    }
+    return cmdBatchSend(v, batch, packets);
+}
+
+static SQInteger cmdBatchPopUInt8(HSQUIRRELVM v)
+{
+    GET_CMDBATCH(v, batch);
+    return doPopUInt8(v, batch->results(), batch->resultIndex());
+}
+
+static SQInteger cmdBatchPopUInt32(HSQUIRRELVM v)
+{
+    GET_CMDBATCH(v, batch);
+    return doPopUInt32(v, batch->results(), batch->resultIndex());
+}
+
+static SQInteger cmdBatchPopUInt32Array(HSQUIRRELVM v)
+{
+    GET_CMDBATCH(v, batch);
+    return doPopUInt32Array(v, batch->results(), batch->resultIndex());
+}
+
+static SQInteger cmdBatchPopBlob(HSQUIRRELVM v)
+{
+    GET_CMDBATCH(v, batch);
+    return doPopBlob(v, batch->results(), batch->resultIndex());
+}
+
+static void addMethod(HSQUIRRELVM v, SQFUNCTION f, const char *fname)
+{
+    sq_pushstring(v, fname, -1);
+    sq_newclosure(v, f, 0);
+    sq_newslot(v, -3, SQFalse);
+}
+
+void registerCmdBatchClass(HSQUIRRELVM v)
+{
+    sq_pushroottable(v);
+    sq_pushstring(v, _SC("CmdBatch"), -1);
+    sq_newclass(v, SQFalse);
+    sq_settypetag(v, -1, CMDBATCH_TYPETAG);
+    addMethod(v, cmdBatchConstructor, _SC("constructor"));
+    addMethod(v, cmdBatchQueueUInt8, _SC("queueUInt8"));
+    addMethod(v, cmdBatchQueueUInt32, _SC("queueUInt32"));
+    addMethod(v, cmdBatchQueueSlot, _SC("queueSlot"));
+    addMethod(v, cmdBatchClear, _SC("clear"));
+    addMethod(v, cmdBatchExec, _SC("exec"));
+    addMethod(v, cmdBatchExecMany, _SC("execMany"));
+    addMethod(v, cmdBatchPopUInt8, _SC("popUInt8"));
+    addMethod(v, cmdBatchPopUInt32, _SC("popUInt32"));
+    addMethod(v, cmdBatchPopUInt32Array, _SC("popUInt32Array"));
+    addMethod(v, cmdBatchPopBlob, _SC("popBlob"));
+    sq_newslot(v, -3, SQFalse);
+    sq_pop(v, 1); //pops the root table
+}
+
+// *****************************************
+// ** FirmwareImage class
+// *****************************************
 
-extern HardwareInterface* g_interface;
+#define GET_FIRMWAREIMAGE(v, image) \
+    FirmwareImage *image = getFirmwareImage(v, 1); \
+    if (image == 0) return sq_throwerror(v, _SC("not a FirmwareImage instance"));
 
-std::vector<uint8_t> g_cmdQueue;        // global command queue to programmer
-std::vector<uint8_t> g_resultQueue;     // global result queue from programmer
+/** get an (address, bytes) pair of arguments that lies within a single segment */
+static const uint8_t* getImageRange(HSQUIRRELVM v, FirmwareImage *image, const char *method,
+    SQInteger &address, SQInteger &bytes)
+{
+    if ((sq_gettop(v) != 3) || SQ_FAILED(sq_getinteger(v, 2, &address)) ||
+        SQ_FAILED(sq_getinteger(v, 3, &bytes)) || (bytes < 0))
+    {
+        printfunc(v, "Error: FirmwareImage.%s expects an address and a byte count\n", method);
+        return 0;
+    }
+    const uint8_t *data = image->data(address, bytes);
+    if (data == 0)
+    {
+        printfunc(v, "Error: FirmwareImage.%s range 0x%08X..0x%08X is not inside a segment\n",
+            method, (uint32_t)address, (uint32_t)(address + bytes));
+    }
+    return data;
+}
 
-void printfunc(HSQUIRRELVM SQ_UNUSED_ARG(v),const SQChar *s,...)
+static SQInteger firmwareImageFormat(HSQUIRRELVM v)
 {
-    va_list vl;
-    va_start(vl, s);
-    scvprintf(stdout, s, vl);
-    va_end(vl);
-    (void)v; /* UNUSED */
+    GET_FIRMWAREIMAGE(v, image);
+    sq_pushstring(v, image->format(), -1);
+    return 1;
 }
 
-void errorfunc(HSQUIRRELVM SQ_UNUSED_ARG(v),const SQChar *s,...)
+static SQInteger firmwareImageTotalBytes(HSQUIRRELVM v)
 {
-    va_list vl;
-    va_start(vl, s);
-    scvprintf(stderr, s, vl);
-    va_end(vl);
+    GET_FIRMWAREIMAGE(v, image);
+    sq_pushinteger(v, image->totalBytes());
+    return 1;
 }
 
-void register_global_func(HSQUIRRELVM v, SQFUNCTION f, const char *fname)
+/** push an array of {address, size} tables */
+static void pushRanges(HSQUIRRELVM v, const std::vector<ImageScan::Range> &ranges)
 {
-    sq_pushroottable(v);
-    sq_pushstring(v,fname,-1);
-    sq_newclosure(v,f,0);
-    sq_newslot(v,-3,SQFalse);
-    sq_pop(v,1); //pops the root table
+    sq_newarray(v, 0);
+    for(size_t i=0; i<ranges.size(); i++)
+    {
+        sq_newtable(v);
+        sq_pushstring(v, _SC("address"), -1);
+        sq_pushinteger(v, ranges[i].address);
+        sq_newslot(v, -3, SQFalse);
+        sq_pushstring(v, _SC("size"), -1);
+        sq_pushinteger(v, ranges[i].bytes);
+        sq_newslot(v, -3, SQFalse);
+        sq_arrayappend(v, -2);
+    }
 }
 
-void register_global_func(HSQUIRRELVM v, SQFUNCTION f, const char *fname, SQUserPointer *userPtr)
+static SQInteger firmwareImageSegments(HSQUIRRELVM v)
 {
-    sq_pushroottable(v);
-    sq_pushstring(v,fname,-1);
-    sq_pushuserpointer(v, userPtr);
-    sq_newclosure(v,f,1);
-    sq_setparamscheck(v,1,NULL);
-    sq_newslot(v,-3,SQFalse);
-    sq_pop(v,1); //pops the root table
+    GET_FIRMWAREIMAGE(v, image);
+    const std::vector<FirmwareImage::Segment> &segs = image->segments();
+    std::vector<ImageScan::Range> ranges(segs.size());
+    for(size_t i=0; i<segs.size(); i++)
+    {
+        ranges[i].address = segs[i].address;
+        ranges[i].bytes = segs[i].size;
+    }
+    pushRanges(v, ranges);
+    return 1;
 }
 
-void compile_error_handler(HSQUIRRELVM v, const SQChar* desc, const SQChar* source, SQInteger line, SQInteger column)
+static SQInteger firmwareImageCrc32(HSQUIRRELVM v)
 {
-    printf("Error in %s:%d:%d %s\n", source, line, column, desc);
+    GET_FIRMWAREIMAGE(v, image);
+    SQInteger address, bytes;
+    const uint8_t *data = getImageRange(v, image, "crc32", address, bytes);
+    if (data == 0)
+    {
+        return 0;
+    }
+    sq_pushinteger(v, CRC32::calc(data, bytes));
+    return 1;
 }
 
-void createStringVariable(HSQUIRRELVM v, const char *varname, const char *value)
+static SQInteger firmwareImageReadUInt32(HSQUIRRELVM v)
 {
-    sq_pushroottable(v);
-    sq_pushstring(v,varname,-1);
-    sq_pushstring(v,value,-1);
-    sq_createslot(v,-3);
+    GET_FIRMWAREIMAGE(v, image);
+    SQInteger address;
+    const uint8_t *data;
+    if ((sq_gettop(v) != 2) || SQ_FAILED(sq_getinteger(v, 2, &address)) ||
+        ((data = image->data(address, 4)) == 0))
+    {
+        printfunc(v, "Error: FirmwareImage.readUInt32 address is not inside a segment\n");
+        return 0;
+    }
+    uint32_t w;
+    memcpy(&w, data, 4);    // the host is little-endian, like the target
+    sq_pushinteger(v, w);
+    return 1;
 }
 
-void createIntegerVariable(HSQUIRRELVM v,const char *varname, uint32_t value)
+static SQInteger firmwareImageToBlob(HSQUIRRELVM v)
 {
-    sq_pushroottable(v);
-    sq_pushstring(v,varname,-1);
-    sq_pushinteger(v,value);
-    sq_createslot(v,-3);
+    GET_FIRMWAREIMAGE(v, image);
+    SQInteger address, bytes;
+    const uint8_t *data = getImageRange(v, image, "toBlob", address, bytes);
+    if (data == 0)
+    {
+        return 0;
+    }
+    memcpy(sqstd_createblob(v, bytes), data, bytes);
+    return 1;
 }
 
-void createBooleanVariable(HSQUIRRELVM v, const char *varname, bool value)
+static SQInteger firmwareImageCompare(HSQUIRRELVM v)
 {
-    sq_pushroottable(v);
-    sq_pushstring(v,varname,-1);
-    sq_pushbool(v, value ? SQTrue : SQFalse);
-    sq_createslot(v,-3);
+    GET_FIRMWAREIMAGE(v, image);
+    SQInteger address;
+    SQUserPointer blobData;
+    if ((sq_gettop(v) != 3) || SQ_FAILED(sq_getinteger(v, 2, &address)) ||
+        SQ_FAILED(sqstd_getblob(v, 3, &blobData)))
+    {
+        printfunc(v, "Error: FirmwareImage.compare expects an address and a blob\n");
+        return 0;
+    }
+    SQInteger bytes = sqstd_getblobsize(v, 3);
+    const uint8_t *data = image->data(address, bytes);
+    if (data == 0)
+    {
+        printfunc(v, "Error: FirmwareImage.compare range is not inside a segment\n");
+        return 0;
+    }
+
+    const uint8_t *other = (const uint8_t*)blobData;
+    SQInteger mismatch = -1;
+    if (memcmp(data, other, bytes) != 0)
+    {
+        for(mismatch=0; data[mismatch] == other[mismatch]; mismatch++) {}
+    }
+    sq_pushinteger(v, mismatch);
+    return 1;
 }
 
-// *****************************************
-// ** CUSTOM SQUIRREL FUNCTIONS
-// *****************************************
+static SQInteger firmwareImageMismatches(HSQUIRRELVM v)
+{
+    GET_FIRMWAREIMAGE(v, image);
+    SQInteger address;
+    SQUserPointer blobData;
+    if ((sq_gettop(v) != 3) || SQ_FAILED(sq_getinteger(v, 2, &address)) ||
+        SQ_FAILED(sqstd_getblob(v, 3, &blobData)))
+    {
+        printfunc(v, "Error: FirmwareImage.mismatches expects an address and a blob\n");
+        return 0;
+    }
+    SQInteger bytes = sqstd_getblobsize(v, 3);
+    const uint8_t *data = image->data(address, bytes);
+    if (data == 0)
+    {
+        printfunc(v, "Error: FirmwareImage.mismatches range is not inside a segment\n");
+        return 0;
+    }
 
-SQInteger quit(HSQUIRRELVM v)
+    std::vector<ImageScan::Range> ranges;
+    ImageScan::findMismatches(data, (const uint8_t*)blobData, bytes, address, ranges);
+    pushRanges(v, ranges);
+    return 1;
+}
+
+static SQInteger firmwareImageDataRuns(HSQUIRRELVM v)
 {
-    int *done;
-    sq_getuserpointer(v,-1,(SQUserPointer*)&done);
-    *done=1;
-    return 0;
+    GET_FIRMWAREIMAGE(v, image);
+    SQInteger nargs = sq_gettop(v);
+    SQInteger unitBytes;
+    SQInteger sectorBytes = 0;
+    if (((nargs != 2) && (nargs != 3)) || SQ_FAILED(sq_getinteger(v, 2, &unitBytes)) ||
+        ((nargs == 3) && SQ_FAILED(sq_getinteger(v, 3, &sectorBytes))) ||
+        (unitBytes <= 0) || ((unitBytes & (unitBytes-1)) != 0) ||
+        (sectorBytes < 0) || ((sectorBytes & (sectorBytes-1)) != 0))
+    {
+        printfunc(v, "Error: FirmwareImage.dataRuns expects a unit size [, sector size], both powers of 2\n");
+        return 0;
+    }
+
+    std::vector<ImageScan::Range> runs;
+    const std::vector<FirmwareImage::Segment> &segs = image->segments();
+    for(size_t i=0; i<segs.size(); i++)
+    {
+        ImageScan::findDataRuns(segs[i].data, segs[i].size, segs[i].address, unitBytes, sectorBytes, runs);
+    }
+    pushRanges(v, runs);
+    return 1;
 }
 
+void registerFirmwareImageClass(HSQUIRRELVM v)
+{
+    sq_pushroottable(v);
+    sq_pushstring(v, _SC("FirmwareImage"), -1);
+    sq_newclass(v, SQFalse);
+    sq_settypetag(v, -1, FIRMWAREIMAGE_TYPETAG);
+    addMethod(v, firmwareImageFormat, _SC("format"));
+    addMethod(v, firmwareImageTotalBytes, _SC("totalBytes"));
+    addMethod(v, firmwareImageSegments, _SC("segments"));
+    addMethod(v, firmwareImageCrc32, _SC("crc32"));
+    addMethod(v, firmwareImageReadUInt32, _SC("readUInt32"));
+    addMethod(v, firmwareImageToBlob, _SC("toBlob"));
+    addMethod(v, firmwareImageCompare, _SC("compare"));
+    addMethod(v, firmwareImageMismatches, _SC("mismatches"));
+    addMethod(v, firmwareImageDataRuns, _SC("dataRuns"));
+    sq_newslot(v, -3, SQFalse);
+    sq_pop(v, 1); //pops the root table
+}
 
-/** Squirrel command: queue uint8_t in the command queue*/
-SQInteger queueUInt8(HSQUIRRELVM v)
+static SQInteger firmwareImageRelease(SQUserPointer p, SQInteger size)
 {
-    SQInteger nargs = sq_gettop(v);  // get number of arguments
+    FirmwareImage::release((FirmwareImage*)p);
+    return 1;
+}
 
-    if (nargs != 2)
+SQInteger loadImage(HSQUIRRELVM v)
+{
+    const SQChar *filename;
+    if ((sq_gettop(v) != 2) || SQ_FAILED(sq_getstring(v, 2, &filename)))
     {
-        printf("Error: queueUint8 does not have enough parameters\n");
-        return 0;   // error, not enough
+        printfunc(v, "Error: loadImage parameter is not a file name\n");
+        return 0;
     }
 
-    SQInteger byte;
-    if (SQ_SUCCEEDED(sq_getinteger(v, -1, &byte)))
+    FirmwareImage *image = FirmwareImage::get(filename);
+    if (image == 0)
     {
-        g_cmdQueue.push_back(byte);
+        printfunc(v, "Error: %s\n", FirmwareImage::lastError().c_str());
+        sq_pushnull(v);
+        return 1;
     }
-    else
+
+    // the image is owned by the cache, the instance
+    // gives its reference back when it is released.
+    sq_pushroottable(v);
+    sq_pushstring(v, _SC("FirmwareImage"), -1);
+    if (SQ_FAILED(sq_get(v, -2)) || SQ_FAILED(sq_createinstance(v, -1)))
     {
-        printf("Error: queueUint8 parameter is not an integer\n");
+        FirmwareImage::release(image);
+        return sq_throwerror(v, _SC("FirmwareImage class is not registered"));
     }
-    return 0;   // no parameters returned
+    sq_setinstanceup(v, -1, image);
+    sq_setreleasehook(v, -1, firmwareImageRelease);
+    return 1;
 }
 
+// *****************************************
+// ** TargetDriver class
+// *****************************************
+
+#define TARGETDRIVER_TYPETAG ((SQUserPointer)0xBA7C0003)
 
-/** Squirrel command: queue uint32_t int the command queue*/
-SQInteger queueUInt32(HSQUIRRELVM v)
+#define GET_TARGETDRIVER(v, driver) \
+    const SwaggerTargetDriver *driver = getTargetDriver(v, 1); \
+    if (driver == 0) return sq_throwerror(v, _SC("not a TargetDriver instance"));
+
+/** get the driver of the TargetDriver instance at stack position idx */
+static const SwaggerTargetDriver* getTargetDriver(HSQUIRRELVM v, SQInteger idx)
 {
-    SQInteger nargs = sq_gettop(v);  // get number of arguments
+    SQUserPointer p = 0;
+    if ((sq_gettype(v, idx) != OT_INSTANCE) ||
+        SQ_FAILED(sq_getinstanceup(v, idx, &p, TARGETDRIVER_TYPETAG)))
+    {
+        return 0;
+    }
+    return (const SwaggerTargetDriver*)p;
+}
 
-    if (nargs != 2)
+/** push the result of a driver function, or throw an
+    error if the driver does not implement it */
+static SQInteger pushDriverResult(HSQUIRRELVM v, bool implemented, int result)
+{
+    if (!implemented)
     {
-        printf("Error: queueUint32 does not have enough parameters\n");
-        return 0;   // error, not enough
+        return sq_throwerror(v, _SC("the driver does not implement this function"));
     }
+    sq_pushinteger(v, result);
+    return 1;
+}
 
-    SQInteger word;
-    if (SQ_SUCCEEDED(sq_getinteger(v, -1, &word)))
+/** call the program or verify function of a driver
+    with the FirmwareImage argument */
+static SQInteger callDriverImageFunc(HSQUIRRELVM v, const SwaggerTargetDriver *driver,
+    int (*func)(void*, const SwaggerHost*, const SwaggerImage*), const char *method)
+{
+    FirmwareImage *image = getFirmwareImage(v, 2);
+    if ((sq_gettop(v) != 2) || (image == 0))
     {
-        g_cmdQueue.push_back(word & 0xFF); // LSB first
-        g_cmdQueue.push_back((word>>8) & 0xFF);
-        g_cmdQueue.push_back((word>>16) & 0xFF);
-        g_cmdQueue.push_back((word>>24) & 0xFF);
+        printfunc(v, "Error: TargetDriver.%s expects a FirmwareImage\n", method);
+        return 0;
     }
-    else
+    if (func == 0)
     {
-        printf("Error: queueUint32 parameter is not an integer\n");
+        return pushDriverResult(v, false, 0);
     }
-    return 0;   // no parameters returned
+
+    const std::vector<FirmwareImage::Segment> &segments = image->segments();
+    std::vector<SwaggerSegment> segs(segments.size());
+    for(size_t i=0; i<segments.size(); i++)
+    {
+        segs[i].address = segments[i].address;
+        segs[i].size = segments[i].size;
+        segs[i].data = segments[i].data;
+    }
+    SwaggerImage swaggerImage;
+    swaggerImage.segments = segs.empty() ? 0 : &segs[0];
+    swaggerImage.segmentCount = segs.size();
+    return pushDriverResult(v, true, func(driver->context, TargetPlugin::host(v), &swaggerImage));
 }
 
+static SQInteger targetDriverName(HSQUIRRELVM v)
+{
+    GET_TARGETDRIVER(v, driver);
+    sq_pushstring(v, driver->name, -1);
+    return 1;
+}
 
-/** Squirrel command: execute command queue */
-SQInteger executeCmdQueue(HSQUIRRELVM v)
+static SQInteger targetDriverIDCode(HSQUIRRELVM v)
 {
-    // no arguments required
-    if (g_interface->writePacket(g_cmdQueue)==false)
+    GET_TARGETDRIVER(v, driver);
+    sq_pushinteger(v, driver->idcode);
+    return 1;
+}
+
+static SQInteger targetDriverHas(HSQUIRRELVM v)
+{
+    GET_TARGETDRIVER(v, driver);
+    const SQChar *name;
+    if ((sq_gettop(v) != 2) || SQ_FAILED(sq_getstring(v, 2, &name)))
     {
-        printf("Error: writePacket %s\n", g_interface->getLastError().c_str());
-        sq_pushinteger(v, 1);
-        // error transmitting
+        printfunc(v, "Error: TargetDriver.has parameter is not a function name\n");
+        return 0;
     }
-    g_resultQueue.clear();
-    if (g_interface->readPacket(g_resultQueue)==false)
+    bool has = false;
+    if (strcmp(name, "check") == 0) has = (driver->check != 0);
+    else if (strcmp(name, "halt") == 0) has = (driver->halt != 0);
+    else if (strcmp(name, "reset") == 0) has = (driver->reset != 0);
+    else if (strcmp(name, "erase") == 0) has = (driver->erase != 0);
+    else if (strcmp(name, "program") == 0) has = (driver->program != 0);
+    else if (strcmp(name, "verify") == 0) has = (driver->verify != 0);
+    sq_pushbool(v, has ? SQTrue : SQFalse);
+    return 1;
+}
+
+static SQInteger targetDriverCheck(HSQUIRRELVM v)
+{
+    GET_TARGETDRIVER(v, driver);
+    return pushDriverResult(v, driver->check != 0,
+        driver->check ? driver->check(driver->context, TargetPlugin::host(v)) : 0);
+}
+
+static SQInteger targetDriverHalt(HSQUIRRELVM v)
+{
+    GET_TARGETDRIVER(v, driver);
+    return pushDriverResult(v, driver->halt != 0,
+        driver->halt ? driver->halt(driver->context, TargetPlugin::host(v)) : 0);
+}
+
+static SQInteger targetDriverReset(HSQUIRRELVM v)
+{
+    GET_TARGETDRIVER(v, driver);
+    SQInteger state;
+    if ((sq_gettop(v) != 2) || SQ_FAILED(sq_getinteger(v, 2, &state)))
     {
-        printf("Error: readPacket %s\n", g_interface->getLastError().c_str());
-        sq_pushinteger(v, 2);
-        // error receiving
+        printfunc(v, "Error: TargetDriver.reset parameter is not an integer\n");
+        return 0;
     }
-    sq_pushinteger(v, 0);
-    return 1;   // result code
+    return pushDriverResult(v, driver->reset != 0,
+        driver->reset ? driver->reset(driver->context, TargetPlugin::host(v), state) : 0);
 }
 
+static SQInteger targetDriverErase(HSQUIRRELVM v)
+{
+    GET_TARGETDRIVER(v, driver);
+    return pushDriverResult(v, driver->erase != 0,
+        driver->erase ? driver->erase(driver->context, TargetPlugin::host(v)) : 0);
+}
 
-/** Squirrel command: pop uint8_t from result queue */
-SQInteger popUInt8(HSQUIRRELVM v)
+static SQInteger targetDriverProgram(HSQUIRRELVM v)
+{
+    GET_TARGETDRIVER(v, driver);
+    return callDriverImageFunc(v, driver, driver->program, "program");
+}
+
+static SQInteger targetDriverVerify(HSQUIRRELVM v)
+{
+    GET_TARGETDRIVER(v, driver);
+    return callDriverImageFunc(v, driver, driver->verify, "verify");
+}
+
+void registerTargetDriverClass(HSQUIRRELVM v)
+{
+    sq_pushroottable(v);
+    sq_pushstring(v, _SC("TargetDriver"), -1);
+    sq_newclass(v, SQFalse);
+    sq_settypetag(v, -1, TARGETDRIVER_TYPETAG);
+    addMethod(v, targetDriverName, _SC("name"));
+    addMethod(v, targetDriverIDCode, _SC("idcode"));
+    addMethod(v, targetDriverHas, _SC("has"));
+    addMethod(v, targetDriverCheck, _SC("check"));
+    addMethod(v, targetDriverHalt, _SC("halt"));
+    addMethod(v, targetDriverReset, _SC("reset"));
+    addMethod(v, targetDriverErase, _SC("erase"));
+    addMethod(v, targetDriverProgram, _SC("program"));
+    addMethod(v, targetDriverVerify, _SC("verify"));
+    sq_newslot(v, -3, SQFalse);
+    sq_pop(v, 1); //pops the root table
+}
+
+SQInteger loadTargetPlugin(HSQUIRRELVM v)
 {
-    if (g_resultQueue.size() > 0)
+    const SQChar *filename;
+    if ((sq_gettop(v) != 2) || SQ_FAILED(sq_getstring(v, 2, &filename)))
+    {
+        printfunc(v, "Error: loadTargetPlugin parameter is not a file name\n");
+        return 0;
+    }
+
+    TargetPlugin *plugin = TargetPlugin::load(filename);
+    if (plugin == 0)
     {
-        uint8_t byte = g_resultQueue.front();
-        g_resultQueue.erase(g_resultQueue.begin());
-        sq_pushinteger(v, byte);
+        printfunc(v, "Error: %s\n", TargetPlugin::lastError().c_str());
+        sq_pushnull(v);
+        return 1;
     }
-    else
+
+    // the drivers are owned by the plugin, so the
+    // instances have no release hook.
+    const std::vector<const SwaggerTargetDriver*> &drivers = plugin->drivers();
+    sq_newarray(v, 0);
+    sq_pushroottable(v);
+    sq_pushstring(v, _SC("TargetDriver"), -1);
+    if (SQ_FAILED(sq_get(v, -2)))
     {
-        sq_pushinteger(v, 0);
+        return sq_throwerror(v, _SC("TargetDriver class is not registered"));
+    }
+    for(size_t i=0; i<drivers.size(); i++)
+    {
+        sq_createinstance(v, -1);
+        sq_setinstanceup(v, -1, (SQUserPointer)drivers[i]);
+        sq_arrayappend(v, -4);
     }
+    sq_pop(v, 2);   // pops the class and the root table
     return 1;
 }
 
-
-/** Squirrel command: pop uint32_t from result queue */
-SQInteger popUInt32(HSQUIRRELVM v)
+SQInteger setCmdOptimizer(HSQUIRRELVM v)
 {
-    if (g_resultQueue.size() > 3)
+    Session *session = Session::get(v);
+    SQInteger nargs = sq_gettop(v);  // get number of arguments
+
+    if (nargs != 2)
+    {
+        printfunc(v, "Error: setCmdOptimizer does not have enough parameters\n");
+        return 0;
+    }
+
+    SQBool enabled;
+    if (SQ_SUCCEEDED(sq_getbool(v, -1, &enabled)))
     {
-        // FIXME: ugly code, would be better with an operation
-        // that does not require freeing memory
-        uint32_t word = (uint32_t)g_resultQueue.front();   // LSB first
-        g_resultQueue.erase(g_resultQueue.begin());
-        word |= ((uint32_t)g_resultQueue.front()) << 8;
-        g_resultQueue.erase(g_resultQueue.begin());
-        word |= ((uint32_t)g_resultQueue.front()) << 16;
-        g_resultQueue.erase(g_resultQueue.begin());
-        word |= ((uint32_t)g_resultQueue.front()) << 24;
-        g_resultQueue.erase(g_resultQueue.begin());
-        sq_pushinteger(v, word);
+        session->optimizer.setEnabled(enabled == SQTrue);
     }
     else
     {
-        sq_pushinteger(v, 0);
+        printfunc(v, "Error: setCmdOptimizer parameter is not a bool\n");
     }
-    return 1;
+    return 0;
 }
 
-SQInteger dumpCmdQueue(HSQUIRRELVM v)
+SQInteger progressBegin(HSQUIRRELVM v)
 {
-    uint32_t N=g_cmdQueue.size();
-    printf("Command queue size = %d bytes\n", N);
-    for(uint32_t i=0; i<N; i++)
+    Session *session = Session::get(v);
+    const SQChar *label;
+    SQInteger totalBytes;
+    if ((sq_gettop(v) != 3) || SQ_FAILED(sq_getstring(v, 2, &label)) ||
+        SQ_FAILED(sq_getinteger(v, 3, &totalBytes)))
     {
-        printf(" %02X", g_cmdQueue[i]);
+        printfunc(v, "Error: progressBegin expects a label and a byte count\n");
+        return 0;
     }
-    printf("\n");
+    session->progress.begin(label, totalBytes);
     return 0;
 }
 
-SQInteger printLastPacketError(HSQUIRRELVM v)
+SQInteger progressAdvance(HSQUIRRELVM v)
 {
-    if (g_interface != 0)
-        printf("%s\n", g_interface->getLastError().c_str());
+    Session *session = Session::get(v);
+    SQInteger bytes;
+    if ((sq_gettop(v) != 2) || SQ_FAILED(sq_getinteger(v, 2, &bytes)))
+    {
+        printfunc(v, "Error: progressAdvance parameter is not an integer\n");
+        return 0;
+    }
+    session->progress.advance(bytes);
     return 0;
 }
 
-
-SQInteger dumpResultQueue(HSQUIRRELVM v)
+SQInteger progressEnd(HSQUIRRELVM v)
 {
-    uint32_t N=g_resultQueue.size();
-    printf("Result queue size = %d bytes\n", N);
-    for(uint32_t i=0; i<N; i++)
-    {
-        printf(" %02X", g_resultQueue[i]);
-    }
-    printf("\n");
+    Session *session = Session::get(v);
+    session->progress.end();
     return 0;
 }
 
-SQInteger clearCmdQueue(HSQUIRRELVM v)
+SQInteger benchmarkScriptCache(HSQUIRRELVM v)
 {
-    g_cmdQueue.clear();
+    Session *session = Session::get(v);
+    SQInteger rounds = 10;
+    if ((sq_gettop(v) >= 2) && SQ_FAILED(sq_getinteger(v, 2, &rounds)))
+    {
+        printfunc(v, "Error: benchmarkScriptCache parameter is not an integer\n");
+        return 0;
+    }
+    session->scriptCache.benchmark(v, rounds);
     return 0;
 }
 
-SQInteger sleep(HSQUIRRELVM v)
+SQInteger crc32(HSQUIRRELVM v)
 {
     SQInteger nargs = sq_gettop(v);  // get number of arguments
 
-    if (nargs != 2)
+    if ((nargs != 2) && (nargs != 4))
     {
-        printf("Error: sleep does not have enough parameters\n");
-        return 0;   // error, not enough
+        printfunc(v, "Error: crc32 does not have the right number of parameters\n");
+        return 0;
     }
 
-    SQInteger word;
-    if (SQ_SUCCEEDED(sq_getinteger(v, -1, &word)))
+    SQUserPointer data;
+    if (SQ_FAILED(sqstd_getblob(v, 2, &data)))
     {
-#ifdef _WIN32
-        Sleep(word);
-#else
-        struct timespec ts;
-        ts.tv_sec = word / 1000;
-        ts.tv_nsec = (word % 1000) * 1000000;
-        nanosleep(&ts, NULL);
-#endif
+        printfunc(v, "Error: crc32 parameter is not a blob\n");
+        return 0;
     }
-    else
+
+    SQInteger size = sqstd_getblobsize(v, 2);
+    SQInteger offset = 0;
+    SQInteger length = size;
+    if (nargs == 4)
     {
-        printf("Error: sleep parameter is not an integer\n");
+        if (SQ_FAILED(sq_getinteger(v, 3, &offset)) || SQ_FAILED(sq_getinteger(v, 4, &length)))
+        {
+            printfunc(v, "Error: crc32 offset and length must be integers\n");
+            return 0;
+        }
+        if ((offset < 0) || (length < 0) || (offset + length > size))
+        {
+            printfunc(v, "Error: crc32 range is outside the blob\n");
+            return 0;
+        }
     }
-    return 0;   // no parameters returned
+
+    sq_pushinteger(v, CRC32::calc((const uint8_t*)data + offset, length));
+    return 1;
 }
 
 
@@ -293,6 +2113,7 @@ SQInteger sleep(HSQUIRRELVM v)
    */
 SQInteger targetReset(HSQUIRRELVM v)
 {
+    Session *session = Session::get(v);
     SQInteger nargs = sq_gettop(v);  // get number of arguments
 
     if (nargs != 2)
@@ -301,10 +2122,10 @@ SQInteger targetReset(HSQUIRRELVM v)
     SQInteger vReset;
     if (SQ_SUCCEEDED(sq_getinteger(v, -1, &vReset)))
     {
-        if (g_interface != 0)
+        if (session->hw != 0)
         {
             //TODO: error checking..
-            g_interface->setTargetReset(vReset > 0);
+            session->hw->setTargetReset(vReset > 0);
         }
         else
         {
@@ -324,16 +2145,17 @@ SQInteger targetReset(HSQUIRRELVM v)
    */
 SQInteger targetConnect(HSQUIRRELVM v)
 {
+    Session *session = Session::get(v);
     SQInteger nargs = sq_gettop(v);  // get number of arguments
 
-    if (g_interface == 0)
+    if (session->hw == 0)
     {
         printf("Error: can't connect - open an interface first!");
         return 0;
     }
 
     uint32_t idcode;
-    HWResult result = g_interface->connect(idcode);
+    HWResult result = session->hw->connect(idcode);
 
     // create a table as a return argument
     sq_newtable(v);
@@ -359,9 +2181,10 @@ SQInteger targetConnect(HSQUIRRELVM v)
 */
 SQInteger readDP(HSQUIRRELVM v)
 {
+    Session *session = Session::get(v);
     SQInteger nargs = sq_gettop(v);  // get number of arguments
 
-    if (g_interface == 0)
+    if (session->hw == 0)
     {
         printf("Error: can't connect - open an interface first!");
         return 0;
@@ -381,7 +2204,7 @@ SQInteger readDP(HSQUIRRELVM v)
     }
 
     uint32_t my_data;
-    HWResult result = g_interface->readDP(address, my_data);
+    HWResult result = session->hw->readDP(address, my_data);
 
     // create a table as a return argument
     sq_newtable(v);
@@ -403,9 +2226,10 @@ SQInteger readDP(HSQUIRRELVM v)
 */
 SQInteger writeDP(HSQUIRRELVM v)
 {
+    Session *session = Session::get(v);
     SQInteger nargs = sq_gettop(v);  // get number of arguments
 
-    if (g_interface == 0)
+    if (session->hw == 0)
     {
         printf("Error: can't connect - open an interface first!");
         return 0;
@@ -431,7 +2255,7 @@ SQInteger writeDP(HSQUIRRELVM v)
 
     //printf("%d %d\n", address, data);
 
-    HWResult result = g_interface->writeDP(address, data);
+    HWResult result = session->hw->writeDP(address, data);
 
     // create a table as a return argument
     sq_newtable(v);
@@ -451,9 +2275,10 @@ SQInteger writeDP(HSQUIRRELVM v)
 */
 SQInteger readAP(HSQUIRRELVM v)
 {
+    Session *session = Session::get(v);
     SQInteger nargs = sq_gettop(v);  // get number of arguments
 
-    if (g_interface == 0)
+    if (session->hw == 0)
     {
         printf("Error: can't connect - open an interface first!");
         return 0;
@@ -473,7 +2298,7 @@ SQInteger readAP(HSQUIRRELVM v)
     }
 
     uint32_t my_data;
-    HWResult result = g_interface->readAP(address, my_data);
+    HWResult result = session->hw->readAP(address, my_data);
 
     // create a table as a return argument
     sq_newtable(v);
@@ -495,9 +2320,10 @@ SQInteger readAP(HSQUIRRELVM v)
 */
 SQInteger writeAP(HSQUIRRELVM v)
 {
+    Session *session = Session::get(v);
     SQInteger nargs = sq_gettop(v);  // get number of arguments
 
-    if (g_interface == 0)
+    if (session->hw == 0)
     {
         printf("Error: can't connect - open an interface first!");
         return 0;
@@ -521,7 +2347,7 @@ SQInteger writeAP(HSQUIRRELVM v)
         return 0;
     }
 
-    HWResult result = g_interface->writeAP(address, data);
+    HWResult result = session->hw->writeAP(address, data);
 
     // create a table as a return argument
     sq_newtable(v);
@@ -542,9 +2368,10 @@ SQInteger writeAP(HSQUIRRELVM v)
 */
 SQInteger readMemory(HSQUIRRELVM v)
 {
+    Session *session = Session::get(v);
     SQInteger nargs = sq_gettop(v);  // get number of arguments
 
-    if (g_interface == 0)
+    if (session->hw == 0)
     {
         printf("Error: can't connect - open an interface first!");
         return 0;
@@ -561,7 +2388,7 @@ SQInteger readMemory(HSQUIRRELVM v)
     }
 
     uint32_t my_data;
-    HWResult result = g_interface->readMemory(address, my_data);
+    HWResult result = session->hw->readMemory(address, my_data);
 
     // create a table as a return argument
     sq_newtable(v);
@@ -583,9 +2410,10 @@ SQInteger readMemory(HSQUIRRELVM v)
 */
 SQInteger writeMemory(HSQUIRRELVM v)
 {
+    Session *session = Session::get(v);
     SQInteger nargs = sq_gettop(v);  // get number of arguments
 
-    if (g_interface == 0)
+    if (session->hw == 0)
     {
         printf("Error: can't connect - open an interface first!");
         return 0;
@@ -606,7 +2434,7 @@ SQInteger writeMemory(HSQUIRRELVM v)
         return 0;
     }
 
-    HWResult result = g_interface->writeMemory(address, data);
+    HWResult result = session->hw->writeMemory(address, data);
 
     // create a table as a return argument
     sq_newtable(v);
@@ -623,12 +2451,23 @@ SQInteger writeMemory(HSQUIRRELVM v)
 
 
 
-bool doScript(HSQUIRRELVM v, const char *fileName)
+bool doScript(HSQUIRRELVM v, const char *fileName, SQInteger *result)
 {
+    Session *session = Session::get(v);
     //sq_pushroottable(v);
 
-    if (SQ_SUCCEEDED(sqstd_dofile(v, fileName, SQFalse, SQTrue)))
+    if (SQ_SUCCEEDED(session->scriptCache.doFile(v, fileName, result != 0, true)))
     {
+        if (result != 0)
+        {
+            // a script that returns nothing succeeded
+            *result = 0;
+            if (sq_gettype(v, -1) != OT_NULL)
+            {
+                sq_getinteger(v, -1, result);
+            }
+            sq_poptop(v);
+        }
         return true;
     }
     return false;
@@ -35,9 +35,11 @@
 #include <vector>
 #include <stdarg.h>
 
-void printfunc(HSQUIRRELVM SQ_UNUSED_ARG(v),const SQChar *s,...);
+/** print functions of the VM, they print through the
+    session of the VM when it has one, see session.h */
+void printfunc(HSQUIRRELVM v,const SQChar *s,...);
 
-void errorfunc(HSQUIRRELVM SQ_UNUSED_ARG(v),const SQChar *s,...);
+void errorfunc(HSQUIRRELVM v,const SQChar *s,...);
 
 void register_global_func(HSQUIRRELVM v, SQFUNCTION f, const char *fname);
 
@@ -55,8 +57,51 @@ void createIntegerVariable(HSQUIRRELVM v, const char *varname, uint32_t value);
 
 void createBooleanVariable(HSQUIRRELVM v, const char *varname, bool value);
 
-/** Execute a squirrel script */
-bool doScript(HSQUIRRELVM v, const char *fileName);
+/** register the CmdBatch class, a prepared command
+    batch with named argument slots:
+      b = CmdBatch();
+      b.queueUInt8(x), b.queueUInt32(x)
+      b.queueSlot(name [, base, mask])  - argument slot
+      b.exec({name=value, ..})         - patch the slots and execute
+      b.execMany(blob)                 - execute once for every record of
+                                         slot values (u32, in slot order)
+      b.popUInt8(), b.popUInt32(), b.popUInt32Array(n), b.popBlob(n)
+      b.clear()
+*/
+void registerCmdBatchClass(HSQUIRRELVM v);
+
+/** register the FirmwareImage class, a read-only view of a
+    firmware file, see loadImage:
+      img.format()                     - "bin", "hex", "srec" or "elf"
+      img.segments()                   - array of {address, size}
+      img.totalBytes()
+      img.crc32(address, bytes)        - CRC32 of the image data
+      img.readUInt32(address)
+      img.compare(address, blob)       - offset of the first difference, or -1
+      img.mismatches(address, blob)    - array of {address, size} of the words
+                                         that differ
+      img.dataRuns(unit [, sector])    - array of {address, size} of the runs
+                                         of non-blank units
+      img.toBlob(address, bytes)       - copy of the image data
+*/
+void registerFirmwareImageClass(HSQUIRRELVM v);
+
+/** register the TargetDriver class, a driver of a native
+    target plugin, see loadTargetPlugin:
+      d.name(), d.idcode()
+      d.has(function)                  - true if the driver implements
+                                         check, halt, reset, erase,
+                                         program or verify
+      d.check(), d.halt(), d.reset(state), d.erase()
+      d.program(image), d.verify(image) - image is a FirmwareImage
+    The functions return 0 on success, -1 on failure.
+*/
+void registerTargetDriverClass(HSQUIRRELVM v);
+
+/** Execute a squirrel script. If result is not NULL, it
+    gets the integer the script returns, 0 if it returns
+    nothing. */
+bool doScript(HSQUIRRELVM v, const char *fileName, SQInteger *result = 0);
 
 // *****************************************
 // ** CUSTOM SQUIRREL FUNCTIONS
@@ -75,12 +120,41 @@ SQInteger queueUInt32(HSQUIRRELVM v);
 /** Squirrel command: execute command queue */
 SQInteger executeCmdQueue(HSQUIRRELVM v);
 
+/** Squirrel command: send the command queue without waiting
+    for the result, returns a handle or 0 on error */
+SQInteger executeAsync(HSQUIRRELVM v);
+
+/** Squirrel command: asyncReady(handle)
+    returns true if the result of handle has been received */
+SQInteger asyncReady(HSQUIRRELVM v);
+
+/** Squirrel command: receive the oldest outstanding result,
+    returns its handle or 0 if nothing was received */
+SQInteger asyncReceiveNext(HSQUIRRELVM v);
+
+/** Squirrel command: drop the results that were never
+    awaited, the handles become invalid */
+SQInteger asyncDiscard(HSQUIRRELVM v);
+
+/** Squirrel command: awaitResult(handle)
+    waits for the result of handle and moves it to the
+    result queue. Returns 0 if ok, like executeCmdQueue. */
+SQInteger awaitResult(HSQUIRRELVM v);
+
 /** Squirrel command: pop uint8_t from result queue */
 SQInteger popUInt8(HSQUIRRELVM v);
 
 /** Squirrel command: pop uint32_t from result queue */
 SQInteger popUInt32(HSQUIRRELVM v);
 
+/** Squirrel command: popUInt32Array(n)
+    pops n uint32_t from the result queue and returns them as an array */
+SQInteger popUInt32Array(HSQUIRRELVM v);
+
+/** Squirrel command: popBlob(nbytes)
+    pops nbytes from the result queue and returns them as a blob */
+SQInteger popBlob(HSQUIRRELVM v);
+
 /** Squirrel command: dump the current command queue */
 SQInteger dumpCmdQueue(HSQUIRRELVM v);
 
@@ -96,6 +170,111 @@ SQInteger printLastPacketError(HSQUIRRELVM v);
 /** Squirrel command: sleep for a number of milliseconds */
 SQInteger sleep(HSQUIRRELVM v);
 
+/** Squirrel command: get a millisecond time stamp */
+SQInteger getMillis(HSQUIRRELVM v);
+
+/** Squirrel command: waitForInterface(maxWaitMs)
+    wait until the programming interface answers, returns
+    a table with version, rxBufSize, rxBufCount and txBufSize,
+    or null if it did not answer in time. */
+SQInteger waitForInterface(HSQUIRRELVM v);
+
+/** Squirrel command: getInterfaceInfo()
+    returns the table of waitForInterface without waiting,
+    or null if the interface did not respond. The reply of
+    the interface is cached. */
+SQInteger getInterfaceInfo(HSQUIRRELVM v);
+
+/** Make Ctrl-C request the scripts to stop instead of
+    ending the program, see stopRequested. */
+void enableStopRequests();
+
+/** Squirrel command: stopRequested()
+    returns true once Ctrl-C was pressed, if stop
+    requests are enabled. */
+SQInteger stopRequested(HSQUIRRELVM v);
+
+/** Squirrel command: readMemoryBlock(address, nbytes)
+    reads nbytes of memory and returns them as a blob,
+    or null if the read failed. */
+SQInteger readMemoryBlock(HSQUIRRELVM v);
+
+/** Squirrel command: writeMemoryBlock(address, blob)
+    writes the contents of a blob to memory and
+    returns the status code. */
+SQInteger writeMemoryBlock(HSQUIRRELVM v);
+
+/** Squirrel command: readCoreRegisters(regIDs)
+    reads the core registers in the array regIDs, waiting
+    for S_REGRDY after every register on the interface.
+    The transfers are packed into as few packets as the
+    buffers of the interface allow. Returns an array with
+    the values, or null if the read failed.
+    Only works when the core is halted. */
+SQInteger readCoreRegisters(HSQUIRRELVM v);
+
+/** Squirrel command: writeCoreRegisters(values)
+    writes the core registers of a table that maps register
+    numbers to values, packed like readCoreRegisters.
+    Returns the status code.
+    Only works when the core is halted. */
+SQInteger writeCoreRegisters(HSQUIRRELVM v);
+
+/** Squirrel command: flashImage(blob or image, algorithm)
+    programs a blob or the segments of a FirmwareImage into
+    flash using the flash controller described by the algorithm
+    table, see flashengine.h. The baseAddress of the algorithm
+    is added to the image addresses.
+    returns 0 if ok, else -1. */
+SQInteger flashImage(HSQUIRRELVM v);
+
+/** Squirrel command: flashStream(blob or image, algorithm, filename)
+    programs like flashImage, but replays the precompiled packets
+    of the packet stream file, see packetstream.h. The stream is
+    compiled first when the file does not hold the packets of
+    this image, algorithm and programming interface.
+    returns 0 if ok, else -1. */
+SQInteger flashStream(HSQUIRRELVM v);
+
+/** Squirrel command: loadImage(filename)
+    loads a .bin, Intel HEX, S-record or ELF file and returns a
+    FirmwareImage, or null on error. Files are loaded once and
+    cached, so calling it again for the same file is cheap. */
+SQInteger loadImage(HSQUIRRELVM v);
+
+/** Squirrel command: loadTargetPlugin(filename)
+    loads a native target plugin, see swagger_plugin.h, and
+    returns an array of its TargetDriver instances, or null
+    if it cannot be loaded.
+*/
+SQInteger loadTargetPlugin(HSQUIRRELVM v);
+
+/** Squirrel command: setCmdOptimizer(bool)
+    enables or disables the command queue optimizer */
+SQInteger setCmdOptimizer(HSQUIRRELVM v);
+
+/** Squirrel command: progressBegin(label, totalBytes)
+    starts showing the progress of an operation. Native
+    functions such as flashImage add the bytes they process. */
+SQInteger progressBegin(HSQUIRRELVM v);
+
+/** Squirrel command: progressAdvance(bytes)
+    adds bytes to the progress of the current operation */
+SQInteger progressAdvance(HSQUIRRELVM v);
+
+/** Squirrel command: progressEnd()
+    ends the current operation and prints the statistics */
+SQInteger progressEnd(HSQUIRRELVM v);
+
+/** Squirrel command: benchmarkScriptCache([rounds])
+    compares compiling the loaded scripts with loading
+    them from the script cache */
+SQInteger benchmarkScriptCache(HSQUIRRELVM v);
+
+/** Squirrel command: crc32(blob [, offset, length])
+    returns the CRC32 of (a part of) a blob */
+SQInteger crc32(HSQUIRRELVM v);
+
 
 
 #endif
@@ -0,0 +1,214 @@
+/*
+
+  Swagger - A tool for programming ARM processors using the SWD protocol
+
+  Niels A. Moseley (c) Moseley Instruments 2016
+
+  Native target driver plugins
+
+*/
+
+#ifdef _WIN32
+#include <windows.h>    // for Sleep
+#else
+#include <time.h>       // for nanosleep
+#endif
+#include <stdio.h>
+#include <string.h>
+#include <map>
+#include <QMutex>
+#include "targetplugin.h"
+#include "hardwareinterface.h"
+#include "session.h"
+
+thread_local std::string TargetPlugin::m_lastError;
+
+static std::map<std::string, TargetPlugin*> g_plugins;
+static QMutex g_pluginsLock;    // the sessions of gang mode load plugins at the same time
+
+// *****************************************
+// ** Host services
+// *****************************************
+
+/** the context of the host is the calling VM */
+static HardwareInterface* getInterface(void *context)
+{
+    Session *session = Session::get((HSQUIRRELVM)context);
+    return (session != 0) ? session->hw : 0;
+}
+
+static int32_t hostExecute(void *context, const uint8_t *commands, uint32_t commandBytes,
+    uint8_t *results, uint32_t resultSize)
+{
+    HardwareInterface *hw = getInterface(context);
+    if (hw == 0)
+    {
+        return -1;
+    }
+
+    // the results of asynchronous packets arrive first
+    std::vector<uint8_t> packet(commands, commands + commandBytes);
+    std::vector<uint8_t> result;
+    if (!hw->flushAsync() || !hw->writePacket(packet) || !hw->readPacket(result))
+    {
+        HSQUIRRELVM v = (HSQUIRRELVM)context;
+        sq_getprintfunc(v)(v, "Error: plugin packet %s\n", hw->getLastError().c_str());
+        return -1;
+    }
+
+    size_t bytes = (result.size() < resultSize) ? result.size() : resultSize;
+    if (bytes > 0)
+    {
+        memcpy(results, &result[0], bytes);
+    }
+    return bytes;
+}
+
+static int hostGetPacketSizes(void *context, uint32_t *commandBytes, uint32_t *resultBytes)
+{
+    HardwareInterface *hw = getInterface(context);
+    InterfaceInfo info;
+    if ((hw == 0) || !hw->getInterfaceInfo(info))
+    {
+        return 0;
+    }
+    *commandBytes = info.rxBufSize;
+    *resultBytes = info.txBufSize;
+    return 1;
+}
+
+static void hostLog(void *context, int level, const char *message)
+{
+    // use the debug level of the scripts
+    HSQUIRRELVM v = (HSQUIRRELVM)context;
+    SQInteger debug = SWAGGER_LOG_INFO;
+    SQInteger top = sq_gettop(v);
+    sq_pushroottable(v);
+    sq_pushstring(v, _SC("debug"), -1);
+    if (SQ_SUCCEEDED(sq_get(v, -2)))
+    {
+        sq_getinteger(v, -1, &debug);
+    }
+    sq_settop(v, top);
+
+    if (level >= debug)
+    {
+        sq_getprintfunc(v)(v, "%s", message);
+    }
+}
+
+static void hostProgress(void *context, uint32_t bytes)
+{
+    Session *session = Session::get((HSQUIRRELVM)context);
+    if (session != 0)
+    {
+        session->progress.advance(bytes);
+    }
+}
+
+static uint32_t hostMillis(void *context)
+{
+#ifdef _WIN32
+    return GetTickCount();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+#endif
+}
+
+static void hostSleep(void *context, uint32_t ms)
+{
+#ifdef _WIN32
+    Sleep(ms);
+#else
+    struct timespec ts;
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (ms % 1000) * 1000000;
+    nanosleep(&ts, NULL);
+#endif
+}
+
+const SwaggerHost* TargetPlugin::host(HSQUIRRELVM v)
+{
+    // every session has its own host, the drivers
+    // of several sessions can run at the same time
+    Session *session = Session::get(v);
+    SwaggerHost &host = session->pluginHost;
+    host.version = SWAGGER_PLUGIN_API_VERSION;
+    host.context = v;
+    host.execute = hostExecute;
+    host.getPacketSizes = hostGetPacketSizes;
+    host.log = hostLog;
+    host.progress = hostProgress;
+    host.millis = hostMillis;
+    host.sleep = hostSleep;
+    return &host;
+}
+
+// *****************************************
+// ** Plugin loading
+// *****************************************
+
+TargetPlugin::TargetPlugin()
+{
+}
+
+TargetPlugin::~TargetPlugin()
+{
+    m_library.unload();
+}
+
+TargetPlugin* TargetPlugin::load(const std::string &filename)
+{
+    QMutexLocker lock(&g_pluginsLock);
+    std::map<std::string, TargetPlugin*>::iterator iter = g_plugins.find(filename);
+    if (iter != g_plugins.end())
+    {
+        return iter->second;
+    }
+
+    TargetPlugin *plugin = new TargetPlugin();
+    plugin->m_library.setFileName(QString::fromStdString(filename));
+    if (!plugin->m_library.load())
+    {
+        m_lastError = "cannot load plugin " + filename + ": " +
+            plugin->m_library.errorString().toStdString();
+        delete plugin;
+        return 0;
+    }
+
+    SwaggerPluginInitFunc init = (SwaggerPluginInitFunc)plugin->m_library.resolve(SWAGGER_PLUGIN_INIT);
+    if (init == 0)
+    {
+        m_lastError = "plugin " + filename + " has no " SWAGGER_PLUGIN_INIT " function";
+        delete plugin;
+        return 0;
+    }
+
+    const SwaggerTargetDriver* const *drivers = init(SWAGGER_PLUGIN_API_VERSION);
+    if (drivers == 0)
+    {
+        m_lastError = "plugin " + filename + " does not support this version of swagger";
+        delete plugin;
+        return 0;
+    }
+    for(size_t i=0; drivers[i] != 0; i++)
+    {
+        plugin->m_drivers.push_back(drivers[i]);
+    }
+
+    g_plugins[filename] = plugin;
+    return plugin;
+}
+
+void TargetPlugin::unloadAll()
+{
+    QMutexLocker lock(&g_pluginsLock);
+    std::map<std::string, TargetPlugin*>::iterator iter;
+    for(iter = g_plugins.begin(); iter != g_plugins.end(); ++iter)
+    {
+        delete iter->second;
+    }
+    g_plugins.clear();
+}
@@ -0,0 +1,69 @@
+/*
+
+  Swagger - A tool for programming ARM processors using the SWD protocol
+
+  Niels A. Moseley (c) Moseley Instruments 2016
+
+  Native target driver plugins
+
+  Loads the shared libraries described in swagger_plugin.h and
+  offers their drivers the services of the host. Plugins are
+  cached by file name and stay loaded until unloadAll(), as the
+  scripts hold on to their drivers.
+
+  In gang mode the sessions share the plugins, so a driver can
+  be called from several threads at once, each time with the
+  host of its own session.
+
+*/
+
+#ifndef targetplugin_h
+#define targetplugin_h
+
+#include <string>
+#include <vector>
+#include <QLibrary>
+#include <squirrel.h>
+#include "swagger_plugin.h"
+
+class TargetPlugin
+{
+public:
+    ~TargetPlugin();
+
+    /** Get a loaded plugin, or load it. The file name may omit
+        the platform suffix (.so, .dll). Returns NULL on error,
+        see lastError().
+    */
+    static TargetPlugin* load(const std::string &filename);
+
+    /** Unload all plugins. Drivers returned by drivers() are
+        valid until this is called. */
+    static void unloadAll();
+
+    /** get the description of the last error of load()
+        on the calling thread */
+    static std::string lastError()
+    {
+        return m_lastError;
+    }
+
+    const std::vector<const SwaggerTargetDriver*>& drivers() const
+    {
+        return m_drivers;
+    }
+
+    /** get the host services of the session of a VM
+        for a driver called from a script */
+    static const SwaggerHost* host(HSQUIRRELVM v);
+
+protected:
+    TargetPlugin();
+
+    QLibrary                                m_library;
+    std::vector<const SwaggerTargetDriver*> m_drivers;
+
+    static thread_local std::string m_lastError;
+};
+
+#endif
@@ -16,6 +16,8 @@ const LOG_WARNING   = 2;
 const LOG_INFO      = 1;
 const LOG_DEBUG     = 0;
 
+const INTERFACE_TIMEOUT_MS = 2000;  // time a programming interface gets to start
+
 // *************************************
 // global variables
 // *************************************
@@ -41,25 +43,52 @@ function initSystem()
         
         dofile(scriptDir + "targetfuncs.nut");
         dofile(scriptDir + "targets.nut");
-        dofile(scriptDir + "nxp\\kinetis.nut");
-        dofile(scriptDir + "nxp\\mkv10z.nut");
+        dofile(scriptDir + "manifest.nut");
         print("targets loaded!\n");
         
-        sleep(200); // wait for programming interface to get online
+        // an interface that resets when the port is opened
+        // needs some time before it answers. The reply is
+        // cached for getInterfaceInfo().
+        local info = waitForInterface(INTERFACE_TIMEOUT_MS);
+        if (info == null)
+        {
+            return -1;
+        }
+        logmsg(LOG_DEBUG, format("Interface protocol version %d, %d x %d bytes receive buffer\n", info.version, info.rxBufCount, info.rxBufSize));
         
-        connect();
+        if (daemon)
+        {
+            // the jobs select the target of the board
+            // that is connected when they run.
+            dofile(scriptDir + "jobs.nut");
+            logmsg(LOG_INFO, "Daemon mode...\n");
+            return 0;
+        }
+
+        if (production)
+        {
+            dofile(scriptDir + "production.nut");
+            return productionLoop();
+        }
+
+        // connect and load the scripts of the connected part
+        local target = selectTarget();
         
         if (!interactive)
         {
-            if (targets[0].flash_erase() != 0)
+            if (target == null)
+            {
+                return -1;
+            }
+            if (target.flash_erase() != 0)
             {
                 return -1;
             }
-            if (targets[0].flash_program() != 0)
+            if (target.flash_program() != 0)
             {
                 return -1;
             }
-            if (verifyFlash() != 0)
+            if (target.flash_verify() != 0)
             {
                 return -1;
             }
@@ -71,8 +100,12 @@ function initSystem()
     }
     catch(error)
     {
-        print("Error: " + error);
+        print("Error: " + error + "\n");
+        return -1;
     }
+    return 0;
 }
 
-initSystem();
+// the result is the exit code of swagger, and the
+// result of the slot in gang mode
+return initSystem();
@@ -0,0 +1,124 @@
+//
+// Daemon mode jobs
+//
+// In daemon mode swagger calls runJob for every job it
+// receives, see src/jobserver.h. The programmer stays open
+// and the scripts stay loaded between the jobs; every job
+// connects to the board that is in the fixture at that time.
+//
+// Author...: Niels A. Moseley
+// Version..: 0.1
+//
+// This is experimental!
+//
+
+// parse a decimal or 0x prefixed hex number
+function parseNumber(str)
+{
+    if ((str.len() > 2) && (str.slice(0, 2).tolower() == "0x"))
+    {
+        return str.slice(2).tointeger(16);
+    }
+    return str.tointeger();
+}
+
+// flash <file>: erase, program and verify
+function job_flash(target, args)
+{
+    ::binFile = args[1];
+    if (target.flash_erase() != 0)
+    {
+        return -1;
+    }
+    if (target.flash_program() != 0)
+    {
+        return -1;
+    }
+    return target.flash_verify();
+}
+
+// verify <file>
+function job_verify(target, args)
+{
+    ::binFile = args[1];
+    return target.flash_verify();
+}
+
+// uid: print the unique id of the part
+function job_uid(target, args)
+{
+    local uid = target.readUID();
+    if (uid == null)
+    {
+        logmsg(LOG_ERROR, "Cannot read the unique id of " + target.getName() + "\n");
+        return -1;
+    }
+    print(uid + "\n");
+    return 0;
+}
+
+// dump <address> <bytes>: print memory as hex
+function job_dump(target, args)
+{
+    local address = parseNumber(args[1]);
+    local bytes = parseNumber(args[2]);
+    local data = readMemoryBlock(address, bytes);
+    if (data == null)
+    {
+        return -1;
+    }
+    for(local offset=0; offset<bytes; offset+=16)
+    {
+        local line = format("%08X:", address + offset);
+        for(local i=offset; (i<offset+16) && (i<bytes); i++)
+        {
+            line += format(" %02X", data[i]);
+        }
+        print(line + "\n");
+    }
+    return 0;
+}
+
+jobs <- {
+    flash  = { func = job_flash,  args = 1 },
+    verify = { func = job_verify, args = 1 },
+    uid    = { func = job_uid,    args = 0 },
+    dump   = { func = job_dump,   args = 2 }
+};
+
+// run a job, args[0] is the name of the job.
+// returns 0 if ok, else -1.
+function runJob(args)
+{
+    try
+    {
+        if (!(args[0] in ::jobs))
+        {
+            logmsg(LOG_ERROR, "Unknown job " + args[0] + "\n");
+            return -1;
+        }
+        local job = ::jobs[args[0]];
+        if (args.len() != job.args + 1)
+        {
+            logmsg(LOG_ERROR, format("Job %s needs %d arguments\n", args[0], job.args));
+            return -1;
+        }
+
+        local target = selectTarget();
+        if (target == null)
+        {
+            return -1;
+        }
+        local result = job.func(target, args);
+        asyncDiscard();     // results a job did not await
+        return result;
+    }
+    catch(error)
+    {
+        print("Error: " + error + "\n");
+    }
+    asyncDiscard();
+    return -1;
+}
+
+logmsg(LOG_DEBUG, "Loaded jobs.nut\n");
@@ -19,3 +19,11 @@ function logmsg(level, str)
     if (level >= ::debug)
         print(str)
 }
+
+// show the progress of a long operation, see progressBegin.
+// Like the info messages, it is hidden at higher debug levels.
+function logProgressBegin(label, bytes)
+{
+    if (LOG_INFO >= ::debug)
+        progressBegin(label, bytes);
+}
@@ -0,0 +1,26 @@
+//
+// Target manifest
+//
+// Lists the supported parts and the scripts that support them,
+// see targets.nut for the layout of the entries.
+//
+// Author...: Niels A. Moseley
+// Version..: 0.1
+//
+// This is experimental!
+//
+
+registerManifest([
+    // Kinetis KV10Z: Cortex-M0+ with the Kinetis MDM-AP
+    {
+        name    = "KV10Z",
+        idcode  = 0x0BC11477,
+        ap      = { address = 0x010000FC, value = 0x001C0020 },  // MDM-AP IDR
+        scripts = ["nxp/kinetis.nut", "nxp/mkv10z.nut"]
+    }
+
+    // LPC13xx (IDCODE 0x2BA01477) is left out until nxp/lpc13.nut
+    // has a flash driver.
+]);
+
+logmsg(LOG_DEBUG, "Loaded manifest.nut\n");
@@ -33,6 +33,9 @@ const MDM_STAT_SLEEPING     = 0x040000;
 
 const SIM_FCFG1         = 0x4004804C;       // flash configuration reg 1
 const SIM_FCFG2         = 0x40048050;       // flash configuration reg 2
+const SIM_UIDMH         = 0x40048058;       // unique id, bits 64..79
+const SIM_UIDML         = 0x4004805C;       // unique id, bits 32..63
+const SIM_UIDL          = 0x40048060;       // unique id, bits 0..31
 
 const SIM_SCGC6         = 0x4004803C;       // clock config reg 6
 const SCGC6_FTF         = 0x1;              // flash clock gating bit
@@ -102,8 +105,12 @@ function kinetis_mdm_halt()
     if (result & MDM_STAT_COREHALTED)
     {
         logmsg(LOG_DEBUG, "Entered debug mode - core halted!\n");
-        logmsg(LOG_DEBUG, format("PC  = %08X\n", readCoreRegister(15)));
-        logmsg(LOG_DEBUG, format("MSP = %08X\n", readCoreRegister(DCRSR_REG_MSP)));   
+        local regs = readCoreRegisters([15, DCRSR_REG_MSP]);
+        if (regs != null)
+        {
+            logmsg(LOG_DEBUG, format("PC  = %08X\n", regs[0]));
+            logmsg(LOG_DEBUG, format("MSP = %08X\n", regs[1]));
+        }
     }
     else
     {
@@ -113,42 +120,120 @@ function kinetis_mdm_halt()
     return 0;
 }
 
+// description of the FTFA program longword command,
+// used by the native flashImage() engine.
+kinetis_flash_algorithm <- {
+    statusReg   = FTFA_FSTAT,
+    clearValue  = 0xFFFE0000 | FSTAT_RDCOLERR | FSTAT_ACCERR | FSTAT_FPVIOL,
+    launchValue = 0xFFFE0000 | FSTAT_CCIF,
+    readyMask   = FSTAT_CCIF,
+    errorMask   = FSTAT_RDCOLERR | FSTAT_ACCERR | FSTAT_FPVIOL | FSTAT_MGSTAT0,
+    paramReg    = FTFA_FCCOB_BASE,
+    command     = 0x06000000,       // program longword
+    addressMask = 0x00FFFFFF,
+    programSize = 4,
+    baseAddress = 0,
+    skipErased  = true,
+    verifySize  = 0                 // set for --verify-interleaved
+};
+
+const KINETIS_SECTOR_SIZE = 1024;   // flash sector of the MKV10Z32
+
+// read the unique identification registers.
+// returns the id as a hex string, or null on error.
+function kinetis_readUID()
+{
+    local uid = readMemoryWords(SIM_UIDMH, 3);
+    if (typeof uid != "array")
+    {
+        return null;
+    }
+    return format("%04X%08X%08X", uid[0] & 0xFFFF, uid[1] & 0xFFFFFFFF, uid[2] & 0xFFFFFFFF);
+}
+
+// program a blob (starting at address 0) or the
+// segments of a FirmwareImage into the flash.
+// erased (0xFFFFFFFF) words are skipped.
+// with --stream, the precompiled packets are sent.
+// with --verify-interleaved, every sector of the image,
+// erased or not, is checksummed right after it is programmed,
+// and the separate verify pass is skipped.
+// returns 0 if ok, else -1.
+function kinetis_flash_image(myblob)
+{
+    local algo = ::kinetis_flash_algorithm;
+    local info = getInterfaceInfo();
+    local interleaved = verifyInterleaved && (info != null) && (info.version >= 3);
+    if (interleaved)
+    {
+        algo = clone algo;
+        algo.verifySize = KINETIS_SECTOR_SIZE;
+    }
+
+    local result;
+    if (::streamFile != "")
+    {
+        result = flashStream(myblob, algo, ::streamFile);
+    }
+    else
+    {
+        result = flashImage(myblob, algo);
+    }
+    ::programVerified = interleaved && (result == 0);
+    return result;
+}
+
+// prepared command batch for kinetis_flash_longword,
+// built on first use.
+kinetis_flash_batch <- null;
+
 function kinetis_flash_longword(address,data)
 {
-    clearCmdQueue();
-    // clear error flags
-    queueWriteMemory(FTFA_FSTAT, 0xFFFE0000 | FSTAT_RDCOLERR | FSTAT_ACCERR | FSTAT_FPVIOL);
-    
-    // wait for the previous command to finish
-    // if there was any        
-    queuePollMemory(FTFA_FSTAT, FSTAT_CCIF);
+    if (::kinetis_flash_batch == null)
+    {
+        local batch = CmdBatch();
+        
+        // clear error flags
+        batchWriteMemory(batch, FTFA_FSTAT, 0xFFFE0000 | FSTAT_RDCOLERR | FSTAT_ACCERR | FSTAT_FPVIOL);
+        
+        // wait for the previous command to finish
+        // if there was any
+        batchPollMemory(batch, FTFA_FSTAT, FSTAT_CCIF);
+        
+        // set address and data
+        batch.queueUInt8(CMD_TYPE_WRITEMEM);
+        batch.queueUInt32(FTFA_FCCOB_BASE);
+        batch.queueSlot("address", 0x06000000, 0x00FFFFFF);
+        batchWriteMemory(batch, FTFA_FCCOB_BASE+4, "data");
+        
+        // trigger flash write command
+        batchWriteMemory(batch, FTFA_FSTAT, 0xFFFE0000 | FSTAT_CCIF);
+        // wait for the previous command to finish
+        batchPollMemory(batch, FTFA_FSTAT, FSTAT_CCIF);
+        batchReadMemory(batch, FTFA_FSTAT);
+        
+        ::kinetis_flash_batch = batch;
+    }
     
-    // set address and data
-    queueWriteMemory(FTFA_FCCOB_BASE, 0x06000000 | (address & 0x00FFFFFF));
-    queueWriteMemory(FTFA_FCCOB_BASE+4, data);
-
-    // trigger flash write command
-    queueWriteMemory(FTFA_FSTAT, 0xFFFE0000 | FSTAT_CCIF);
-    // wait for the previous command to finish
-    queuePollMemory(FTFA_FSTAT, FSTAT_CCIF);
-    queueReadMemory(FTFA_FSTAT);
+    logmsg(LOG_DEBUG, format("(%08X) <- %08X\n", address, data));
     
     // execute commands!
-    if (executeCmdQueue() != 0)
+    local batch = ::kinetis_flash_batch;
+    if (batch.exec({address = address, data = data}) != 0)
     {
         logmsg(LOG_ERROR, "ERROR: command queue execution failed\n");
         return -1;
     }
         
     // get result of operations
-    local result = popUInt8();
+    local result = batch.popUInt8();
     if (result != CMD_STATUS_OK)
     {
         logmsg(LOG_ERROR, "ERROR: flash longword failed: " + result + "\n");
         return -1;
     }
     // report error from Flash controller, if any
-    local retval = popUInt32();
+    local retval = batch.popUInt32();
     if (retval & FSTAT_MGSTAT0)
     {
         logmsg(LOG_ERROR, "Command executing error!\n");
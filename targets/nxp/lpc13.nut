@@ -10,7 +10,7 @@ class TargetLPC13 extends TargetBase
     constructor()
     {
         name = "LPC13xx"
-        idcode = 0x12345678
+        idcode = 0x2BA01477
     }
 }
 
@@ -14,7 +14,7 @@ class TargetKV10Z extends TargetBase
     constructor()
     {
         name = "KV10Z"
-        idcode = 0x11111111
+        idcode = 0x0BC11477
     }
     
     // processor identification check
@@ -123,6 +123,11 @@ class TargetKV10Z extends TargetBase
     {
         return kinetis_flasherase();
     }
+
+    function readUID()
+    {
+        return kinetis_readUID();
+    }
         
     function flash_program_longword(address, data)
     {
@@ -132,42 +137,26 @@ class TargetKV10Z extends TargetBase
     function flash_program()
     {
         logmsg(LOG_INFO, "Flashing " + binFile + "\n");
-        local myfile;
-        try
+        local image = loadImage(binFile);
+        if (image == null)
         {
-            myfile = file(binFile,"rb");
-        }
-        catch(error)
-        {
-            logmsg(LOG_ERROR, "Cannot open file " + binFile + "\n");
+            logmsg(LOG_ERROR, "Cannot load file " + binFile + "\n");
             return -1;
         }
         
-        local myblob = myfile.readblob(myfile.len());
-        logmsg(LOG_INFO, format("Binary data is %d bytes\n", myblob.len()));
-                
-        local idx = 0;
-        while(idx < myblob.len())
-        {
-            local word = myblob.readn('i');
-            logmsg(LOG_INFO, format("(%08X) <- %08X\r", idx, word));
-            
-            // program the flash but skip
-            // the all-set word, as the erased flash
-            // has these bits set already -> faster programming
-            if (word != 0xFFFFFFFF)
-            {
-                if (flash_program_longword(idx, word) != 0)
-                {
-                    logmsg(LOG_ERROR,"Flashing failed :-@\n");
-                    return -1;
-                }
-            }
-            idx += 4;
-        }        
-        myfile.close();
+        logmsg(LOG_INFO, format("Firmware (%s) is %d bytes in %d segments\n",
+            image.format(), image.totalBytes(), image.segments().len()));
         
-        logmsg(LOG_INFO, "\n");
+        // the erased flash has all bits set already, so
+        // the all-set words are skipped -> faster programming
+        logProgressBegin("Programming", image.totalBytes());
+        local result = kinetis_flash_image(image);
+        progressEnd();
+        if (result != 0)
+        {
+            logmsg(LOG_ERROR,"Flashing failed :-@\n");
+            return -1;
+        }
         
         setReset(1);
         setReset(0);
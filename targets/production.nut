@@ -0,0 +1,145 @@
+//
+// Production loop
+//
+// Programs the same image onto board after board. The loop
+// probes the fixture with a single connect every probeInterval
+// ms. When a board answers it is erased, programmed and
+// verified, and the loop waits until the board is removed
+// before it arms again. The image is loaded once, loadImage
+// keeps it in memory.
+//
+// Ctrl-C ends the loop and prints the cycle time statistics.
+//
+// Author...: Niels A. Moseley
+// Version..: 0.1
+//
+// This is experimental!
+//
+
+const REMOVED_PROBES    = 3;    // failed probes in a row before a board counts as removed
+const HISTOGRAM_BUCKETS = 10;
+const HISTOGRAM_WIDTH   = 40;   // characters of the longest bar
+
+// returns true if a board answers
+function probeBoard()
+{
+    return connect(1) != -1;
+}
+
+// erase, program and verify the board in the fixture.
+// returns 0 if ok, else -1.
+function programBoard()
+{
+    local target = selectTarget();
+    if (target == null)
+    {
+        return -1;
+    }
+    if (target.flash_erase() != 0)
+    {
+        return -1;
+    }
+    if (target.flash_program() != 0)
+    {
+        return -1;
+    }
+    return target.flash_verify();
+}
+
+// print the statistics and a histogram of cycle times in ms
+function printCycleTimes(label, times)
+{
+    if (times.len() == 0)
+    {
+        return;
+    }
+
+    local sorted = clone times;
+    sorted.sort();
+    local n = sorted.len();
+    local sum = 0;
+    foreach(t in sorted)
+    {
+        sum += t;
+    }
+    local low = sorted[0];
+    local high = sorted[n-1];
+    print(format("%s: %d boards, min %d ms, median %d ms, p95 %d ms, max %d ms, mean %d ms\n",
+        label, n, low, sorted[n/2], sorted[(n*95)/100], high, sum/n));
+
+    local width = (high - low) / HISTOGRAM_BUCKETS + 1;
+    local counts = array(HISTOGRAM_BUCKETS, 0);
+    local most = 0;
+    foreach(t in sorted)
+    {
+        local bucket = (t - low) / width;
+        counts[bucket]++;
+        if (counts[bucket] > most)
+        {
+            most = counts[bucket];
+        }
+    }
+    for(local i=0; i<HISTOGRAM_BUCKETS; i++)
+    {
+        local bar = "";
+        for(local k=0; k<(counts[i] * HISTOGRAM_WIDTH) / most; k++)
+        {
+            bar += "#";
+        }
+        print(format("  %6d - %6d ms %5d %s\n", low + i*width, low + (i+1)*width - 1, counts[i], bar));
+    }
+}
+
+// program boards until Ctrl-C is pressed.
+// returns 0 if all the boards passed, else -1.
+function productionLoop()
+{
+    local passed = [];
+    local failed = [];
+
+    logmsg(LOG_INFO, "Production loop, press Ctrl-C to stop.\n");
+    logmsg(LOG_INFO, "Waiting for a board...\n");
+    while(!stopRequested())
+    {
+        if (!probeBoard())
+        {
+            sleep(probeInterval);
+            continue;
+        }
+
+        local start = getMillis();
+        local result = programBoard();
+        local ms = getMillis() - start;
+        asyncDiscard();     // results the board did not await
+        if (result == 0)
+        {
+            passed.append(ms);
+        }
+        else
+        {
+            failed.append(ms);
+        }
+        print(format("Board %d: %s in %.2f s (%d passed, %d failed)\n", passed.len() + failed.len(),
+            (result == 0) ? "PASS" : "FAIL", ms / 1000.0, passed.len(), failed.len()));
+
+        // arm again when the board is gone
+        logmsg(LOG_INFO, "Remove the board...\n");
+        local missing = 0;
+        while(!stopRequested() && (missing < REMOVED_PROBES))
+        {
+            missing = probeBoard() ? 0 : missing + 1;
+            sleep(probeInterval);
+        }
+        if (!stopRequested())
+        {
+            logmsg(LOG_INFO, "Waiting for a board...\n");
+        }
+    }
+
+    print(format("\n%d boards: %d passed, %d failed\n", passed.len() + failed.len(), passed.len(), failed.len()));
+    printCycleTimes("Passed", passed);
+    printCycleTimes("Failed", failed);
+    return (failed.len() == 0) ? 0 : -1;
+}
+
+logmsg(LOG_DEBUG, "Loaded production.nut\n");
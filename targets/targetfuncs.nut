@@ -35,6 +35,8 @@ const CMD_TYPE_WRITEDP      = 5   // write access port register
 const CMD_TYPE_READMEM      = 6   // read a memory address
 const CMD_TYPE_WRITEMEM     = 7   // write to a memory address
 const CMD_TYPE_WAITMEMTRUE  = 8   // wait for memory contents
+const CMD_TYPE_CHECKSUMMEM  = 10  // CRC32 over a memory range
+const CMD_TYPE_GETINFO      = 0xFF  // get interface info
 
 const CMD_STATUS_OK         = 0   // command OK
 const CMD_STATUS_TIMEOUT    = 1   // command time out
@@ -71,6 +73,14 @@ const DCRSR_REG_PSP     = 0x12;
 const DCRSR_REG_IPSR    = 0x17;
 const DCRSR_REG_CONTROL = 0x1B;
 
+const VERIFY_BLOCKSIZE  = 1024;         // verify checksum block size in bytes
+const VERIFY_MAXREPORT  = 8;            // number of mismatching ranges shown
+
+// *************************************
+// global variables
+// *************************************
+
+
 // *************************************
 // Functions
 // *************************************
@@ -87,14 +97,14 @@ function setReset(state)
     executeCmdQueue();
 }
 
-// connect to the target
+// connect to the target, trying up to maxTries times.
 // it returns the IDCODE, if connect is succesful
-// or 0xFFFFFFFF if it failed
-function connect()
+// or -1 if it failed
+function connect(maxTries = 10)
 {
     local retries = 0;
     logmsg(LOG_DEBUG, "Connecting...\n");
-    while(retries < 10)
+    while(retries < maxTries)
     {
         clearCmdQueue();
         queueUInt8(CMD_TYPE_CONNECT);
@@ -183,6 +193,162 @@ function queuePollMemory(address, mask)
     queueUInt32(mask);
 }
 
+// queue a memory checksum operation
+// the number of bytes must be a multiple of 4
+function queueChecksumMemory(address, bytes)
+{
+    queueUInt8(CMD_TYPE_CHECKSUMMEM);
+    queueUInt32(address);
+    queueUInt32(bytes);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Command batch functions
+//
+// These add commands to a CmdBatch. Where noted, a value
+// can be given as a string, which creates an argument slot
+// with that name.
+////////////////////////////////////////////////////////////////////////////////
+
+// add a value or an argument slot to a batch
+function batchValue(batch, value)
+{
+    if (typeof value == "string")
+    {
+        batch.queueSlot(value);
+    }
+    else
+    {
+        batch.queueUInt32(value);
+    }
+}
+
+// add a write memory operation to a batch
+// address and value can be slot names
+function batchWriteMemory(batch, address, value)
+{
+    batch.queueUInt8(CMD_TYPE_WRITEMEM);
+    batchValue(batch, address);
+    batchValue(batch, value);
+}
+
+// add a read memory operation to a batch
+// address can be a slot name
+function batchReadMemory(batch, address)
+{
+    batch.queueUInt8(CMD_TYPE_READMEM);
+    batchValue(batch, address);
+}
+
+// add a poll memory operation to a batch
+// address and mask can be slot names
+function batchPollMemory(batch, address, mask)
+{
+    batch.queueUInt8(CMD_TYPE_WAITMEMTRUE);
+    batchValue(batch, address);
+    batchValue(batch, mask);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Asynchronous functions
+//
+// executeAsync() sends the command queue and returns a handle
+// without waiting for the result. Functions started with
+// runTasks run as coroutines: await(handle) suspends the task
+// until the result has arrived, so other tasks can queue and
+// send their packets in the meantime. Results arrive in the
+// order the packets were sent.
+//
+// Example:
+//   runTasks([ function() { ... await(executeAsync()) ... },
+//              function() { ... } ]);
+////////////////////////////////////////////////////////////////////////////////
+
+asyncTasksRunning <- false;
+
+// wait for the result of an asynchronous packet and move
+// it to the result queue. Returns 0 if ok, like executeCmdQueue.
+function await(handle)
+{
+    if (handle == 0)
+    {
+        return 2;
+    }
+    if (asyncTasksRunning)
+    {
+        while(!asyncReady(handle))
+        {
+            // the scheduler wakes us with false when the
+            // result was lost
+            if (suspend(handle) == false)
+            {
+                break;
+            }
+        }
+    }
+    return awaitResult(handle);
+}
+
+// run an array of functions as cooperative tasks
+// until all of them have finished
+function runTasks(funcs)
+{
+    local tasks = [];
+    local waiting = [];
+    asyncTasksRunning = true;
+    foreach(f in funcs)
+    {
+        local t = newthread(f);
+        tasks.append(t);
+        waiting.append(t.call());
+    }
+
+    while(true)
+    {
+        local active = 0;
+        local woken = 0;
+        foreach(i,t in tasks)
+        {
+            if (t.getstatus() != "suspended")
+            {
+                continue;
+            }
+            active++;
+            if ((waiting[i] == null) || asyncReady(waiting[i]))
+            {
+                waiting[i] = t.wakeup(true);
+                woken++;
+            }
+        }
+
+        if (active == 0)
+        {
+            break;
+        }
+
+        if (woken == 0)
+        {
+            // nothing to do until the next result arrives
+            if (asyncReceiveNext() == 0)
+            {
+                logmsg(LOG_ERROR, "ERROR: runTasks lost the outstanding results\n");
+                foreach(i,t in tasks)
+                {
+                    if (t.getstatus() == "suspended")
+                    {
+                        waiting[i] = t.wakeup(false);
+                    }
+                }
+            }
+        }
+    }
+    asyncTasksRunning = false;
+
+    // the results that a finished task did not await
+    // can no longer be collected
+    asyncDiscard();
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // Immediate functions
 ////////////////////////////////////////////////////////////////////////////////
@@ -330,7 +496,6 @@ function readMemoryWords(address, words)
         logmsg(LOG_ERROR, "Error: readMemoryWords failed: too many words requested\n");
         return -1;
     }
-    local contents = array(0,0);
     for(local i=0; i<words; i++)
     {
         queueReadMemory(address);
@@ -340,11 +505,7 @@ function readMemoryWords(address, words)
     local status = popUInt8();
     if (status == CMD_STATUS_OK)
     {
-        for(local i=0; i<words; i++)
-        {
-            contents.append(popUInt32());
-        }
-        return contents;
+        return popUInt32Array(words);
     }
     logmsg(LOG_ERROR, "Error: readMemoryWords failed: " + format("%02X", status) + "\n");
     return status;
@@ -366,13 +527,18 @@ function writeMemory(address, value)
 
 // read a core register
 // this only works when the core is in debug mode!
+// returns 0 if the read failed.
 function readCoreRegister(regID)
 {
     // NOTE: system must be in debug mode!
-    // first request a register read
-    // then read it!
-    writeMemory(SCS_DCRSR, regID);
-    return readMemory(SCS_DCRDR);
+    // the interface selects the register, waits
+    // for S_REGRDY and reads it in one round trip.
+    local values = readCoreRegisters([regID]);
+    if (values == null)
+    {
+        return 0;
+    }
+    return values[0];
 }
 
 // write to a core register
@@ -380,84 +546,257 @@ function readCoreRegister(regID)
 function writeCoreRegister(regID, value)
 {
     // NOTE: system must be in debug mode!
-    // first write the register value
-    // then request a register write
-    writeMemory(SCS_DCRDR, value);        
-    return writeMemory(SCS_DCRSR, (regID & 0x1F) | DCRSR_WRITE);
+    local values = {};
+    values[regID] <- value;
+    return writeCoreRegisters(values);
 }
 
 // dump all registers to the console
 // this only works when the core is in debug mode!
 function showRegisters()
 {
+    local regs = [];
     for(local i=0; i<16; i+=1)
     {
-        print(format("r%d = %08X\n", i, readCoreRegister(i)));
+        regs.append(i);
+    }
+    local values = readCoreRegisters(regs);
+    if (values == null)
+    {
+        return;
+    }
+    foreach(i, value in values)
+    {
+        print(format("r%d = %08X\n", i, value));
     }
 }
 
-// compare the flash with the binary file
-function verifyFlash()
+// compare a range of the flash with the
+// firmware image by reading it back
+// returns 0 if ok, else -1.
+function verifyFlashRange(image, address, bytes)
 {
-    logmsg(LOG_INFO, "Verifying " + binFile + "\n");
-    local myfile;
-    try
+    // get the memory contents in a blob
+    local targetContents = readMemoryBlock(address, bytes);
+    if (targetContents == null)
     {
-        myfile = file(binFile,"rb");
+        logmsg(LOG_ERROR, "ERROR: reading the flash failed\n");
+        return -1;
     }
-    catch(error)
+    
+    // compare the memory contents with the file
+    local mismatches = image.mismatches(address, targetContents);
+    if (mismatches == null)
     {
-        logmsg(LOG_ERROR, "Cannot open file " + binFile + "\n");
         return -1;
     }
+    if (mismatches.len() == 0)
+    {
+        return 0;
+    }
     
-    local myblob = myfile.readblob(myfile.len());    
-    logmsg(LOG_INFO, format("Binary data is %d bytes\n", myblob.len()));
-    
-    // check that the binary file is indeed a whole number of words
-    if ((myblob.len() % 4) != 0)
+    // report all the mismatching ranges, with the
+    // first word of each.
+    local total = 0;
+    foreach(m in mismatches)
+    {
+        total += m.size;
+    }
+    logmsg(LOG_ERROR, format("\nVerify failed: %d bytes differ in %d ranges\n", total, mismatches.len()));
+    foreach(i,m in mismatches)
+    {
+        if (i == VERIFY_MAXREPORT)
+        {
+            logmsg(LOG_ERROR, format("  ... and %d more ranges\n", mismatches.len() - i));
+            break;
+        }
+        local first = (m.address < address) ? address : m.address;
+        targetContents.seek(first - address);
+        local flashWord = targetContents.readn('i') & 0xFFFFFFFF;
+        local word = image.readUInt32(first) & 0xFFFFFFFF;
+        logmsg(LOG_ERROR, format("  0x%08X..0x%08X  flash: 0x%08X  file: 0x%08X\n",
+            m.address, m.address + m.size - 1, flashWord, word));
+    }
+    return -1;
+}
+
+// compare a range of the flash with the firmware
+// image by letting the interface checksum the flash
+// in blocks of VERIFY_BLOCKSIZE bytes. Only blocks
+// with a checksum mismatch are read back, and all
+// of them are reported.
+// returns 0 if ok, else -1.
+function verifyFlashChecksum(image, address, bytes)
+{
+    // each checksum command takes 9 bytes
+    // and returns 4 bytes.
+    local info = getInterfaceInfo();
+    local blocksPerPacket = (info.rxBufSize - 1) / 9;
+    if (blocksPerPacket > info.txBufSize / 4)
     {
-        logmsg(LOG_WARNING, format("Data is not a whole number of 32-bit words!\n"));
+        blocksPerPacket = info.txBufSize / 4;   // result must fit in the reply
     }
     
-    local wordsLeft = myblob.len() / 4;
-    local address = 0;
-    while(wordsLeft > 0)
+    local result = 0;
+    local endAddress = address + bytes;
+    while(address < endAddress)
     {
-        local wordCount = wordsLeft;    // number of words to read in one go.
-        if (wordCount > 6)
+        clearCmdQueue();
+        local lengths = [];
+        local start = address;
+        while((address < endAddress) && (lengths.len() < blocksPerPacket))
         {
-            wordCount = 6;
+            local blockBytes = endAddress - address;
+            if (blockBytes > VERIFY_BLOCKSIZE)
+            {
+                blockBytes = VERIFY_BLOCKSIZE;
+            }
+            queueChecksumMemory(address, blockBytes);
+            lengths.append(blockBytes);
+            address += blockBytes;
         }
         
-        // get the memory contents in an array
-        local targetContents = readMemoryWords(address, wordCount);
-        if (typeof targetContents != "array")
+        if (executeCmdQueue() != 0)
+        {
+            logmsg(LOG_ERROR, "ERROR: command queue execution failed\n");
+            return -1;
+        }
+        local status = popUInt8();
+        if (status != CMD_STATUS_OK)
         {
-            logmsg(LOG_ERROR, "ERROR: Expected array\n");
+            logmsg(LOG_ERROR, "Error: checksum failed: " + format("%02X", status) + "\n");
             return -1;
         }
         
-        // compare the memory contents with the file
-        for(local i=0; i<wordCount; i++)
+        foreach(blockBytes in lengths)
         {
-            local word = myblob.readn('i'); // read word from file
-            if (word != targetContents[i])
+            local crc = popUInt32();
+            if (crc != image.crc32(start, blockBytes))
             {
-                logmsg(LOG_ERROR, "\nVerify failed at address " + format("0x%08X",address+(i*4)) + "\n");
-                logmsg(LOG_ERROR, "  flash: " + format("0x%08X",targetContents[i]) + "\n  file : " + format("0x%08X",word) + "\n");
-                return -1;
+                logmsg(LOG_DEBUG, format("Checksum mismatch in block at 0x%08X\n", start));
+                // find the offending words, and carry on
+                // to report all the failing blocks
+                if (verifyFlashRange(image, start, blockBytes) != 0)
+                {
+                    result = -1;
+                }
             }
+            start += blockBytes;
+            progressAdvance(blockBytes);
         }
-        address += wordCount*4;
-        wordsLeft -= wordCount;
     }
-    logmsg(LOG_INFO, "\nVerify complete!\n");
+    return result;
+}
+
+// set by the flash drivers when the sectors were
+// verified while they were programmed
+programVerified <- false;
+
+// compare the flash with the firmware file.
+// only the address ranges that are in the
+// file are verified.
+function verifyFlash()
+{
+    if (::programVerified)
+    {
+        ::programVerified = false;
+        logmsg(LOG_INFO, "Verified while programming " + binFile + "\n");
+        return 0;
+    }
+
+    logmsg(LOG_INFO, "Verifying " + binFile + "\n");
+    local image = loadImage(binFile);
+    if (image == null)
+    {
+        logmsg(LOG_ERROR, "Cannot load file " + binFile + "\n");
+        return -1;
+    }
     
-    myfile.close();    
+    // collect the words that are completely inside the segments
+    local ranges = [];
+    local total = 0;
+    foreach(seg in image.segments())
+    {
+        logmsg(LOG_INFO, format("Segment 0x%08X: %d bytes\n", seg.address, seg.size));
+        
+        // check that the segment is indeed a whole number of words
+        if (((seg.address % 4) != 0) || ((seg.size % 4) != 0))
+        {
+            logmsg(LOG_WARNING, format("Segment is not a whole number of 32-bit words!\n"));
+        }
+        
+        local start = (seg.address + 3) & ~3;
+        local bytes = (seg.address + seg.size - start) & ~3;
+        if (bytes > 0)
+        {
+            ranges.append({address = start, size = bytes});
+            total += bytes;
+        }
+    }
+    
+    local info = getInterfaceInfo();
+    local useChecksum = (info != null) && (info.version >= 3);
+    local result = 0;
+    logProgressBegin("Verifying", total);
+    foreach(r in ranges)
+    {
+        if (useChecksum)
+        {
+            if (verifyFlashChecksum(image, r.address, r.size) != 0)
+            {
+                result = -1;
+            }
+            continue;
+        }
+        
+        for(local offset = 0; offset < r.size; offset += VERIFY_BLOCKSIZE)
+        {
+            local bytes = r.size - offset;
+            if (bytes > VERIFY_BLOCKSIZE)
+            {
+                bytes = VERIFY_BLOCKSIZE;
+            }
+            if (verifyFlashRange(image, r.address + offset, bytes) != 0)
+            {
+                result = -1;
+            }
+            progressAdvance(bytes);
+        }
+    }
+    progressEnd();
+    
+    if (result != 0)
+    {
+        return -1;
+    }
+    
+    logmsg(LOG_INFO, "\nVerify complete!\n");
     return 0;
 }
 
+// compare the time it takes to verify the flash
+// using checksums and using read back.
+function benchmarkVerify()
+{
+    local image = loadImage(binFile);
+    if (image == null)
+    {
+        return;
+    }
+    local seg = image.segments()[0];
+    local bytes = seg.size & ~3;
+    
+    local t0 = getMillis();
+    local r1 = verifyFlashRange(image, seg.address, bytes);
+    local t1 = getMillis();
+    local r2 = verifyFlashChecksum(image, seg.address, bytes);
+    local t2 = getMillis();
+    
+    print(format("Verify %d bytes:\n", bytes));
+    print(format("  read back : %6d ms (result %d)\n", t1-t0, r1));
+    print(format("  checksum  : %6d ms (result %d)\n", t2-t1, r2));
+}
+
 // clear sticky SWD errors
 function clearStickyErrors()
 {
@@ -4,9 +4,13 @@
 // Each target must register itself via an auto-execute script
 // that appends a target info table to the global targets table.
 //
+// The target scripts are not loaded up front: the manifest
+// (manifest.nut) tells which scripts support which part, and
+// selectTarget() loads only the scripts of the connected part.
+//
 // The target info table must hold the follwing:
 //   .name          - (string) the human readable name of the target
-//   .idcode        - (integer) the IDCODE of the chip supported
+//   .idcode        - (integer) the DP IDCODE of the chip supported
 //   .flasherase    - (function) a function that erases the entire flash
 //   .upload        - (function) a function that uploads/fashes a binary file
 //
@@ -25,6 +29,8 @@
 // *************************************
 targets <- [];      // create an empty targets array
 targetIDx <- -1;    // current target in use, -1 if none selected
+targetIndex <- {};  // manifest entries by IDCODE
+loadedScripts <- {};// target scripts and plugins loaded so far
 
 // *************************************
 // Target baseclass
@@ -73,6 +79,21 @@ class TargetBase
         return -1;
     }
     
+    // verify the flash against binFile
+    // return 0 if ok, else -1.
+    function flash_verify()
+    {
+        return verifyFlash();
+    }
+
+    // read the unique id of the part
+    // returns a hex string, or null if
+    // the part has none or it cannot be read.
+    function readUID()
+    {
+        return null;
+    }
+    
     function getName()
     {
         return name;
@@ -97,5 +118,244 @@ function registerTarget(target_info)
     ::targets.append(target_info);
 }
 
+// *************************************
+// target manifest
+// *************************************
+//
+// Each manifest entry is a table holding:
+//   .name      - (string) the name of the target the scripts register
+//   .idcode    - (integer) the DP IDCODE
+//   .ap        - (optional) {address, value}: an AP register, such as
+//                the IDR of a vendor specific AP, and its value
+//   .part      - (optional) {address, mask, values}: a memory mapped
+//                part ID register, such as the Kinetis SIM_SDID, and
+//                the masked values of the supported parts
+//   .scripts   - (array) the scripts to load, relative to scriptDir,
+//                in load order
+//   .plugin    - (string) or the native plugin to load, relative to
+//                pluginDir and without the .so/.dll suffix
+//
+// The entries are indexed on IDCODE. Many parts share an IDCODE, so
+// the entries with the same IDCODE are tried in order: list the most
+// specific ones first.
+//
+
+// add entries to the manifest
+function registerManifest(entries)
+{
+    foreach(entry in entries)
+    {
+        if (!(entry.idcode in ::targetIndex))
+        {
+            ::targetIndex[entry.idcode] <- [];
+        }
+        ::targetIndex[entry.idcode].append(entry);
+    }
+}
+
+// find the manifest entry of the connected part
+// returns null if there is none.
+function findTarget(idcode)
+{
+    if (!(idcode in ::targetIndex))
+    {
+        return null;
+    }
+    
+    // every register is read once, no matter
+    // how many entries check it.
+    local apRegs = {};
+    local memRegs = {};
+    foreach(entry in ::targetIndex[idcode])
+    {
+        if ("ap" in entry)
+        {
+            if (!(entry.ap.address in apRegs))
+            {
+                apRegs[entry.ap.address] <- readAP(entry.ap.address);
+            }
+            if (apRegs[entry.ap.address] != entry.ap.value)
+            {
+                continue;
+            }
+        }
+        if ("part" in entry)
+        {
+            if (!(entry.part.address in memRegs))
+            {
+                memRegs[entry.part.address] <- readMemory(entry.part.address);
+            }
+            if (entry.part.values.find(memRegs[entry.part.address] & entry.part.mask) == null)
+            {
+                continue;
+            }
+        }
+        return entry;
+    }
+    return null;
+}
+
+// load the scripts of a manifest entry and select its target
+// returns the target object, or null if the scripts did
+// not register the target.
+function loadTarget(entry)
+{
+    if ("plugin" in entry)
+    {
+        if (!(entry.plugin in ::loadedScripts))
+        {
+            logmsg(LOG_DEBUG, "Loading plugin " + entry.plugin + "\n");
+            registerPlugin(::pluginDir + entry.plugin);
+            ::loadedScripts[entry.plugin] <- true;
+        }
+    }
+    else
+    {
+        foreach(script in entry.scripts)
+        {
+            if (!(script in ::loadedScripts))
+            {
+                logmsg(LOG_DEBUG, "Loading " + script + "\n");
+                dofile(::scriptDir + script);
+                ::loadedScripts[script] <- true;
+            }
+        }
+    }
+    
+    foreach(idx, target in ::targets)
+    {
+        if (target.getName() == entry.name)
+        {
+            ::targetIDx = idx;
+            return target;
+        }
+    }
+    logmsg(LOG_ERROR, "The scripts of " + entry.name + " did not register it!\n");
+    return null;
+}
+
+// *************************************
+// Native targets
+// *************************************
+//
+// A NativeTarget is a target implemented by a driver of a native
+// plugin (see include/swagger_plugin.h), so it can be used like a
+// target written in Squirrel.
+//
+class NativeTarget extends TargetBase
+{
+    driver = null
+    
+    constructor(nativeDriver)
+    {
+        driver = nativeDriver;
+        name = driver.name();
+        idcode = driver.idcode();
+    }
+    
+    function check()
+    {
+        return driver.has("check") ? driver.check() : -1;
+    }
+    
+    function halt()
+    {
+        return driver.has("halt") ? driver.halt() : -1;
+    }
+    
+    function reset(state)
+    {
+        return driver.has("reset") ? driver.reset(state) : -1;
+    }
+    
+    function flash_erase()
+    {
+        return driver.has("erase") ? driver.erase() : -1;
+    }
+    
+    function flash_program()
+    {
+        if (!driver.has("program"))
+        {
+            logmsg(LOG_ERROR, name + " cannot program the flash\n");
+            return -1;
+        }
+        
+        logmsg(LOG_INFO, "Flashing " + binFile + "\n");
+        local image = loadImage(binFile);
+        if (image == null)
+        {
+            logmsg(LOG_ERROR, "Cannot load file " + binFile + "\n");
+            return -1;
+        }
+        
+        logProgressBegin("Programming", image.totalBytes());
+        local result = driver.program(image);
+        progressEnd();
+        return result;
+    }
+    
+    function flash_verify()
+    {
+        if (!driver.has("verify"))
+        {
+            return verifyFlash();
+        }
+        
+        logmsg(LOG_INFO, "Verifying " + binFile + "\n");
+        local image = loadImage(binFile);
+        if (image == null)
+        {
+            logmsg(LOG_ERROR, "Cannot load file " + binFile + "\n");
+            return -1;
+        }
+        
+        logProgressBegin("Verifying", image.totalBytes());
+        local result = driver.verify(image);
+        progressEnd();
+        return result;
+    }
+}
+
+// load a native plugin and register its targets
+// returns the number of targets registered, or -1
+// if the plugin cannot be loaded.
+function registerPlugin(filename)
+{
+    local drivers = loadTargetPlugin(filename);
+    if (drivers == null)
+    {
+        return -1;
+    }
+    foreach(driver in drivers)
+    {
+        registerTarget(NativeTarget(driver));
+    }
+    return drivers.len();
+}
+
+// connect to the target and select the target
+// that supports the connected part.
+// returns the target object, or null if the part
+// is not supported.
+function selectTarget()
+{
+    local idcode = connect();
+    if (idcode == -1)
+    {
+        logmsg(LOG_ERROR, "Cannot connect to the target!\n");
+        return null;
+    }
+    
+    local entry = findTarget(idcode);
+    if (entry == null)
+    {
+        logmsg(LOG_ERROR, format("No target supports the part with IDCODE %08X\n", idcode));
+        return null;
+    }
+    logmsg(LOG_INFO, "Target: " + entry.name + "\n");
+    return loadTarget(entry);
+}
+
 
 logmsg(LOG_DEBUG, "Loaded targets.nut\n");
\ No newline at end of file
@@ -0,0 +1,127 @@
+/*
+
+  Swagger - A tool for programming ARM processors using the SWD protocol
+
+  Niels A. Moseley (c) Moseley Instruments 2016
+
+  nutbundle: compiles the target scripts to bytecode and writes
+  them as a C++ source file defining g_scriptBundle.
+
+  usage: nutbundle <output.cpp> <targets dir> <script.nut> ...
+
+  The scripts are compiled in the given order, in one VM, so
+  constants are resolved as they are when init.nut loads them.
+
+*/
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <string>
+#include "scriptcache.h"
+
+static void printfunc(HSQUIRRELVM, const SQChar *s, ...)
+{
+    va_list vl;
+    va_start(vl, s);
+    vfprintf(stderr, s, vl);
+    va_end(vl);
+}
+
+static void compile_error_handler(HSQUIRRELVM, const SQChar *desc, const SQChar *source,
+    SQInteger line, SQInteger column)
+{
+    fprintf(stderr, "%s:%d:%d: error: %s\n", source, (int)line, (int)column, desc);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 3)
+    {
+        fprintf(stderr, "usage: nutbundle <output.cpp> <targets dir> <script.nut> ...\n");
+        return 1;
+    }
+
+    std::string root = argv[2];
+    if (!root.empty() && (root[root.size()-1] != '/') && (root[root.size()-1] != '\\'))
+    {
+        root += '/';
+    }
+
+    HSQUIRRELVM v = sq_open(1024);
+    sq_setprintfunc(v, printfunc, printfunc);
+    sq_setcompilererrorhandler(v, compile_error_handler);
+
+    std::string out;
+    out += "/* generated by nutbundle, do not edit */\n\n";
+    out += "#include \"scriptbundle.h\"\n\n";
+
+    std::string table;
+    table += "const ScriptBundleEntry g_scriptBundle[] =\n{\n";
+
+    bool ok = true;
+    for(int i=3; ok && (i<argc); i++)
+    {
+        std::string filename = argv[i];
+        if (filename.compare(0, root.size(), root) != 0)
+        {
+            fprintf(stderr, "Error: %s is not in %s\n", argv[i], root.c_str());
+            ok = false;
+            break;
+        }
+
+        std::string name = filename.substr(root.size());
+        for(size_t k=0; k<name.size(); k++)
+        {
+            if (name[k] == '\\')
+            {
+                name[k] = '/';
+            }
+        }
+
+        std::string entry;
+        std::string debugName = SCRIPT_BUNDLE_DIR + name;
+        if (!ScriptCache::compileEntry(v, filename.c_str(), debugName.c_str(), entry))
+        {
+            ok = false;
+            break;
+        }
+
+        char line[128];
+        snprintf(line, sizeof(line), "static const uint8_t script%d[%d] =\n{", i-3, (int)entry.size());
+        out += line;
+        for(size_t k=0; k<entry.size(); k++)
+        {
+            snprintf(line, sizeof(line), "%s0x%02X,", (k % 16) ? " " : "\n    ", (uint8_t)entry[k]);
+            out += line;
+        }
+        out += "\n};\n\n";
+
+        snprintf(line, sizeof(line), "script%d, %d},\n", i-3, (int)entry.size());
+        table += "    {\"" + name + "\", " + line;
+    }
+    table += "    {0, 0, 0}\n};\n";
+    sq_close(v);
+
+    if (!ok)
+    {
+        return 1;
+    }
+
+    FILE *f = fopen(argv[1], "wb");
+    if (f == 0)
+    {
+        fprintf(stderr, "Error: cannot write %s\n", argv[1]);
+        return 1;
+    }
+    out += table;
+    ok = (fwrite(out.data(), 1, out.size(), f) == out.size());
+    ok = (fclose(f) == 0) && ok;
+    if (!ok)
+    {
+        fprintf(stderr, "Error: cannot write %s\n", argv[1]);
+        remove(argv[1]);
+        return 1;
+    }
+    return 0;
+}